@@ -0,0 +1,79 @@
+#include <cstring>
+#include "arena.h"
+
+Arena* Arena::current_ = nullptr;
+
+namespace
+{
+
+/// the arenas of lines that are done, ready for the next ones. never
+/// destroyed: lines still held at exit give theirs back after statics go
+std::vector<std::unique_ptr<Arena>>& pool()
+{
+	static auto arenas = new std::vector<std::unique_ptr<Arena>>;
+	return *arenas;
+}
+
+}
+
+void* Arena::allocate(std::size_t n, std::size_t align)
+{
+	if (n > CHUNK / 4) {
+		big_.emplace_back(new char[n]);
+		return big_.back().get();
+	}
+	for (;;) {
+		if (chunk_ == chunks_.size()) {
+			chunks_.emplace_back(new char[CHUNK]);
+			pos_ = 0;
+		}
+		std::size_t at = (pos_ + align - 1) & ~(align - 1);
+		if (at + n <= CHUNK) {
+			pos_ = at + n;
+			return chunks_[chunk_].get() + at;
+		}
+		++chunk_;
+		pos_ = 0;
+	}
+}
+
+char* Arena::copy(const char* s, std::size_t n)
+{
+	auto word = static_cast<char*>(allocate(n + 1, 1));
+	std::memcpy(word, s, n);
+	word[n] = '\0';
+	return word;
+}
+
+void Arena::reset()
+{
+	chunk_ = 0;
+	pos_ = 0;
+	big_.clear();
+}
+
+Arena& Arena::current()
+{
+	if (current_) {
+		return *current_;
+	}
+	static Arena global;
+	return global;
+}
+
+void Arena::Release::operator()(Arena* a) const
+{
+	a->reset();
+	pool().emplace_back(a);
+}
+
+Arena::Lease Arena::acquire()
+{
+	auto& arenas = pool();
+	if (arenas.empty()) {
+		return Lease(new Arena);
+	}
+	Lease a(arenas.back().release());
+	arenas.pop_back();
+	return a;
+}
@@ -0,0 +1,101 @@
+#ifndef ARENA_H__
+#define ARENA_H__
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/// bump allocation for everything one command line is made of: the
+/// nodes, their argv arrays and the words in them. nothing is freed on
+/// its own; reset() takes it all back at once and keeps the memory for
+/// the next line
+class Arena
+{
+public:
+	Arena() = default;
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	void* allocate(std::size_t n, std::size_t align = alignof(std::max_align_t));
+	/// s[0, n) and a '\0', as an argv word
+	char* copy(const char* s, std::size_t n);
+	/// forget every allocation. the chunks stay for reuse
+	void reset();
+
+	/// the arena nodes and words go to: the innermost ArenaScope's, or
+	/// one that is never reset when there is none
+	static Arena& current();
+
+	struct Release
+	{
+		void operator()(Arena* a) const;
+	};
+	/// an arena for one line, back in the pool and reset once let go
+	using Lease = std::unique_ptr<Arena, Release>;
+	static Lease acquire();
+
+private:
+	static constexpr std::size_t CHUNK = 64 * 1024;
+
+	std::vector<std::unique_ptr<char[]>> chunks_;
+	/// allocations too big for a chunk, freed on reset
+	std::vector<std::unique_ptr<char[]>> big_;
+	std::size_t chunk_ = 0;
+	std::size_t pos_ = 0;
+
+	friend class ArenaScope;
+	static Arena* current_;
+};
+
+/// makes an arena current for as long as it lives
+class ArenaScope
+{
+public:
+	explicit ArenaScope(Arena& a) : prev_(Arena::current_) { Arena::current_ = &a; }
+	ArenaScope(const ArenaScope&) = delete;
+	~ArenaScope() { Arena::current_ = prev_; }
+
+private:
+	Arena* prev_;
+};
+
+/// lets standard containers live in an arena. a default-made one takes
+/// the current arena, so members of a node share the node's
+template<typename T>
+class ArenaAllocator
+{
+public:
+	using value_type = T;
+
+	ArenaAllocator() : arena_(&Arena::current()) {}
+	explicit ArenaAllocator(Arena& a) : arena_(&a) {}
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) {}
+
+	T* allocate(std::size_t n) {
+		return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+	}
+	void deallocate(T*, std::size_t) {}
+
+	Arena* arena() const { return arena_; }
+
+private:
+	Arena* arena_;
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+	return a.arena() == b.arena();
+}
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+	return a.arena() != b.arena();
+}
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif
@@ -0,0 +1,105 @@
+// throughput of capturing a command's output: the old 512-byte reads
+// appended to a std::string, a Capture that keeps it all in memory, and
+// one that spills to a memfd past its default cap.
+// usage: benchcapture [MB]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "capture.h"
+
+namespace
+{
+
+/// fork a writer of mb megabytes of text lines; returns the read end
+int producer(std::size_t mb, pid_t* pid)
+{
+	int fd[2];
+	if (pipe(fd) < 0) {
+		std::perror("pipe error");
+		std::exit(1);
+	}
+	*pid = fork();
+	if (*pid < 0) {
+		std::perror("fork error");
+		std::exit(1);
+	} else if (*pid == 0) {
+		close(fd[0]);
+		static char buf[1024 * 1024];
+		std::memset(buf, 'x', sizeof(buf));
+		for (std::size_t i = 63; i < sizeof(buf); i += 64) {
+			buf[i] = '\n';
+		}
+		for (std::size_t i = 0; i < mb; ++i) {
+			for (std::size_t off = 0; off < sizeof(buf); ) {
+				ssize_t n = write(fd[1], buf + off, sizeof(buf) - off);
+				if (n <= 0) {
+					_exit(1);
+				}
+				off += n;
+			}
+		}
+		_exit(0);
+	}
+	close(fd[1]);
+	return fd[0];
+}
+
+void report(const char* name, std::size_t mb, std::size_t got,
+			std::chrono::steady_clock::time_point beg)
+{
+	std::chrono::duration<double> d = std::chrono::steady_clock::now() - beg;
+	if (got != mb * 1024 * 1024) {
+		std::fprintf(stderr, "%s: captured %zu bytes\n", name, got);
+		std::exit(1);
+	}
+	std::printf("%-22s %8.0f MB/s\n", name, mb / d.count());
+}
+
+void oldWay(std::size_t mb)
+{
+	pid_t pid;
+	auto beg = std::chrono::steady_clock::now();
+	int fd = producer(mb, &pid);
+	std::string ret;
+	char buf[512];
+	ssize_t n;
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		ret.append(buf, buf + n);
+	}
+	close(fd);
+	waitpid(pid, nullptr, 0);
+	report("512B reads + append", mb, ret.size(), beg);
+}
+
+void capture(const char* name, std::size_t mb, std::size_t cap)
+{
+	pid_t pid;
+	auto beg = std::chrono::steady_clock::now();
+	int fd = producer(mb, &pid);
+	Capture c(cap);
+	if (!c.drain(fd)) {
+		std::perror("capture error");
+		std::exit(1);
+	}
+	close(fd);
+	waitpid(pid, nullptr, 0);
+	// touch the result the way the expander does
+	volatile std::size_t len = c.text().size();
+	(void)len;
+	report(name, mb, c.size(), beg);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	std::size_t mb = argc > 1 ? std::atoi(argv[1]) : 1024;
+	std::printf("capturing %zu MB\n", mb);
+	oldWay(mb);
+	capture("capture in memory", mb, (mb + 1) * 1024 * 1024);
+	capture("capture, memfd spill", mb, Capture::defaultCap());
+}
@@ -0,0 +1,171 @@
+// heap allocations made by expansion and lexing, counted by replacing
+// operator new. expandDollar() on its own should make none once warm;
+// nor should a whole line, whose nodes and argv words go to an arena
+// that is reset after each one, as the shell does after each line.
+// then the same lines again through the line cache, where only their
+// holes are lexed.
+// usage: benchexpand [iterations]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <unistd.h>
+#include "arena.h"
+#include "context.h"
+#include "capture.h"
+#include "executor.h"
+#include "expand.h"
+#include "linecache.h"
+#include "nodes.h"
+#include "parse.h"
+#include "vars.h"
+
+namespace
+{
+
+std::size_t allocs = 0;
+
+}
+
+void* operator new(std::size_t n)
+{
+	++allocs;
+	if (void* p = std::malloc(n ? n : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+// what shell.cpp provides, as far as lexing gets to it. the lines
+// below have no $(...), so nothing is ever run
+Context& getContext()
+{
+	static Context context;
+	return context;
+}
+
+bool captureCmdOutput(std::unique_ptr<NodeBase>&, Capture&) { return false; }
+pid_t startCmdOutput(std::unique_ptr<NodeBase>&, int*) { return -1; }
+pid_t startCmdInput(std::unique_ptr<NodeBase>&, int*) { return -1; }
+void becomeTtyFgPgrp() {}
+void doBg(int) {}
+void doFg(int) {}
+void Executor::visit(Exec*) {}
+void Executor::visit(Pipe*) {}
+void Executor::visit(Group*) {}
+void Executor::visit(Ordered*) {}
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+double since(Clock::time_point beg)
+{
+	return std::chrono::duration<double>(Clock::now() - beg).count();
+}
+
+/// every $ construct of the text, one after the other, into one buffer
+void expandAll(const char* text, std::string& out)
+{
+	out.clear();
+	for (const char* p = text; *p; ) {
+		if (*p == '$') {
+			expandDollar(p, out);
+		} else {
+			out.push_back(*p++);
+		}
+	}
+}
+
+/// what a simple command puts in the arena: the node, its argv array
+/// and the words in it, argv ending in a null
+std::size_t handedOut(NodeBase* node)
+{
+	return node->isExec() ? 1 + static_cast<Exec*>(node)->argv.size() : 1;
+}
+
+const char* const dollars[] = {
+	"$HOME",
+	"${PATH}",
+	"$? $$",
+	"$((1 + 2 * 3)) $((-(4 - 10) / 2)) $((1.5 * 2))",
+	"$(( $((2 + 2)) * $? ))",
+};
+
+const char* const lines[] = {
+	"echo hello world",
+	"ls -l $HOME/src > /tmp/out",
+	"echo \"$USER:$((1+2*3))\" ${PATH} $? 'a b'",
+	"cc -O2 -c -o main.o main.c",
+};
+
+}
+
+int main(int argc, char* argv[])
+{
+	long iters = argc > 1 ? std::atol(argv[1]) : 100000;
+	auto& vars = getVarStore();
+	vars.set("HOME", "/home/user");
+	vars.set("USER", "user");
+	vars.set("PATH", "/usr/local/bin:/usr/bin:/bin");
+
+	std::string out;
+	for (const char* text : dollars) {
+		expandAll(text, out);	// warm up
+		std::size_t before = allocs;
+		auto beg = Clock::now();
+		for (long i = 0; i < iters; ++i) {
+			expandAll(text, out);
+		}
+		double t = since(beg);
+		std::printf("expand %-46s %6.2f allocs  %7.1f ns\n", text,
+					double(allocs - before) / iters, t / iters * 1e9);
+	}
+
+	Arena arena;
+	ArenaScope scope(arena);
+	for (const char* line : lines) {
+		parseCmdLine(line);
+		arena.reset();
+		std::size_t before = allocs;
+		std::size_t words = 0;
+		auto beg = Clock::now();
+		for (long i = 0; i < iters; ++i) {
+			{
+				auto res = parseCmdLine(line);
+				words = handedOut(res.first.get());
+			}
+			arena.reset();
+		}
+		double t = since(beg);
+		std::printf("parse  %-46s %6.2f allocs  %7.1f ns  (%zu in the arena)\n", line,
+					double(allocs - before) / iters, t / iters * 1e9, words);
+	}
+
+	auto& cache = getLineCache();
+	for (const char* line : lines) {
+		const std::string text = line;
+		cache.parse(text);	// the miss that keeps it
+		arena.reset();
+		std::size_t before = allocs;
+		auto beg = Clock::now();
+		for (long i = 0; i < iters; ++i) {
+			cache.parse(text);
+			arena.reset();
+		}
+		double t = since(beg);
+		std::printf("cached %-46s %6.2f allocs  %7.1f ns\n", line,
+					double(allocs - before) / iters, t / iters * 1e9);
+	}
+}
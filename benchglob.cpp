@@ -0,0 +1,129 @@
+// glob expansion over a synthetic tree: **/*.c through globExpand()
+// against find(1) piped back to the caller, as scripts did before.
+// the tree is made once and kept in /tmp.
+// usage: benchglob [files] [runs]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "glob.h"
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+double since(Clock::time_point beg)
+{
+	return std::chrono::duration<double>(Clock::now() - beg).count();
+}
+
+/// 10 x 10 x 10 directories, the files spread over the leaves; one
+/// name in four ends in .c
+std::string makeTree(long files)
+{
+	std::string root = "/tmp/benchglob-" + std::to_string(files);
+	std::string done = root + "/.done";
+	if (access(done.c_str(), F_OK) == 0) {
+		return root;
+	}
+	std::printf("creating %ld files under %s...\n", files, root.c_str());
+	std::fflush(stdout);
+	mkdir(root.c_str(), 0755);
+	long perLeaf = (files + 999) / 1000;
+	long made = 0;
+	for (int a = 0; a < 10; ++a) {
+		std::string da = root + "/d" + std::to_string(a);
+		mkdir(da.c_str(), 0755);
+		for (int b = 0; b < 10; ++b) {
+			std::string db = da + "/d" + std::to_string(b);
+			mkdir(db.c_str(), 0755);
+			for (int c = 0; c < 10; ++c) {
+				std::string dc = db + "/d" + std::to_string(c);
+				mkdir(dc.c_str(), 0755);
+				for (long i = 0; i < perLeaf && made < files; ++i, ++made) {
+					std::string f = dc + "/f" + std::to_string(i) + (i % 4 == 0 ? ".c" : ".h");
+					int fd = open(f.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0644);
+					if (fd < 0) {
+						std::perror("open error");
+						std::exit(1);
+					}
+					close(fd);
+				}
+			}
+		}
+	}
+	close(open(done.c_str(), O_CREAT | O_WRONLY, 0644));
+	return root;
+}
+
+std::size_t viaGlob(const std::string& pattern)
+{
+	std::vector<std::string> out;
+	globForgetDirs();
+	globExpand(pattern, out);
+	return out.size();
+}
+
+/// what `$(find root -name '*.c')` costs: a child, and its output
+/// read back through a pipe
+std::size_t viaFind(const std::string& root)
+{
+	int fd[2];
+	if (pipe(fd) < 0) {
+		std::perror("pipe error");
+		std::exit(1);
+	}
+	pid_t pid = fork();
+	if (pid == 0) {
+		dup2(fd[1], 1);
+		close(fd[0]);
+		close(fd[1]);
+		execlp("find", "find", root.c_str(), "-name", "*.c", (char*)nullptr);
+		_exit(127);
+	}
+	close(fd[1]);
+	std::size_t lines = 0;
+	char buf[65536];
+	ssize_t n;
+	while ((n = read(fd[0], buf, sizeof(buf))) > 0) {
+		lines += std::count(buf, buf + n, '\n');
+	}
+	close(fd[0]);
+	waitpid(pid, nullptr, 0);
+	return lines;
+}
+
+template<typename F>
+void measure(const char* name, int runs, F&& f)
+{
+	std::vector<double> t;
+	std::size_t count = 0;
+	for (int i = 0; i < runs; ++i) {
+		auto beg = Clock::now();
+		count = f();
+		t.push_back(since(beg));
+	}
+	std::sort(t.begin(), t.end());
+	std::printf("%-28s %8zu paths  best %7.3f s  median %7.3f s\n",
+				name, count, t.front(), t[t.size() / 2]);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	long files = argc > 1 ? std::atol(argv[1]) : 1000000;
+	int runs = argc > 2 ? std::atoi(argv[2]) : 5;
+	std::string root = makeTree(files);
+
+	measure("glob root/**/*.c", runs, [&] { return viaGlob(root + "/**/*.c"); });
+	measure("find root -name '*.c'", runs, [&] { return viaFind(root); });
+	measure("glob root/d1/*/*/f1*", runs, [&] { return viaGlob(root + "/d1/*/*/f1*"); });
+}
@@ -0,0 +1,84 @@
+// job table stress: 10k background jobs started, registered and reaped
+// usage: benchjobs [jobs]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "context.h"
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+double msSince(Clock::time_point beg)
+{
+	std::chrono::duration<double, std::milli> d = Clock::now() - beg;
+	return d.count();
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	int n = argc > 1 ? std::atoi(argv[1]) : 10000;
+	Context ctx;
+
+	// every child blocks until the write end goes away, so all n jobs
+	// are alive at once
+	int fd[2];
+	if (pipe(fd) < 0) {
+		std::perror("pipe error");
+		return 1;
+	}
+
+	std::vector<pid_t> pids;
+	pids.reserve(n);
+	auto beg = Clock::now();
+	for (int i = 0; i < n; ++i) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			std::perror("fork error");
+			break;
+		} else if (pid == 0) {
+			close(fd[1]);
+			char c;
+			read(fd[0], &c, 1);
+			_exit(0);
+		}
+		pids.push_back(pid);
+	}
+	double spawnMs = msSince(beg);
+
+	beg = Clock::now();
+	for (pid_t p : pids) {
+		ctx.addJob(p, nullptr);
+	}
+	double addMs = msSince(beg);
+
+	close(fd[0]);
+	close(fd[1]);
+
+	beg = Clock::now();
+	int statloc;
+	pid_t pid;
+	std::size_t reaped = 0;
+	while (reaped < pids.size() && (pid = waitpid(-1, &statloc, 0)) > 0) {
+		ctx.onProcessExited(pid, statloc, true);
+		++reaped;
+	}
+	double reapMs = msSince(beg);
+
+	std::printf("%zu background jobs\n", pids.size());
+	std::printf("fork:            %9.1f ms\n", spawnMs);
+	std::printf("addJob:          %9.1f ms (%.0f ns/job)\n", addMs, addMs * 1e6 / pids.size());
+	std::printf("reap + dispatch: %9.1f ms (%.0f ns/job)\n", reapMs, reapMs * 1e6 / pids.size());
+	std::printf("jobs left: %zu\n", ctx.jobMap.size());
+	// a stand-in job for pid 1: it takes the smallest id given back, and
+	// goes again as if pid 1 had exited
+	int id = ctx.addJob(1, nullptr);
+	std::printf("next id reused: %d\n", id);
+	ctx.onProcessExited(1, 0, true);
+}
@@ -0,0 +1,133 @@
+// lexer throughput on the long lines scripts generate: one command with
+// a few hundred KB of arguments. the scanner is timed on its own, vector
+// against a byte at a time, then whole lines through parseCmdLine().
+// usage: benchlex [kbytes] [runs]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "arena.h"
+#include "charclass.h"
+#include "context.h"
+#include "capture.h"
+#include "executor.h"
+#include "nodes.h"
+#include "parse.h"
+#include "vars.h"
+
+// what shell.cpp provides, as far as lexing gets to it. the lines
+// below have no $(...), so nothing is ever run
+Context& getContext()
+{
+	static Context context;
+	return context;
+}
+
+bool captureCmdOutput(std::unique_ptr<NodeBase>&, Capture&) { return false; }
+pid_t startCmdOutput(std::unique_ptr<NodeBase>&, int*) { return -1; }
+pid_t startCmdInput(std::unique_ptr<NodeBase>&, int*) { return -1; }
+void becomeTtyFgPgrp() {}
+void doBg(int) {}
+void doFg(int) {}
+void Executor::visit(Exec*) {}
+void Executor::visit(Pipe*) {}
+void Executor::visit(Group*) {}
+void Executor::visit(Ordered*) {}
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+double since(Clock::time_point beg)
+{
+	return std::chrono::duration<double>(Clock::now() - beg).count();
+}
+
+/// plain object paths, as a build tool would pass them
+std::string plainLine(std::size_t bytes)
+{
+	std::string line = "ar rcs libout.a";
+	for (int i = 0; line.size() < bytes; ++i) {
+		line += " build/obj/module_" + std::to_string(i % 97) + "/source_file_"
+			+ std::to_string(i) + ".o";
+	}
+	return line;
+}
+
+/// the same with some quoting, variables and long flags mixed in
+std::string mixedLine(std::size_t bytes)
+{
+	std::string line = "cc";
+	for (int i = 0; line.size() < bytes; ++i) {
+		switch (i % 4) {
+		case 0: line += " -DNAME_" + std::to_string(i) + "=\"value with blanks\""; break;
+		case 1: line += " -I$HOME/include/dir_" + std::to_string(i); break;
+		case 2: line += " 'quoted/path/" + std::to_string(i) + ".c'"; break;
+		default: line += " --some-long-option-" + std::to_string(i); break;
+		}
+	}
+	return line;
+}
+
+constexpr ByteSet stop(" \t();&|<>'\"\\$~*?[]");
+
+template<typename F>
+double best(int runs, F&& f)
+{
+	std::vector<double> t;
+	for (int i = 0; i < runs; ++i) {
+		auto beg = Clock::now();
+		f();
+		t.push_back(since(beg));
+	}
+	return *std::min_element(t.begin(), t.end());
+}
+
+void report(const char* name, std::size_t bytes, double t, std::size_t count)
+{
+	std::printf("%-32s %9.1f MB/s  (%zu)\n", name, bytes / t / 1e6, count);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	std::size_t kb = argc > 1 ? std::atol(argv[1]) : 512;
+	int runs = argc > 2 ? std::atoi(argv[2]) : 20;
+	getVarStore().set("HOME", "/home/user");
+
+	const std::string lines[] = { plainLine(kb * 1024), mixedLine(kb * 1024) };
+	const char* names[] = { "plain", "mixed" };
+
+	for (int k = 0; k < 2; ++k) {
+		const std::string& line = lines[k];
+		std::size_t stops = 0;
+		double t = best(runs, [&] {
+			stops = 0;
+			for (char const* p = stop.find(line.c_str()); *p; p = stop.find(p + 1))
+				++stops;
+		});
+		report((std::string("scan, vector, ") + names[k]).c_str(), line.size(), t, stops);
+		t = best(runs, [&] {
+			stops = 0;
+			for (char const* p = stop.findScalar(line.c_str()); *p; p = stop.findScalar(p + 1))
+				++stops;
+		});
+		report((std::string("scan, byte at a time, ") + names[k]).c_str(), line.size(), t, stops);
+
+		Arena arena;
+		ArenaScope scope(arena);
+		std::size_t words = 0;
+		t = best(runs, [&] {
+			{
+				auto res = parseCmdLine(line.c_str());
+				words = res.first ? static_cast<Exec*>(res.first.get())->argv.size() - 1 : 0;
+			}
+			arena.reset();
+		});
+		report((std::string("parseCmdLine, ") + names[k]).c_str(), line.size(), t, words);
+	}
+}
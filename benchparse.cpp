@@ -0,0 +1,157 @@
+// the parser under generated input: long lists, long pipes and groups
+// nested a million deep, each at 1, 2, 4, 8 and 16 MB so a time per MB
+// that stays flat shows it linear. parse, toString() and teardown are
+// timed apart; none of them may run out of stack.
+// usage: benchparse [max MB] [runs]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "arena.h"
+#include "context.h"
+#include "capture.h"
+#include "executor.h"
+#include "nodes.h"
+#include "parse.h"
+
+// what shell.cpp provides, as far as lexing gets to it. the lines
+// below have no $(...), so nothing is ever run
+Context& getContext()
+{
+	static Context context;
+	return context;
+}
+
+bool captureCmdOutput(std::unique_ptr<NodeBase>&, Capture&) { return false; }
+pid_t startCmdOutput(std::unique_ptr<NodeBase>&, int*) { return -1; }
+pid_t startCmdInput(std::unique_ptr<NodeBase>&, int*) { return -1; }
+void becomeTtyFgPgrp() {}
+void doBg(int) {}
+void doFg(int) {}
+void Executor::visit(Exec*) {}
+void Executor::visit(Pipe*) {}
+void Executor::visit(Group*) {}
+void Executor::visit(Ordered*) {}
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+double since(Clock::time_point beg)
+{
+	return std::chrono::duration<double>(Clock::now() - beg).count();
+}
+
+/// words of one command
+std::string words(std::size_t bytes)
+{
+	std::string line = "echo";
+	for (int i = 0; line.size() < bytes; ++i)
+		line += " word_" + std::to_string(i);
+	return line;
+}
+
+/// a; a; a; ...
+std::string list(std::size_t bytes)
+{
+	std::string line;
+	while (line.size() < bytes)
+		line += "a; ";
+	return line + "a";
+}
+
+/// a | a | a ...
+std::string pipe(std::size_t bytes)
+{
+	std::string line = "a";
+	while (line.size() < bytes)
+		line += " | a";
+	return line;
+}
+
+/// ((((a))))
+std::string groups(std::size_t bytes)
+{
+	std::size_t depth = bytes / 2;
+	return std::string(depth, '(') + "a" + std::string(depth, ')');
+}
+
+/// (a; (a; (a; ...)))
+std::string lists(std::size_t bytes)
+{
+	std::size_t depth = bytes / 5;
+	std::string line;
+	line.reserve(depth * 5 + 1);
+	for (std::size_t i = 0; i < depth; ++i)
+		line += "(a; ";
+	line += "a";
+	return line + std::string(depth, ')');
+}
+
+struct Times
+{
+	double parse = 0;
+	double render = 0;
+	double teardown = 0;
+	std::size_t rendered = 0;
+};
+
+Times measure(const std::string& line, int runs)
+{
+	Arena arena;
+	ArenaScope scope(arena);
+	Times best{1e9, 1e9, 1e9, 0};
+	for (int i = 0; i < runs; ++i) {
+		auto beg = Clock::now();
+		auto res = parseCmdLine(line.c_str());
+		best.parse = std::min(best.parse, since(beg));
+		if (!res.first) {
+			std::fprintf(stderr, "benchparse: parse error %d\n", int(res.second));
+			std::exit(1);
+		}
+		beg = Clock::now();
+		best.rendered = res.first->toString().size();
+		best.render = std::min(best.render, since(beg));
+		beg = Clock::now();
+		res.first.reset();
+		best.teardown = std::min(best.teardown, since(beg));
+		arena.reset();
+	}
+	return best;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	std::size_t maxMb = argc > 1 ? std::atol(argv[1]) : 16;
+	int runs = argc > 2 ? std::atoi(argv[2]) : 3;
+
+	struct Shape
+	{
+		const char* name;
+		std::string (*make)(std::size_t);
+	};
+	const Shape shapes[] = {
+		{ "words", words },
+		{ "a; a; ...", list },
+		{ "a | a | ...", pipe },
+		{ "((((a))))", groups },
+		{ "(a; (a; ...))", lists },
+	};
+
+	std::printf("%-14s %5s %12s %12s %12s %12s\n", "", "MB", "parse ms",
+				"ms/MB", "toString ms", "teardown ms");
+	for (const Shape& s : shapes) {
+		for (std::size_t mb = 1; mb <= maxMb; mb *= 2) {
+			std::string line = s.make(mb << 20);
+			Times t = measure(line, runs);
+			std::printf("%-14s %5zu %12.1f %12.2f %12.1f %12.1f\n", s.name, mb,
+						t.parse * 1e3, t.parse * 1e3 / mb, t.render * 1e3,
+						t.teardown * 1e3);
+		}
+	}
+}
@@ -0,0 +1,89 @@
+// lines per second through a script: a generated file of builtin-only
+// lines, run as a script file and fed through a pipe on stdin.
+// usage: benchscript [lines] [shell]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+namespace
+{
+
+double run(const char* shell, const char* script, bool viaStdin)
+{
+	auto beg = std::chrono::steady_clock::now();
+	pid_t pid = fork();
+	if (pid < 0) {
+		std::perror("fork error");
+		std::exit(1);
+	} else if (pid == 0) {
+		if (viaStdin) {
+			int fd = open(script, O_RDONLY);
+			int p[2];
+			if (fd < 0 || pipe(p) < 0) {
+				_exit(126);
+			}
+			// a pipe, not the file: no mmap for the shell
+			if (fork() == 0) {
+				close(p[0]);
+				char buf[65536];
+				ssize_t n;
+				while ((n = read(fd, buf, sizeof(buf))) > 0) {
+					write(p[1], buf, n);
+				}
+				_exit(0);
+			}
+			close(p[1]);
+			dup2(p[0], 0);
+			close(p[0]);
+			execl(shell, shell, (char*)nullptr);
+		} else {
+			execl(shell, shell, script, (char*)nullptr);
+		}
+		_exit(127);
+	}
+	int statloc;
+	waitpid(pid, &statloc, 0);
+	std::chrono::duration<double> d = std::chrono::steady_clock::now() - beg;
+	if (!WIFEXITED(statloc)) {
+		std::fprintf(stderr, "shell did not exit normally\n");
+		std::exit(1);
+	}
+	return d.count();
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	int n = argc > 1 ? std::atoi(argv[1]) : 100000;
+	const char* shell = argc > 2 ? argv[2] : "./sltsh";
+
+	char script[] = "/tmp/benchscriptXXXXXX";
+	int fd = mkstemp(script);
+	if (fd < 0) {
+		std::perror("mkstemp error");
+		return 1;
+	}
+	FILE* f = fdopen(fd, "w");
+	for (int i = 0; i < n; ++i) {
+		switch (i % 4) {
+		case 0: std::fprintf(f, "true\n"); break;
+		case 1: std::fprintf(f, "echo line %d > /dev/null\n", i); break;
+		case 2: std::fprintf(f, "test %d -gt 0\n", i); break;
+		case 3: std::fprintf(f, "printf '%%s\\n' %d > /dev/null\n", i); break;
+		}
+	}
+	std::fclose(f);
+
+	double file = run(shell, script, false);
+	double pipe = run(shell, script, true);
+	unlink(script);
+
+	std::printf("%d builtin lines\n", n);
+	std::printf("script file: %10.0f lines/s\n", n / file);
+	std::printf("stdin pipe:  %10.0f lines/s\n", n / pipe);
+}
@@ -0,0 +1,71 @@
+// commands launched per second: fork()+execvp() vs the spawn engine.
+// usage: benchspawn [iterations] [ballast MB]
+// the ballast is touched heap memory standing in for a shell that
+// holds big caches, which is what makes fork() expensive
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "launch.h"
+#include "cmdhash.h"
+
+namespace
+{
+
+char* trueArgv[] = { const_cast<char*>("true"), nullptr };
+
+void forkExec()
+{
+	pid_t pid = fork();
+	if (pid < 0) {
+		std::perror("fork error");
+		std::exit(1);
+	} else if (pid == 0) {
+		setpgid(0, 0);
+		execvp(trueArgv[0], trueArgv);
+		_exit(127);
+	}
+	waitpid(pid, nullptr, 0);
+}
+
+void spawnExec()
+{
+	SpawnSpec spec;
+	spec.path = getCommandHash().lookup(trueArgv[0]);
+	spec.argv = trueArgv;
+	pid_t pid;
+	if (spawnProcess(spec, &pid) != 0) {
+		std::fprintf(stderr, "spawn failed\n");
+		std::exit(1);
+	}
+	waitpid(pid, nullptr, 0);
+}
+
+template<typename F>
+double perSecond(F f, int n)
+{
+	auto beg = std::chrono::steady_clock::now();
+	for (int i = 0; i < n; ++i) {
+		f();
+	}
+	std::chrono::duration<double> d = std::chrono::steady_clock::now() - beg;
+	return n / d.count();
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	int n = argc > 1 ? std::atoi(argv[1]) : 2000;
+	std::size_t mb = argc > 2 ? std::atoi(argv[2]) : 512;
+
+	std::vector<char> ballast(mb << 20);
+	std::memset(ballast.data(), 1, ballast.size());
+
+	std::printf("%d launches of true, %zu MB resident ballast\n", n, mb);
+	std::printf("fork+execvp: %10.0f cmds/s\n", perSecond(forkExec, n));
+	std::printf("spawn:       %10.0f cmds/s\n", perSecond(spawnExec, n));
+}
@@ -0,0 +1,135 @@
+// latency from the start of a launch to the exec of the command:
+// fork()+execv() and posix_spawn() from the big process, and a request
+// to a zygote forked before the process grew.
+// usage: benchzygote [iterations] [ballast MB]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "launch.h"
+#include "cmdhash.h"
+#include "zygote.h"
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+char* trueArgv[] = { const_cast<char*>("true"), nullptr };
+const char* truePath;
+sigset_t childMask;
+
+pid_t lastDone;
+
+void onStatus(pid_t pid, int)
+{
+	lastDone = pid;
+}
+
+double forkExec()
+{
+	// the exec closes the write end: EOF on the read end is the moment
+	int fd[2];
+	if (pipe2(fd, O_CLOEXEC) < 0) {
+		std::perror("pipe error");
+		std::exit(1);
+	}
+	auto beg = Clock::now();
+	pid_t pid = fork();
+	if (pid < 0) {
+		std::perror("fork error");
+		std::exit(1);
+	} else if (pid == 0) {
+		setpgid(0, 0);
+		execv(truePath, trueArgv);
+		_exit(127);
+	}
+	close(fd[1]);
+	char c;
+	read(fd[0], &c, 1);
+	std::chrono::duration<double, std::micro> d = Clock::now() - beg;
+	close(fd[0]);
+	waitpid(pid, nullptr, 0);
+	return d.count();
+}
+
+/// posix_spawn returns once the child has exec'd
+double spawnLocal()
+{
+	SpawnSpec spec;
+	spec.path = truePath;
+	spec.argv = trueArgv;
+	spec.sigmask = &childMask;
+	pid_t pid;
+	auto beg = Clock::now();
+	if (spawnProcess(spec, &pid) != 0) {
+		std::fprintf(stderr, "spawn failed\n");
+		std::exit(1);
+	}
+	std::chrono::duration<double, std::micro> d = Clock::now() - beg;
+	waitpid(pid, nullptr, 0);
+	return d.count();
+}
+
+/// the reply is sent once the zygote's posix_spawn has returned
+double spawnZygote()
+{
+	SpawnSpec spec;
+	spec.path = truePath;
+	spec.argv = trueArgv;
+	pid_t pid;
+	auto beg = Clock::now();
+	if (getZygote().spawn(spec, &pid) != 0) {
+		std::fprintf(stderr, "zygote spawn failed\n");
+		std::exit(1);
+	}
+	std::chrono::duration<double, std::micro> d = Clock::now() - beg;
+	while (lastDone != pid) {
+		struct pollfd pfd = { getZygote().fd(), POLLIN, 0 };
+		poll(&pfd, 1, -1);
+		getZygote().drain();
+	}
+	return d.count();
+}
+
+void report(const char* name, double (*launch)(), int n)
+{
+	std::vector<double> us;
+	us.reserve(n);
+	for (int i = 0; i < n; ++i) {
+		us.push_back(launch());
+	}
+	std::sort(us.begin(), us.end());
+	std::printf("%-12s p50 %8.1f us   p99 %8.1f us\n",
+				name, us[n / 2], us[std::min<std::size_t>(n - 1, n * 99 / 100)]);
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	int n = argc > 1 ? std::atoi(argv[1]) : 2000;
+	std::size_t mb = argc > 2 ? std::atoi(argv[2]) : 512;
+
+	truePath = getCommandHash().lookup(trueArgv[0]);
+	sigprocmask(SIG_SETMASK, nullptr, &childMask);
+	if (truePath == nullptr || !getZygote().start(&childMask, onStatus)) {
+		std::fprintf(stderr, "setup failed\n");
+		return 1;
+	}
+
+	// the zygote was forked while we were small, like the shell's
+	std::vector<char> ballast(mb << 20);
+	std::memset(ballast.data(), 1, ballast.size());
+
+	std::printf("%d launches of true, %zu MB resident ballast\n", n, mb);
+	report("fork+execv", forkExec, n);
+	report("spawn", spawnLocal, n);
+	report("zygote", spawnZygote, n);
+}
@@ -0,0 +1,1167 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <vector>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "builtin.h"
+#include "context.h"
+#include "redirect.h"
+#include "cmdhash.h"
+#include "linecache.h"
+#include "eventloop.h"
+#include "vars.h"
+#include "launch.h"
+
+// from shell.cpp
+extern Context& getContext();
+void doBg(int jid);
+void doFg(int jid);
+void becomeTtyFgPgrp();
+
+void BuiltinOut::put(const char* s, std::size_t n)
+{
+	if (len_ + n > sizeof(buf_)) {
+		flush();
+		if (n > sizeof(buf_)) {
+			// too big to be worth copying
+			while (n > 0) {
+				ssize_t w = write(fd_, s, n);
+				if (w < 0) {
+					if (errno == EINTR)
+						continue;
+					return;
+				}
+				s += w;
+				n -= w;
+			}
+			return;
+		}
+	}
+	std::memcpy(buf_ + len_, s, n);
+	len_ += n;
+}
+
+void BuiltinOut::put(const char* s)
+{
+	put(s, std::strlen(s));
+}
+
+void BuiltinOut::put(char c)
+{
+	if (len_ == sizeof(buf_)) {
+		flush();
+	}
+	buf_[len_++] = c;
+}
+
+void BuiltinOut::printf(const char* fmt, ...)
+{
+	char tmp[512];
+	va_list ap;
+	va_start(ap, fmt);
+	int n = std::vsnprintf(tmp, sizeof(tmp), fmt, ap);
+	va_end(ap);
+	if (n < 0) {
+		return;
+	}
+	if (static_cast<std::size_t>(n) < sizeof(tmp)) {
+		put(tmp, n);
+	} else {
+		std::vector<char> big(n + 1);
+		va_start(ap, fmt);
+		std::vsnprintf(big.data(), big.size(), fmt, ap);
+		va_end(ap);
+		put(big.data(), n);
+	}
+}
+
+void BuiltinOut::flush()
+{
+	std::size_t done = 0;
+	while (done < len_) {
+		ssize_t w = write(fd_, buf_ + done, len_ - done);
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			// reader went away or the fd is bad: drop the output
+			break;
+		}
+		done += w;
+	}
+	len_ = 0;
+}
+
+namespace
+{
+
+bool parseJobId(const char* s, long* jid)
+{
+	if (*s == '%') {
+		++s;
+	}
+	char* endptr;
+	errno = 0;
+	*jid = std::strtol(s, &endptr, 10);
+	return *endptr == '\0' && endptr != s && errno != ERANGE;
+}
+
+/// backslash escapes of echo -e and printf. returns false on \c,
+/// which means: print nothing more
+bool putEscaped(BuiltinOut& out, const char* s, bool echoOctal)
+{
+	for (; *s; ++s) {
+		if (*s != '\\' || s[1] == '\0') {
+			out.put(*s);
+			continue;
+		}
+		switch (*++s) {
+		case 'a': out.put('\a'); break;
+		case 'b': out.put('\b'); break;
+		case 'c': return false;
+		case 'e': out.put('\033'); break;
+		case 'f': out.put('\f'); break;
+		case 'n': out.put('\n'); break;
+		case 'r': out.put('\r'); break;
+		case 't': out.put('\t'); break;
+		case 'v': out.put('\v'); break;
+		case '\\': out.put('\\'); break;
+		case '0': case '1': case '2': case '3':
+		case '4': case '5': case '6': case '7': {
+			// echo wants \0nnn, printf \nnn
+			if (echoOctal && *s != '0') {
+				out.put('\\');
+				out.put(*s);
+				break;
+			}
+			int digits = echoOctal ? 0 : 1;
+			int v = echoOctal ? 0 : *s - '0';
+			while (digits < 3 && s[1] >= '0' && s[1] <= '7') {
+				v = v * 8 + (*++s - '0');
+				++digits;
+			}
+			out.put(static_cast<char>(v));
+			break;
+		}
+		default:
+			out.put('\\');
+			out.put(*s);
+		}
+	}
+	return true;
+}
+
+int doCd(int argc, char** argv, BuiltinIO& io)
+{
+	const char* dir;
+	if (argc == 1) {
+		auto home = getVarStore().get("HOME");
+		dir = home ? home->c_str() : nullptr;
+		if (dir == nullptr) {
+			io.err.put("sltsh: cd: HOME not set\n");
+			return 1;
+		}
+	} else if (argc == 2) {
+		dir = argv[1];
+	} else {
+		io.err.put("sltsh: cd: wrong number of arguments\n");
+		return 1;
+	}
+
+	if (chdir(dir) < 0) {
+		io.err.printf("sltsh: cd error: %s\n", std::strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+int doExit(int argc, char** argv, BuiltinIO& io)
+{
+	if (argc > 2) {
+		io.err.put("sltsh: exit: wrong number of arguments\n");
+		return 1;
+	}
+	int status = 0;
+	if (argc == 2) {
+		char* endptr;
+		status = std::strtol(argv[1], &endptr, 10);
+		if (*endptr != '\0' || endptr == argv[1]) {
+			io.err.printf("sltsh: exit: %s: numeric argument required\n", argv[1]);
+			status = 2;
+		}
+	}
+	io.out.flush();
+	io.err.flush();
+	std::exit(status & 0377);
+}
+
+int doBgFg(int argc, char** argv, BuiltinIO& io)
+{
+	bool fg = argv[0][0] == 'f';
+	if (!getContext().interactive) {
+		io.err.printf("sltsh: %s: no job control\n", argv[0]);
+		return 1;
+	}
+	if (argc != 2) {
+		io.err.printf("sltsh: %s: usage: %s <jobid>\n", argv[0], argv[0]);
+		return 1;
+	}
+	long jid;
+	if (!parseJobId(argv[1], &jid)) {
+		io.err.printf("sltsh: %s: invalid argument\n", argv[0]);
+		return 1;
+	}
+
+	// job control messages may come out while we wait
+	io.err.flush();
+	if (fg) {
+		doFg(jid);
+		return getContext().lastExitStatus;
+	} else {
+		doBg(jid);
+		return 0;
+	}
+}
+
+int doJobs(int argc, char** argv, BuiltinIO& io)
+{
+	if (argc != 1) {
+		io.err.put("sltsh: jobs: wrong number of arguments\n");
+		return 1;
+	}
+	getEventLoop().reap();
+	for (auto& kv: getContext().jobMap) {
+		io.out.printf("[%d] %s\t%s\n",
+			kv.first, strJobStatus[(int)kv.second.stat], kv.second.command().c_str());
+	}
+	return 0;
+}
+
+/// wait [-n] [jobid...]: with no ids, every job. -n returns as soon as
+/// one of them is done. a stopped job counts as done, or we would wait
+/// forever. the status is that of the last job waited for
+int doWait(int argc, char** argv, BuiltinIO& io)
+{
+	auto& ctx = getContext();
+	bool any = false;
+	int i = 1;
+	if (i < argc && !std::strcmp(argv[i], "-n")) {
+		any = true;
+		++i;
+	}
+
+	int status = 0;
+	std::vector<int> targets;
+	if (i == argc) {
+		for (auto& kv : ctx.jobMap) {
+			targets.push_back(kv.first);
+		}
+		if (any && targets.empty()) {
+			return 127;
+		}
+	}
+	for (; i < argc; ++i) {
+		long jid;
+		if (!parseJobId(argv[i], &jid)) {
+			io.err.printf("sltsh: wait: %s: invalid argument\n", argv[i]);
+			return 2;
+		}
+		if (!ctx.jobMap.count(jid) && !ctx.doneStatus.count(jid)) {
+			io.err.printf("sltsh: wait: %s: no such job\n", argv[i]);
+			status = 127;
+			continue;
+		}
+		targets.push_back(jid);
+	}
+	io.err.flush();
+
+	for (;;) {
+		getEventLoop().reap();
+		std::size_t done = 0;
+		for (int jid : targets) {
+			auto iter = ctx.jobMap.find(jid);
+			if (iter != ctx.jobMap.end() && iter->second.stat == JobStatus::Running) {
+				continue;
+			}
+			status = iter != ctx.jobMap.end() ? iter->second.status : ctx.doneStatus[jid];
+			++done;
+			if (any) {
+				return status;
+			}
+		}
+		if (done == targets.size()) {
+			return status;
+		}
+		getEventLoop().wait();
+	}
+}
+
+int doUmask(int argc, char** argv, BuiltinIO& io)
+{
+	if (argc == 1) {
+		auto oldmask = umask(0);
+		umask(oldmask);
+		io.out.printf("%04o\n", oldmask);
+	} else if (argc == 2) {
+		char* endptr;
+		auto mask = std::strtol(argv[1], &endptr, 8);
+		if (*endptr != '\0') {
+			io.err.put("sltsh: umask: wrong argument type\n");
+			return 1;
+		}
+		if (mask > 0777 || mask < 0) {
+			io.err.put("sltsh: umask: invalid range\n");
+			return 1;
+		}
+
+		umask(mask);
+	} else {
+		io.err.put("sltsh: umask: wrong number of arguments\n");
+		return 1;
+	}
+	return 0;
+}
+
+int doHash(int argc, char** argv, BuiltinIO& io)
+{
+	auto& hash = getCommandHash();
+	if (argc == 1) {
+		io.out.put(hash.dump());
+	} else if (argc == 2 && !std::strcmp(argv[1], "-r")) {
+		hash.reset();
+	} else {
+		int status = 0;
+		for (int i = 1; i < argc; ++i) {
+			hash.forget(argv[i]);
+			if (hash.lookup(argv[i]) == nullptr) {
+				io.err.printf("sltsh: hash: %s: not found\n", argv[i]);
+				status = 1;
+			}
+		}
+		return status;
+	}
+	return 0;
+}
+
+/// linecache: how the parsed-line cache is doing. -r empties it
+int doLinecache(int argc, char** argv, BuiltinIO& io)
+{
+	auto& cache = getLineCache();
+	if (argc == 1) {
+		io.out.put(cache.stats());
+	} else if (argc == 2 && !std::strcmp(argv[1], "-r")) {
+		cache.reset();
+	} else {
+		io.err.put("sltsh: linecache: usage: linecache [-r]\n");
+		return 2;
+	}
+	return 0;
+}
+
+int doEcho(int argc, char** argv, BuiltinIO& io)
+{
+	bool newline = true;
+	bool escapes = false;
+	int i = 1;
+	for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; ++i) {
+		const char* f = argv[i] + 1;
+		if (std::strspn(f, "neE") != std::strlen(f))
+			break;
+		for (; *f; ++f) {
+			if (*f == 'n')
+				newline = false;
+			else
+				escapes = *f == 'e';
+		}
+	}
+
+	for (int first = i; i < argc; ++i) {
+		if (i != first)
+			io.out.put(' ');
+		if (!escapes) {
+			io.out.put(argv[i]);
+		} else if (!putEscaped(io.out, argv[i], true)) {
+			return 0;
+		}
+	}
+	if (newline)
+		io.out.put('\n');
+	return 0;
+}
+
+int doPrintf(int argc, char** argv, BuiltinIO& io)
+{
+	if (argc < 2) {
+		io.err.put("sltsh: printf: usage: printf format [arguments]\n");
+		return 2;
+	}
+	const char* fmt = argv[1];
+	int arg = 2;
+	int status = 0;
+
+	auto nextArg = [&]() -> const char* {
+		return arg < argc ? argv[arg++] : "";
+	};
+
+	// the format is reused as long as it consumes arguments
+	do {
+		int before = arg;
+		for (const char* p = fmt; *p; ++p) {
+			if (*p == '\\' && p[1] != '\0') {
+				char tmp[5] = { '\\', p[1], 0, 0, 0 };
+				int n = 2;
+				if (p[1] >= '0' && p[1] <= '7') {
+					while (n < 4 && p[n] >= '0' && p[n] <= '7') {
+						tmp[n] = p[n];
+						++n;
+					}
+				}
+				if (!putEscaped(io.out, tmp, false))
+					return status;
+				p += n - 1;
+				continue;
+			}
+			if (*p != '%') {
+				io.out.put(*p);
+				continue;
+			}
+			if (p[1] == '%') {
+				io.out.put('%');
+				++p;
+				continue;
+			}
+
+			// %[flags][width][.precision]conversion
+			std::string spec("%");
+			++p;
+			while (*p && std::strchr("-+ #0", *p))
+				spec += *p++;
+			while (*p >= '0' && *p <= '9')
+				spec += *p++;
+			if (*p == '.') {
+				spec += *p++;
+				while (*p >= '0' && *p <= '9')
+					spec += *p++;
+			}
+			char conv = *p;
+			if (conv == '\0') {
+				io.err.put("sltsh: printf: missing format character\n");
+				return 1;
+			}
+			switch (conv) {
+			case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': {
+				const char* a = nextArg();
+				char* endptr;
+				errno = 0;
+				long long v = *a == '\'' || *a == '\"'
+					? static_cast<unsigned char>(a[1]) : std::strtoll(a, &endptr, 0);
+				if (*a != '\'' && *a != '\"' && *a != '\0'
+					&& (*endptr != '\0' || errno == ERANGE)) {
+					io.err.printf("sltsh: printf: %s: invalid number\n", a);
+					status = 1;
+				}
+				spec += "ll";
+				spec += conv;
+				io.out.printf(spec.c_str(), v);
+				break;
+			}
+			case 'c': {
+				const char* a = nextArg();
+				if (*a)
+					io.out.put(*a);
+				break;
+			}
+			case 's':
+				spec += 's';
+				io.out.printf(spec.c_str(), nextArg());
+				break;
+			case 'b':
+				if (!putEscaped(io.out, nextArg(), true))
+					return status;
+				break;
+			default:
+				io.err.printf("sltsh: printf: %%%c: invalid directive\n", conv);
+				return 1;
+			}
+		}
+		if (arg == before)
+			break;
+	} while (arg < argc);
+	return status;
+}
+
+/// test / [ by recursive descent:
+///   expr = and { -o and }, and = not { -a not }, not = ! not | primary
+class TestEval
+{
+public:
+	TestEval(int argc, char** argv, BuiltinIO& io)
+		: argc_(argc), argv_(argv), io_(io) {}
+
+	/// 0 true, 1 false, 2 error
+	int run() {
+		if (argc_ == 0)
+			return 1;
+		bool v = orExpr();
+		if (!err_ && i_ != argc_) {
+			io_.err.printf("sltsh: test: %s: unexpected argument\n", argv_[i_]);
+			err_ = true;
+		}
+		return err_ ? 2 : !v;
+	}
+
+private:
+	bool is(const char* s) {
+		return i_ < argc_ && !std::strcmp(argv_[i_], s);
+	}
+
+	bool orExpr() {
+		bool v = andExpr();
+		while (!err_ && is("-o")) {
+			++i_;
+			bool rhs = andExpr();
+			v = v || rhs;
+		}
+		return v;
+	}
+
+	bool andExpr() {
+		bool v = notExpr();
+		while (!err_ && is("-a")) {
+			++i_;
+			bool rhs = notExpr();
+			v = v && rhs;
+		}
+		return v;
+	}
+
+	bool notExpr() {
+		if (is("!")) {
+			++i_;
+			return !notExpr();
+		}
+		return primary();
+	}
+
+	bool primary() {
+		if (i_ >= argc_) {
+			io_.err.put("sltsh: test: argument expected\n");
+			err_ = true;
+			return false;
+		}
+		if (i_ + 2 < argc_ && isBinary(argv_[i_ + 1])) {
+			const char* l = argv_[i_];
+			const char* op = argv_[i_ + 1];
+			const char* r = argv_[i_ + 2];
+			i_ += 3;
+			return binary(l, op, r);
+		}
+		if (is("(")) {
+			++i_;
+			bool v = orExpr();
+			if (!is(")")) {
+				io_.err.put("sltsh: test: missing ')'\n");
+				err_ = true;
+				return false;
+			}
+			++i_;
+			return v;
+		}
+		const char* a = argv_[i_];
+		if (a[0] == '-' && a[1] != '\0' && a[2] == '\0'
+			&& std::strchr("efdrwxsLhpSbcznt", a[1]) && i_ + 1 < argc_) {
+			i_ += 2;
+			return unary(a[1], argv_[i_ - 1]);
+		}
+		++i_;
+		return a[0] != '\0';
+	}
+
+	static bool isBinary(const char* op) {
+		static const char* ops[] = {
+			"=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot",
+		};
+		for (auto o : ops) {
+			if (!std::strcmp(op, o))
+				return true;
+		}
+		return false;
+	}
+
+	bool number(const char* s, long long* v) {
+		char* endptr;
+		errno = 0;
+		*v = std::strtoll(s, &endptr, 10);
+		if (*s == '\0' || *endptr != '\0' || errno == ERANGE) {
+			io_.err.printf("sltsh: test: %s: integer expression expected\n", s);
+			err_ = true;
+			return false;
+		}
+		return true;
+	}
+
+	bool binary(const char* l, const char* op, const char* r) {
+		if (!std::strcmp(op, "=") || !std::strcmp(op, "=="))
+			return !std::strcmp(l, r);
+		if (!std::strcmp(op, "!="))
+			return std::strcmp(l, r) != 0;
+		if (op[1] == 'n' || op[1] == 'o') {
+			if (op[2] == 't') {
+				// -nt / -ot
+				struct stat a, b;
+				bool ha = stat(l, &a) == 0, hb = stat(r, &b) == 0;
+				auto newer = [](const struct stat& x, const struct stat& y) {
+					return x.st_mtim.tv_sec != y.st_mtim.tv_sec
+						? x.st_mtim.tv_sec > y.st_mtim.tv_sec
+						: x.st_mtim.tv_nsec > y.st_mtim.tv_nsec;
+				};
+				if (op[1] == 'n')
+					return ha && (!hb || newer(a, b));
+				return hb && (!ha || newer(b, a));
+			}
+		}
+		long long a, b;
+		if (!number(l, &a) || !number(r, &b))
+			return false;
+		if (!std::strcmp(op, "-eq")) return a == b;
+		if (!std::strcmp(op, "-ne")) return a != b;
+		if (!std::strcmp(op, "-lt")) return a < b;
+		if (!std::strcmp(op, "-le")) return a <= b;
+		if (!std::strcmp(op, "-gt")) return a > b;
+		return a >= b;
+	}
+
+	bool unary(char op, const char* a) {
+		struct stat st;
+		switch (op) {
+		case 'z': return a[0] == '\0';
+		case 'n': return a[0] != '\0';
+		case 'r': return access(a, R_OK) == 0;
+		case 'w': return access(a, W_OK) == 0;
+		case 'x': return access(a, X_OK) == 0;
+		case 't': {
+			long long fd;
+			return number(a, &fd) && isatty(fd);
+		}
+		case 'L':
+		case 'h':
+			return lstat(a, &st) == 0 && S_ISLNK(st.st_mode);
+		default:
+			break;
+		}
+		if (stat(a, &st) < 0)
+			return false;
+		switch (op) {
+		case 'e': return true;
+		case 'f': return S_ISREG(st.st_mode);
+		case 'd': return S_ISDIR(st.st_mode);
+		case 's': return st.st_size > 0;
+		case 'p': return S_ISFIFO(st.st_mode);
+		case 'S': return S_ISSOCK(st.st_mode);
+		case 'b': return S_ISBLK(st.st_mode);
+		case 'c': return S_ISCHR(st.st_mode);
+		}
+		return false;
+	}
+
+	int argc_;
+	char** argv_;
+	BuiltinIO& io_;
+	int i_ = 0;
+	bool err_ = false;
+};
+
+int doTest(int argc, char** argv, BuiltinIO& io)
+{
+	if (argv[0][0] == '[') {
+		if (argc < 2 || std::strcmp(argv[argc - 1], "]")) {
+			io.err.put("sltsh: [: missing ']'\n");
+			return 2;
+		}
+		--argc;
+	}
+	return TestEval(argc - 1, argv + 1, io).run();
+}
+
+int doTrue(int, char**, BuiltinIO&)
+{
+	return 0;
+}
+
+int doFalse(int, char**, BuiltinIO&)
+{
+	return 1;
+}
+
+int doPwd(int argc, char** argv, BuiltinIO& io)
+{
+	char* cwd = getcwd(nullptr, 0);
+	if (cwd == nullptr) {
+		io.err.printf("sltsh: pwd: %s\n", std::strerror(errno));
+		return 1;
+	}
+	io.out.put(cwd);
+	io.out.put('\n');
+	std::free(cwd);
+	return 0;
+}
+
+struct SigName
+{
+	const char* name;
+	int signo;
+};
+
+const SigName sigNames[] = {
+	{"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"ILL", SIGILL},
+	{"TRAP", SIGTRAP}, {"ABRT", SIGABRT}, {"BUS", SIGBUS}, {"FPE", SIGFPE},
+	{"KILL", SIGKILL}, {"USR1", SIGUSR1}, {"SEGV", SIGSEGV}, {"USR2", SIGUSR2},
+	{"PIPE", SIGPIPE}, {"ALRM", SIGALRM}, {"TERM", SIGTERM}, {"CHLD", SIGCHLD},
+	{"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN},
+	{"TTOU", SIGTTOU}, {"URG", SIGURG}, {"XCPU", SIGXCPU}, {"XFSZ", SIGXFSZ},
+	{"VTALRM", SIGVTALRM}, {"PROF", SIGPROF}, {"WINCH", SIGWINCH}, {"SYS", SIGSYS},
+};
+
+int signalNumber(const char* s)
+{
+	if (*s >= '0' && *s <= '9') {
+		char* endptr;
+		long v = std::strtol(s, &endptr, 10);
+		return *endptr == '\0' && v < NSIG ? v : -1;
+	}
+	if (!strncasecmp(s, "SIG", 3))
+		s += 3;
+	for (auto& sn : sigNames) {
+		if (!strcasecmp(s, sn.name))
+			return sn.signo;
+	}
+	return -1;
+}
+
+int doKill(int argc, char** argv, BuiltinIO& io)
+{
+	int signo = SIGTERM;
+	int i = 1;
+	if (i < argc && !std::strcmp(argv[i], "-l")) {
+		for (auto& sn : sigNames) {
+			io.out.printf("%2d) SIG%s\n", sn.signo, sn.name);
+		}
+		return 0;
+	}
+	if (i < argc && !std::strcmp(argv[i], "-s")) {
+		if (i + 1 >= argc || (signo = signalNumber(argv[i + 1])) < 0) {
+			io.err.put("sltsh: kill: invalid signal specification\n");
+			return 1;
+		}
+		i += 2;
+	} else if (i < argc && argv[i][0] == '-' && argv[i][1] != '\0'
+			   && !(argv[i][1] == '-' && argv[i][2] == '\0')) {
+		if ((signo = signalNumber(argv[i] + 1)) < 0) {
+			io.err.printf("sltsh: kill: %s: invalid signal specification\n", argv[i] + 1);
+			return 1;
+		}
+		++i;
+	}
+	if (i < argc && !std::strcmp(argv[i], "--"))
+		++i;
+	if (i == argc) {
+		io.err.put("sltsh: kill: usage: kill [-s sigspec | -sigspec] pid | %jobid ...\n");
+		return 2;
+	}
+
+	int status = 0;
+	for (; i < argc; ++i) {
+		pid_t target;
+		if (argv[i][0] == '%') {
+			long jid;
+			auto& jobMap = getContext().jobMap;
+			auto iter = parseJobId(argv[i], &jid) ? jobMap.find(jid) : jobMap.end();
+			if (iter == jobMap.end()) {
+				io.err.printf("sltsh: kill: %s: no such job\n", argv[i]);
+				status = 1;
+				continue;
+			}
+			auto& job = iter->second;
+			if (!getContext().interactive) {
+				// no group of its own: that would be ours
+				for (int k = 0; k < job.nproc; ++k) {
+					if (job.statInd[k] == ProcStatus::Running
+						|| job.statInd[k] == ProcStatus::Stopped) {
+						kill(job.pid[k], signo);
+					}
+				}
+				continue;
+			}
+			target = -job.pgid();
+		} else {
+			char* endptr;
+			target = std::strtol(argv[i], &endptr, 10);
+			if (*endptr != '\0' || endptr == argv[i]) {
+				io.err.printf("sltsh: kill: %s: arguments must be process or job IDs\n", argv[i]);
+				status = 1;
+				continue;
+			}
+		}
+		if (kill(target, signo) < 0) {
+			io.err.printf("sltsh: kill: (%s) - %s\n", argv[i], std::strerror(errno));
+			status = 1;
+		}
+	}
+	return status;
+}
+
+/// export [NAME[=value]...]: without arguments, list what is exported
+/// in a form that can be read back
+int doExport(int argc, char** argv, BuiltinIO& io)
+{
+	auto& vars = getVarStore();
+	if (argc == 1) {
+		for (auto v : vars.exported()) {
+			io.out.printf("export %s=\"", v->name.c_str());
+			for (char ch : v->value) {
+				if (std::strchr("\"\\$`", ch))
+					io.out.put('\\');
+				io.out.put(ch);
+			}
+			io.out.put("\"\n");
+		}
+		return 0;
+	}
+
+	int status = 0;
+	for (int i = 1; i < argc; ++i) {
+		const char* eq = std::strchr(argv[i], '=');
+		std::string_view name = eq ? std::string_view(argv[i], eq - argv[i])
+			: std::string_view(argv[i]);
+		if (!VarStore::validName(name)) {
+			io.err.printf("sltsh: export: `%s': not a valid identifier\n", argv[i]);
+			status = 1;
+			continue;
+		}
+		if (eq) {
+			vars.set(name, eq + 1);
+		}
+		vars.exportVar(name);
+	}
+	return status;
+}
+
+int doUnset(int argc, char** argv, BuiltinIO& io)
+{
+	int status = 0;
+	for (int i = 1; i < argc; ++i) {
+		if (!VarStore::validName(argv[i])) {
+			io.err.printf("sltsh: unset: `%s': not a valid identifier\n", argv[i]);
+			status = 1;
+			continue;
+		}
+		getVarStore().unset(argv[i]);
+	}
+	return status;
+}
+
+bool parseCount(const char* s, long min, long* n)
+{
+	char* end;
+	errno = 0;
+	*n = std::strtol(s, &end, 10);
+	return *s != '\0' && *end == '\0' && errno == 0 && *n >= min;
+}
+
+/// what an argument takes of ARG_MAX: the string and its pointer
+std::size_t argCost(const char* s)
+{
+	return std::strlen(s) + 1 + sizeof(char*);
+}
+
+/// argsplit [-P jobs] [-n max] [-s size] [-k keep] cmd [arg...]: run cmd
+/// with the args packed, in order, into as few commands as fit in
+/// ARG_MAX next to the environment, as xargs does. the first keep args
+/// go to every command, up to jobs commands run at once. the status is
+/// 0 when all succeeded, 123 when some failed, 126 or 127 when cmd could
+/// not be run and 128+n when one was killed by signal n; those two stop
+/// it from starting more
+int doArgsplit(int argc, char** argv, BuiltinIO& io)
+{
+	long jobs = 1, maxArgs = LONG_MAX, keep = 0;
+	long size = sysconf(_SC_ARG_MAX);
+	int i = 1;
+	for (; i + 1 < argc && argv[i][0] == '-' && argv[i][1] != '\0' && argv[i][2] == '\0'; i += 2) {
+		char opt = argv[i][1];
+		long n;
+		if (!std::strchr("Pnsk", opt) || !parseCount(argv[i + 1], opt == 'k' ? 0 : 1, &n)) {
+			io.err.printf("sltsh: argsplit: %s %s: invalid option\n", argv[i], argv[i + 1]);
+			return 2;
+		}
+		(opt == 'P' ? jobs : opt == 'n' ? maxArgs : opt == 'k' ? keep : size) = n;
+	}
+	if (i == argc || keep > argc - i - 1) {
+		io.err.put("sltsh: argsplit: usage: argsplit [-P jobs] [-n max] [-s size] [-k keep] cmd [arg...]\n");
+		return 2;
+	}
+	size = std::min(size, sysconf(_SC_ARG_MAX));
+	const char* path = getCommandHash().lookup(argv[i]);
+	if (path == nullptr) {
+		io.err.printf("sltsh: %s: command not found\n", argv[i]);
+		return 127;
+	}
+
+	// the kernel counts the environment, both null pointers and every
+	// string with its pointer. 2048 more are left free, as POSIX asks
+	auto env = getVarStore().environment();
+	std::size_t used = 2048 + 2 * sizeof(char*);
+	for (char* const* e = env->envp.data(); *e; ++e) {
+		used += argCost(*e);
+	}
+	std::vector<char*> cmd(argv + i, argv + i + 1 + keep);
+	for (char* a : cmd) {
+		used += argCost(a);
+	}
+	std::size_t maxLen = 32 * sysconf(_SC_PAGESIZE);	// MAX_ARG_STRLEN
+	int first = i + 1 + static_cast<int>(keep);
+	for (int k = first; k < argc; ++k) {
+		if (used + argCost(argv[k]) > static_cast<std::size_t>(size)
+			|| std::strlen(argv[k]) >= maxLen) {
+			io.err.printf("sltsh: argsplit: %s: %s\n", argv[i], std::strerror(E2BIG));
+			return 1;
+		}
+	}
+	io.err.flush();
+
+	SpawnSpec spec;
+	spec.path = path;
+	spec.sigmask = getEventLoop().childMask();
+	spec.in = io.in != 0 ? io.in : -1;
+	spec.out = io.out.fd() != 1 ? io.out.fd() : -1;
+	spec.err = io.err.fd() != 2 ? io.err.fd() : -1;
+	spec.envp = env->envp.data();
+	// with job control the commands form one process group that owns
+	// the terminal. the first is kept unreaped to the end, or the group
+	// could vanish between two of them
+	bool jobControl = getContext().interactive && tcgetpgrp(STDIN_FILENO) == getpgrp();
+	spec.pgid = jobControl ? 0 : -1;
+	pid_t leader = -1;
+
+	std::vector<pid_t> running;
+	int next = first;
+	bool pending = true;	// no args still means one command
+	bool stop = false;
+	int status = 0;
+	while ((pending && !stop) || !running.empty()) {
+		if (pending && !stop && static_cast<long>(running.size()) < jobs) {
+			cmd.resize(1 + keep);
+			std::size_t batch = used;
+			for (; next < argc && static_cast<long>(cmd.size() - 1 - keep) < maxArgs
+				 && batch + argCost(argv[next]) <= static_cast<std::size_t>(size); ++next) {
+				batch += argCost(argv[next]);
+				cmd.push_back(argv[next]);
+			}
+			cmd.push_back(nullptr);
+			pending = next < argc;
+			spec.argv = cmd.data();
+
+			// spawned here, not by the zygote: they are ours to wait for
+			io.out.flush();
+			pid_t pid;
+			int err = spawnProcess(spec, &pid);
+			if (err != 0) {
+				io.err.printf("sltsh: %s: %s\n", argv[i], std::strerror(err));
+				io.err.flush();
+				status = std::max(status, err == ENOENT ? 127 : 126);
+				stop = true;
+				continue;
+			}
+			if (jobControl && leader < 0) {
+				spec.pgid = leader = pid;
+				tcsetpgrp(STDIN_FILENO, pid);
+			}
+			running.push_back(pid);
+			continue;
+		}
+
+		bool reaped = false;
+		for (auto it = running.begin(); it != running.end(); ) {
+			siginfo_t info;
+			info.si_pid = 0;
+			int flags = WEXITED | WSTOPPED | WNOHANG | (*it == leader ? WNOWAIT : 0);
+			if (waitid(P_PID, *it, &info, flags) < 0 || info.si_pid == 0) {
+				++it;
+				continue;
+			}
+			if (info.si_code == CLD_STOPPED) {
+				// not a job, so there is nothing to suspend
+				kill(*it, SIGCONT);
+				++it;
+				continue;
+			}
+			if (info.si_code == CLD_EXITED) {
+				status = std::max(status, info.si_status == 0 ? 0 : 123);
+			} else {
+				status = std::max(status, 128 + info.si_status);
+				stop = true;
+			}
+			it = running.erase(it);
+			reaped = true;
+		}
+		if (!reaped && !running.empty()) {
+			getEventLoop().drainSources();
+			getEventLoop().wait();
+		}
+	}
+	if (leader > 0) {
+		waitpid(leader, nullptr, 0);
+		becomeTtyFgPgrp();
+	}
+	return status;
+}
+
+constexpr Builtin builtins[] = {
+	{"cd",     doCd,     false},
+	{"exit",   doExit,   false},
+	{"bg",     doBgFg,   false},
+	{"fg",     doBgFg,   false},
+	{"jobs",   doJobs,   true},
+	{"wait",   doWait,   false},
+	{"umask",  doUmask,  false},
+	{"hash",   doHash,   false},
+	{"linecache", doLinecache, false},
+	{"echo",   doEcho,   true},
+	{"printf", doPrintf, true},
+	{"test",   doTest,   true},
+	{"[",      doTest,   true},
+	{"true",   doTrue,   true},
+	{"false",  doFalse,  true},
+	{"pwd",    doPwd,    true},
+	{"kill",   doKill,   true},
+	{"export", doExport, false},
+	{"unset",  doUnset,  false},
+	{"argsplit", doArgsplit, false},
+};
+constexpr int NBUILTIN = sizeof(builtins) / sizeof(builtins[0]);
+
+/// perfect hash over the names above: the seed is searched at compile
+/// time so that no two builtins share a slot, and a lookup is one hash
+/// plus one strcmp
+constexpr unsigned TABLE_SIZE = 64;
+
+constexpr unsigned hashName(const char* s, unsigned seed)
+{
+	unsigned h = seed;
+	for (; *s; ++s) {
+		h ^= static_cast<unsigned char>(*s);
+		h *= 16777619u;
+	}
+	return (h ^ (h >> 15)) % TABLE_SIZE;
+}
+
+constexpr bool collisionFree(unsigned seed)
+{
+	bool used[TABLE_SIZE] = {};
+	for (auto& b : builtins) {
+		unsigned h = hashName(b.name, seed);
+		if (used[h])
+			return false;
+		used[h] = true;
+	}
+	return true;
+}
+
+constexpr unsigned findSeed()
+{
+	unsigned seed = 2166136261u;
+	while (!collisionFree(seed))
+		++seed;
+	return seed;
+}
+
+constexpr unsigned SEED = findSeed();
+
+struct Slots
+{
+	signed char idx[TABLE_SIZE];
+};
+
+constexpr Slots makeSlots()
+{
+	Slots s{};
+	for (unsigned i = 0; i < TABLE_SIZE; ++i)
+		s.idx[i] = -1;
+	for (int i = 0; i < NBUILTIN; ++i)
+		s.idx[hashName(builtins[i].name, SEED)] = i;
+	return s;
+}
+
+constexpr Slots slots = makeSlots();
+
+} // end anonymous namespace
+
+const Builtin* findBuiltin(const char* name)
+{
+	int i = slots.idx[hashName(name, SEED)];
+	if (i >= 0 && !std::strcmp(builtins[i].name, name)) {
+		return &builtins[i];
+	}
+	return nullptr;
+}
+
+int runBuiltin(const Builtin* b, Exec* node)
+{
+	// the redirections are applied to a private fd table: the shell's
+	// own 0, 1 and 2 stay where they are
+	int fds[3] = { 0, 1, 2 };
+	std::vector<int> opened;
+	bool ok = true;
+	for (auto& u : node->rdUnits) {
+		switch (u.rdTag) {
+		case RdTag::In:
+		case RdTag::Here:
+		case RdTag::Out:
+		case RdTag::App:
+		case RdTag::OutErr: {
+			int fd = openRdTarget(u);
+			if (fd < 0) {
+				ok = false;
+				break;
+			}
+			opened.push_back(fd);
+			int to = u.isInput() ? 0
+				: u.lhs.tag == RdObj::Empty ? 1 : u.lhs.fd;
+			if (to < 3)
+				fds[to] = fd;
+			if (u.rdTag == RdTag::OutErr)
+				fds[2] = fd;
+			break;
+		}
+		case RdTag::OutDup: {
+			int from = u.rhs.fd < 3 ? fds[u.rhs.fd] : u.rhs.fd;
+			if (u.lhs.fd < 3)
+				fds[u.lhs.fd] = from;
+			break;
+		}
+		default:
+			assert(false);
+		}
+		if (!ok)
+			break;
+	}
+
+	int status = 1;
+	if (ok) {
+		BuiltinIO io;
+		io.in = fds[0];
+		io.out.setFd(fds[1]);
+		io.err.setFd(fds[2]);
+		int argc = static_cast<int>(node->argv.size()) - 1;
+		status = b->fn(argc, node->argv.data(), io);
+	}
+	for (int fd : opened) {
+		close(fd);
+	}
+	return status;
+}
@@ -0,0 +1,62 @@
+#ifndef BUILTIN_H__
+#define BUILTIN_H__
+
+#include <string>
+#include <cstddef>
+#include "nodes.h"
+
+/// buffered output of a builtin. everything a builtin prints goes out
+/// in one write(2) when it returns, instead of one per stdio line
+class BuiltinOut
+{
+public:
+	explicit BuiltinOut(int fd) : fd_(fd), len_(0) {}
+	BuiltinOut(const BuiltinOut&) = delete;
+	~BuiltinOut() { flush(); }
+
+	void put(const char* s, std::size_t n);
+	void put(const char* s);
+	void put(const std::string& s) { put(s.data(), s.size()); }
+	void put(char c);
+	void printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+	void flush();
+
+	void setFd(int fd) { flush(); fd_ = fd; }
+	int fd() const { return fd_; }
+
+private:
+	int fd_;
+	std::size_t len_;
+	char buf_[4096];
+};
+
+/// where a builtin's standard fds point after its redirections
+struct BuiltinIO
+{
+	/// for the commands a builtin starts
+	int in = 0;
+	BuiltinOut out{1};
+	BuiltinOut err{2};
+};
+
+/// argv is null terminated, argc does not count the terminator
+using BuiltinFn = int (*)(int argc, char** argv, BuiltinIO& io);
+
+struct Builtin
+{
+	const char* name;
+	BuiltinFn fn;
+	/// touches no shell state, so running it outside the shell process
+	/// or inside it gives the same result
+	bool pure;
+};
+
+/// the builtin called name, or nullptr. one hash and one strcmp
+const Builtin* findBuiltin(const char* name);
+
+/// run a builtin in the current process, honouring the redirections
+/// of node without touching the shell's own fds.
+/// returns the exit status
+int runBuiltin(const Builtin* b, Exec* node);
+
+#endif
@@ -12,6 +12,8 @@
 #include <iostream>
 #include <memory>
 #include <cstdio>
+#include <charconv>
+#include <string_view>
 
 #include "calc_aslib.h"
 
@@ -141,191 +143,114 @@ private:
     TokenType type;
 };
 
-// Tree Part
-enum class ValueType { Int, Double, Undecided };
-class NodeBase
+// Tree Part: the nodes of an expression sit in one array and name
+// their children by index. the array is kept from one calc() to the
+// next, so once it has grown an expression costs no allocation
+enum class ValueType { Int, Double };
+
+struct Node
+{
+    enum Kind { Leaf, Neg, Bin };
+    Kind kind;
+    char op;
+    ValueType type;
+    int left;
+    int right;
+    union {
+		int i;
+		double d;
+    } u;
+};
+
+class Tree
 {
 public:
-    NodeBase() {
-		restype = ValueType::Undecided;
-    }
-    virtual ~NodeBase() = default;
-    bool isInt() const {
-		return restype == ValueType::Int;
-    }
-    bool isDouble() const {
-		return restype == ValueType::Double;
+    void clear() {
+		nodes.clear();
+		divByZero = false;
     }
-    virtual void decideType() = 0;
-    virtual int evalInt() const = 0;
-    virtual double evalDouble() const = 0;
 
+    int leaf( int i ) {
+		Node n{ Node::Leaf, 0, ValueType::Int, -1, -1, {} };
+		n.u.i = i;
+		return add( n );
+    }
 
-    void setType( ValueType t ) {
-		restype = t;
+    int leaf( double d ) {
+		Node n{ Node::Leaf, 0, ValueType::Double, -1, -1, {} };
+		n.u.d = d;
+		return add( n );
     }
 
-    ValueType getType() const {
-		return restype;
+    int neg( int child ) {
+		return add( { Node::Neg, '-', nodes[child].type, child, -1, {} } );
     }
-private:
-    ValueType restype;
-};
 
-class BinaryNode : public NodeBase
-{
-public:
-    BinaryNode( char op_, std::unique_ptr<NodeBase> l, std::unique_ptr<NodeBase> r )
-		: op(op_), left(std::move(l)), right(std::move(r)) {
+    int bin( char op, int left, int right ) {
 		assert( op == '+' || op == '-' || op == '*' || op == '/' );
+		bool dbl = nodes[left].type == ValueType::Double
+			|| nodes[right].type == ValueType::Double;
+		return add( { Node::Bin, op, dbl ? ValueType::Double : ValueType::Int,
+					  left, right, {} } );
     }
 
-    void setLeft( std::unique_ptr<NodeBase> left_ ) {
-		left = std::move(left_);
+    ValueType type( int n ) const {
+		return nodes[n].type;
     }
 
-    void setRight( std::unique_ptr<NodeBase> right_ ) {
-		right = std::move(right_);
-    }
-    
-    void decideType() override {
-		left->decideType();
-		right->decideType();
-		if( left->isDouble() || right->isDouble() ) {
-			setType( ValueType::Double );
-		} else {
-			setType( ValueType::Int );
+    int evalInt( int idx ) {
+		const Node& n = nodes[idx];
+		assert( n.type == ValueType::Int );
+		switch( n.kind ) {
+		case Node::Leaf: return n.u.i;
+		case Node::Neg: return -evalInt( n.left );
+		case Node::Bin: break;
 		}
-    }
-
-    int evalInt() const override {
-		assert( getType() == ValueType::Int );
-		switch( op ) {
-		case '+': return left->evalInt() + right->evalInt();
-		case '-': return left->evalInt() - right->evalInt();
-		case '*': return left->evalInt() * right->evalInt();
-		case '/': return left->evalInt() / right->evalInt();
-		default: assert( false );
+		int l = evalInt( n.left );
+		int r = evalInt( n.right );
+		switch( n.op ) {
+		case '+': return l + r;
+		case '-': return l - r;
+		case '*': return l * r;
+		default:
+			if( r == 0 ) {
+				divByZero = true;
+				return 0;
+			}
+			return l / r;
 		}
     }
 
-    double evalDouble() const override {
-		assert( getType() == ValueType::Double );
-		switch( op ) {
-		case '+': {
-			unsigned l = !!(left->getType() == ValueType::Double);
-			unsigned r = !!(right->getType() == ValueType::Double);
-			switch( 2 * r + l ) {
-			case 0: return left->evalInt() + right->evalInt();
-			case 1: return left->evalDouble() + right->evalInt();
-			case 2: return left->evalInt() + right->evalDouble();
-			case 3: return left->evalDouble() + right->evalDouble();
-			default: assert(false);
-			}
+    double evalDouble( int idx ) {
+		const Node& n = nodes[idx];
+		if( n.type == ValueType::Int ) {
+			return evalInt( idx );
 		}
-		case '-': {
-			unsigned l = !!(left->getType() == ValueType::Double);
-			unsigned r = !!(right->getType() == ValueType::Double);
-			switch( 2 * r + l ) {
-			case 0: return left->evalInt() - right->evalInt();
-			case 1: return left->evalDouble() - right->evalInt();
-			case 2: return left->evalInt() - right->evalDouble();
-			case 3: return left->evalDouble() - right->evalDouble();
-
-			default: assert(false); return 0;// make g++ happy
-			}
+		switch( n.kind ) {
+		case Node::Leaf: return n.u.d;
+		case Node::Neg: return -evalDouble( n.left );
+		case Node::Bin: break;
 		}
-		case '*': {
-			unsigned l = !!(left->getType() == ValueType::Double);
-			unsigned r = !!(right->getType() == ValueType::Double);
-			switch( 2 * r + l ) {
-			case 0: return left->evalInt() * right->evalInt();
-			case 1: return left->evalDouble() * right->evalInt();
-			case 2: return left->evalInt() * right->evalDouble();
-			case 3: return left->evalDouble() * right->evalDouble();
-
-			default: assert(false);
-			}
-		}
-		case '/': {
-			unsigned l = !!(left->getType() == ValueType::Double);
-			unsigned r = !!(right->getType() == ValueType::Double);
-			switch( 2 * r + l ) {
-			case 0: return left->evalInt() / right->evalInt();
-			case 1: return left->evalDouble() / right->evalInt();
-			case 2: return left->evalInt() / right->evalDouble();
-			case 3: return left->evalDouble() / right->evalDouble();
-
-			default: assert(false);
-			} 
+		double l = evalDouble( n.left );
+		double r = evalDouble( n.right );
+		switch( n.op ) {
+		case '+': return l + r;
+		case '-': return l - r;
+		case '*': return l * r;
+		default: return l / r;
 		}
-		default: assert(false);
-		}
-    }    
-private:
-	char op;
-    std::unique_ptr<NodeBase> left;
-    std::unique_ptr<NodeBase> right;
-};
-
-class UnaryNode : public NodeBase
-{
-public:
-    UnaryNode() : op('-') {
-	
     }
 
-    UnaryNode( std::unique_ptr<NodeBase> child_ ) : op('-'), child(std::move(child_)) {}
+    /// set by an integer division by zero in the last evalInt()
+    bool divByZero = false;
 
-    void setChild( std::unique_ptr<NodeBase> p ) {
-		child = std::move( p );
-    }
-    
-    virtual void decideType() {
-		child->decideType();
-		setType( child->getType() );
-    }
-
-    int evalInt() const {
-		// switch op
-		assert( child->isInt() );
-		return -child->evalInt();
-    }
-
-    double evalDouble() const {
-		assert( child->isDouble() );
-		return -child->evalDouble();
-    }
 private:
-	char op;
-    std::unique_ptr<NodeBase> child;
-};
-
-class LeafNode : public NodeBase
-{
-public:
-    LeafNode( int i_ ) {
-		u.i = i_;
-		setType( ValueType::Int );
-    }
-
-    LeafNode( double d_ ) {
-		u.d = d_;
-		setType( ValueType::Double );
+    int add( const Node& n ) {
+		nodes.push_back( n );
+		return static_cast<int>( nodes.size() ) - 1;
     }
 
-    void decideType() {}
-    int evalInt() const override {
-		return u.i;
-    }
-    double evalDouble() const override {
-		return u.d;
-    }
-private:
-    union {
-		int i;
-		double d;
-    } u;
+    std::vector<Node> nodes;
 };
 
 namespace
@@ -338,20 +263,21 @@ bool isDigit1to9( char c )
 }
 
 inline
-void skipSpace( const std::string& text, std::size_t& pos )
+void skipSpace( std::string_view text, std::size_t& pos )
 {
-    while( std::isspace( text[pos] ) )
+    while( pos < text.size() && std::isspace( (unsigned char)text[pos] ) )
 		++pos;
 }
 
 template<typename OIter>
-bool tokenize( const std::string& text, OIter out );
-Token nextToken( const std::string& , std::size_t& );
+bool tokenize( std::string_view text, OIter out );
+Token nextToken( std::string_view, std::size_t& );
 
-std::unique_ptr<NodeBase> expr( const std::vector<Token>& , std::size_t& );
-std::unique_ptr<NodeBase> term( const std::vector<Token>& , std::size_t& );
-std::unique_ptr<NodeBase> factor( const std::vector<Token>& , std::size_t& );
-std::unique_ptr<NodeBase> primary( const std::vector<Token>& , std::size_t& );
+/// the parsers return the index of the node they built, -1 on error
+int expr( const std::vector<Token>& , std::size_t&, Tree& );
+int term( const std::vector<Token>& , std::size_t&, Tree& );
+int factor( const std::vector<Token>& , std::size_t&, Tree& );
+int primary( const std::vector<Token>& , std::size_t&, Tree& );
 
 /*
 void printTokens( const std::vector<Token>& tokens )
@@ -430,40 +356,44 @@ void assertTrue( const std::string& text, double expect )
 */
 }
 
-CalcResult calc(const std::string& str)
+CalcResult calc(std::string_view str)
 {
-	std::vector<Token> toks;
+	// kept between calls along with their capacity
+	static std::vector<Token> toks;
+	static Tree tree;
+	toks.clear();
+	tree.clear();
 	if (!tokenize(str, std::back_inserter(toks))) {
 		return {};
 	}
 
 	std::size_t pos = 0;
-	auto res = expr(toks, pos);
-	if (pos != toks.size() || !res) {
+	int root = expr(toks, pos, tree);
+	if (pos != toks.size() || root < 0) {
 		return {};
 	}
 
-	res->decideType();    
-    if (res->isInt()) {
-		return {res->evalInt(), CalcResult::Int};
-    } else if (res->isDouble()) {
-		return {res->evalInt(), CalcResult::Double};
-    } else {
-		return {};
-    }
+	if (tree.type(root) == ValueType::Int) {
+		int v = tree.evalInt(root);
+		if (tree.divByZero) {
+			return {};
+		}
+		return {v, CalcResult::Int};
+	}
+	return {tree.evalDouble(root), CalcResult::Double};
 }
 
 
 namespace {
-std::unique_ptr<NodeBase> expr( const std::vector<Token>& tokens, std::size_t& pos )
+int expr( const std::vector<Token>& tokens, std::size_t& pos, Tree& tree )
 {
     if( pos == tokens.size() ) {
-		return nullptr;
+		return -1;
     }
 
-    std::unique_ptr<NodeBase> left;
-    if( !(left = term( tokens, pos )) ) {
-		return nullptr;
+    int left;
+    if( (left = term( tokens, pos, tree )) < 0 ) {
+		return -1;
     }
 
     while( true ) {
@@ -474,17 +404,15 @@ std::unique_ptr<NodeBase> expr( const std::vector<Token>& tokens, std::size_t& p
 		if( tokens[pos].getType() == OP ) {
 			char op = tokens[pos++].getOp();
 			if( op == '+' || op == '-' ) {
-				auto right = term( tokens, pos );
-				if( !right ) {
-					return nullptr;
+				int right = term( tokens, pos, tree );
+				if( right < 0 ) {
+					return -1;
 				}
-				auto root = std::make_unique<BinaryNode>( op, std::move(left),
-														  std::move(right) );	    
-				left = std::move(root);
+				left = tree.bin( op, left, right );
 
 			} else {
-				assert( false ); // bakana
-				// return false;
+				// * or / where an operand should be: 2 + * 3
+				return -1;
 			}
 		} else {
 			return left;
@@ -492,15 +420,15 @@ std::unique_ptr<NodeBase> expr( const std::vector<Token>& tokens, std::size_t& p
     }
 }
 
-std::unique_ptr<NodeBase> term( const std::vector<Token>& tokens, std::size_t& pos )
+int term( const std::vector<Token>& tokens, std::size_t& pos, Tree& tree )
 {
     if( pos == tokens.size() ) {
-		return nullptr;
+		return -1;
     }
 
-    std::unique_ptr<NodeBase> left;
-    if( !(left = factor( tokens, pos )) ) {
-		return nullptr;
+    int left;
+    if( (left = factor( tokens, pos, tree )) < 0 ) {
+		return -1;
     }
 
     while( true ) {
@@ -512,15 +440,11 @@ std::unique_ptr<NodeBase> term( const std::vector<Token>& tokens, std::size_t& p
 			char op = tokens[pos].getOp(); // don't ++
 			if( op == '*' || op == '/' ) {
 				++pos;
-				auto right = factor( tokens, pos );
-				if( !right ) {
-					return nullptr;
+				int right = factor( tokens, pos, tree );
+				if( right < 0 ) {
+					return -1;
 				}
-
-				auto root = std::make_unique<BinaryNode>( op, std::move(left),
-														  std::move(right) );
-				left = std::move(root);
-
+				left = tree.bin( op, left, right );
 
 			} else {
 				// + or - in FOLLOW(factor)
@@ -533,60 +457,60 @@ std::unique_ptr<NodeBase> term( const std::vector<Token>& tokens, std::size_t& p
     }    
 }
 
-std::unique_ptr<NodeBase> factor( const std::vector<Token>& tokens, std::size_t& pos )
+int factor( const std::vector<Token>& tokens, std::size_t& pos, Tree& tree )
 {
     if( pos == tokens.size() ) {
-		return nullptr;
+		return -1;
     }
     
     Token tok = tokens[pos];
     if( tok.getType() == OP && tok.getOp() == '-' ) {
 		++pos;
-		auto subroot = primary( tokens, pos );
-		if( !subroot ) {
-			return nullptr;
+		int subroot = primary( tokens, pos, tree );
+		if( subroot < 0 ) {
+			return -1;
 		}
 	
-		return std::make_unique<UnaryNode>( std::move(subroot) );
+		return tree.neg( subroot );
     } else {
-		return primary( tokens, pos );
+		return primary( tokens, pos, tree );
     }
 }
 
-std::unique_ptr<NodeBase> primary( const std::vector<Token>& tokens, std::size_t& pos )
+int primary( const std::vector<Token>& tokens, std::size_t& pos, Tree& tree )
 {
     if( pos == tokens.size() ) {
-		return nullptr;
+		return -1;
     }
     
     Token tok = tokens[pos++];
     if( tok.getType() == INT ) {
-		return std::make_unique<LeafNode>( tok.getInt() );
+		return tree.leaf( tok.getInt() );
     } else if( tok.getType() == DOUBLE ) {
-		return std::make_unique<LeafNode>( tok.getDouble() );
+		return tree.leaf( tok.getDouble() );
     } else if( tok.getType() == LPAREN ) {
-		auto subroot = expr( tokens, pos );
-		if( !subroot ) {
-			return nullptr;
+		int subroot = expr( tokens, pos, tree );
+		if( subroot < 0 ) {
+			return -1;
 		}
 
 		if( pos == tokens.size() ) {
-			return nullptr;	// 3 + (
+			return -1;	// 3 + (
 		}
 	
 		Token tail = tokens[pos++];
 		if( tail.getType() == RPAREN ) {
 			return subroot;
 		} else {
-			return nullptr;
+			return -1;
 		}
     } else {
-		return nullptr;
+		return -1;
     }
 }
 
 template<typename OIter>
-bool tokenize( const std::string& text, OIter out )
+bool tokenize( std::string_view text, OIter out )
 {
     TokenType type = BEG;
     std::size_t pos = 0;
@@ -609,21 +533,19 @@ bool tokenize( const std::string& text, OIter out )
     return true;
 }
 
-Token nextToken( const std::string& text, std::size_t& pos )
+/// the longest token at pos. the automaton runs until it gets stuck,
+/// then falls back to the last accepting state it went through
+Token nextToken( std::string_view text, std::size_t& pos )
 {
     Token res;
     FaStatus status = S0_BEG;
-    std::vector<FaStatus> stack;
-    std::string lexeme;
+    FaStatus lastAccepted = INVALID;
+    std::size_t start = pos;
+    std::size_t end = pos;
     char curr;
     std::bitset<statusNum> accepted( 0x5C );
     for(; pos < text.size() && status != Se; ++pos ) {
 		curr = text[pos];
-		lexeme.push_back( curr );
-		if( accepted[status] ) {
-			stack.clear();
-		}
-		stack.push_back( status );
 		switch( status ) {
 		case S0:
 		case S0_BEG:
@@ -674,36 +596,36 @@ Token nextToken( const std::string& text, std::size_t& pos )
 		default:
 			assert( false );
 		}
+		if( status != Se && accepted[status] ) {
+			lastAccepted = status;
+			end = pos + 1;
+		}
     } // end for
 
-    while( status != S0_BEG && !accepted[status] ) {
-		status = stack.back();
-		stack.pop_back();
-		lexeme.pop_back();
-		--pos;
-    }
-
-    if( accepted[status] ) {
-		if( status == S1 ) {
-			assert( lexeme.size() == 1 );
-			if( lexeme[0] == '(' ) {
-				res.setParen( LPAREN );
-			} else if( lexeme[0] == ')' ) {
-				res.setParen( RPAREN );
-			} else {
-				res.setOp( lexeme[0] );
-			}
+    pos = end;
+    const char* first = text.data() + start;
+    const char* last = text.data() + end;
+    if( lastAccepted == S1 ) {
+		assert( end - start == 1 );
+		if( *first == '(' ) {
+			res.setParen( LPAREN );
+		} else if( *first == ')' ) {
+			res.setParen( RPAREN );
 		} else {
-			// number
-			if( status == S2 || status == S3 ) {
-				// integer
-				res.setInt( std::stoi( lexeme ) );		
-			} else {
-				// double
-				assert( status == S5 );
-				res.setDouble( std::stod( lexeme ) );
-			}
+			res.setOp( *first );
 		}
+    } else if( lastAccepted == S2 || lastAccepted == S3 ) {
+		int i;
+		auto r = std::from_chars( first, last, i );
+		if( r.ec == std::errc() ) {
+			res.setInt( i );
+		} else {
+			res.setBad();		// out of range
+		}
+    } else if( lastAccepted == S5 ) {
+		double d;
+		std::from_chars( first, last, d );
+		res.setDouble( d );
     } else {
 		res.setBad();
     }
@@ -1,6 +1,8 @@
 #ifndef CALC_ASLIB_H__
 #define CALC_ASLIB_H__
 
+#include <string_view>
+
 struct CalcResult
 {
 private:
@@ -28,6 +30,8 @@ public:
 	double doubleResult() { return u.d; }
 };
 
-CalcResult calc(const std::string&);
+/// evaluate + - * / and parentheses over ints and doubles. nothing is
+/// allocated once the buffers kept between calls are big enough
+CalcResult calc(std::string_view);
 
 #endif
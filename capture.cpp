@@ -0,0 +1,173 @@
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "capture.h"
+
+namespace
+{
+
+constexpr std::size_t FIRST_BUF = 64 * 1024;
+constexpr std::size_t PIPE_SIZE = 1024 * 1024;
+constexpr std::size_t SPLICE_LEN = 1024 * 1024;
+
+bool writeAll(int fd, const char* p, std::size_t n)
+{
+	while (n > 0) {
+		ssize_t w = write(fd, p, n);
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		p += w;
+		n -= w;
+	}
+	return true;
+}
+
+}
+
+std::size_t Capture::defaultCap()
+{
+	constexpr std::size_t dflt = 64 * 1024 * 1024;
+	const char* s = std::getenv("SLTSH_CAPTURE_MEM");
+	if (s == nullptr || *s == '\0') {
+		return dflt;
+	}
+	char* end;
+	unsigned long long n = std::strtoull(s, &end, 10);
+	if (end == s) {
+		return dflt;
+	}
+	switch (*end) {
+	case 'g': case 'G': n <<= 10; // fall through
+	case 'm': case 'M': n <<= 10; // fall through
+	case 'k': case 'K': n <<= 10; ++end; break;
+	}
+	return *end == '\0' ? n : dflt;
+}
+
+Capture::Capture(std::size_t memCap)
+	: cap_(memCap)
+{
+}
+
+Capture::~Capture()
+{
+	std::free(buf_);
+	if (map_) {
+		munmap(map_, len_);
+	}
+	if (memfd_ >= 0) {
+		close(memfd_);
+	}
+}
+
+/// double the buffer, up to the cap. realloc moves large blocks with
+/// mremap, so the bytes already read are not copied
+bool Capture::grow()
+{
+	std::size_t n = bufLen_ ? bufLen_ * 2 : FIRST_BUF;
+	if (n > cap_) {
+		n = cap_;
+	}
+	char* p = static_cast<char*>(std::realloc(buf_, n));
+	if (p == nullptr) {
+		return false;
+	}
+	buf_ = p;
+	bufLen_ = n;
+	return true;
+}
+
+/// move what is in memory to a new memfd; the rest goes there directly
+bool Capture::spill()
+{
+	memfd_ = memfd_create("sltsh-capture", MFD_CLOEXEC);
+	if (memfd_ < 0 || !writeAll(memfd_, buf_, len_)) {
+		return false;
+	}
+	std::free(buf_);
+	buf_ = nullptr;
+	bufLen_ = 0;
+	return true;
+}
+
+/// map what was spilled, once the pipe is at its end
+bool Capture::finish()
+{
+	if (memfd_ < 0 || len_ == 0) {
+		return true;
+	}
+	void* p = mmap(nullptr, len_, PROT_READ, MAP_PRIVATE, memfd_, 0);
+	if (p == MAP_FAILED) {
+		return false;
+	}
+	madvise(p, len_, MADV_SEQUENTIAL);
+	map_ = p;
+	return true;
+}
+
+long Capture::feed(int fd)
+{
+	if (memfd_ < 0 && len_ == bufLen_) {
+		bool ok = bufLen_ < cap_ ? grow() : spill();
+		if (!ok) {
+			return -1;
+		}
+	}
+
+	ssize_t n;
+	if (memfd_ < 0) {
+		n = read(fd, buf_ + len_, bufLen_ - len_);
+	} else if ((n = splice(fd, nullptr, memfd_, nullptr, SPLICE_LEN, SPLICE_F_MOVE)) < 0
+			   && errno == EINVAL) {
+		// fd is not a pipe: copy through a buffer instead
+		char tmp[64 * 1024];
+		n = read(fd, tmp, sizeof(tmp));
+		if (n > 0 && !writeAll(memfd_, tmp, n)) {
+			return -1;
+		}
+	}
+
+	if (n > 0) {
+		len_ += n;
+	} else if (n == 0 && !finish()) {
+		return -1;
+	}
+	return n;
+}
+
+void Capture::widen(int fd)
+{
+	// a plain file or an unprivileged limit just keeps the size it has
+	fcntl(fd, F_SETPIPE_SZ, PIPE_SIZE);
+}
+
+bool Capture::drain(int fd)
+{
+	widen(fd);
+	for (;;) {
+		long n = feed(fd);
+		if (n == 0) {
+			return true;
+		} else if (n < 0 && errno != EINTR) {
+			return false;
+		}
+	}
+}
+
+std::string_view Capture::text() const
+{
+	const char* p = map_ ? static_cast<const char*>(map_) : buf_;
+	if (p == nullptr) {
+		return {};
+	}
+	std::size_t n = len_;
+	while (n > 0 && p[n - 1] == '\n') {
+		--n;
+	}
+	return std::string_view(p, n);
+}
@@ -0,0 +1,55 @@
+#ifndef CAPTURE_H__
+#define CAPTURE_H__
+
+#include <cstddef>
+#include <string_view>
+
+/// collects what a command substitution writes to its pipe. the bytes
+/// are read straight into one growing buffer; past the memory cap they
+/// move to an anonymous memfd, filled with splice(), and are mapped back
+/// when the pipe is drained
+class Capture
+{
+public:
+	/// the cap from SLTSH_CAPTURE_MEM, in bytes with an optional k, m or
+	/// g suffix; 64m when unset or malformed
+	static std::size_t defaultCap();
+
+	explicit Capture(std::size_t memCap = defaultCap());
+	Capture(const Capture&) = delete;
+	Capture& operator=(const Capture&) = delete;
+	~Capture();
+
+	/// read fd until end of file. false on a read or spill error,
+	/// with what was read so far kept
+	bool drain(int fd);
+
+	/// one read from fd, for callers that poll several captures:
+	/// the bytes taken, 0 at end of file, -1 with errno set (EAGAIN
+	/// when a non-blocking fd has nothing yet)
+	long feed(int fd);
+
+	/// make fd a pipe worth reading in large pieces, where allowed
+	static void widen(int fd);
+
+	/// the output less its trailing newlines, valid while the capture
+	/// lives. nothing is copied: the newlines are only left out
+	std::string_view text() const;
+
+	std::size_t size() const { return len_; }
+	bool spilled() const { return memfd_ >= 0; }
+
+private:
+	bool grow();
+	bool spill();
+	bool finish();
+
+	std::size_t cap_;
+	char* buf_ = nullptr;
+	std::size_t bufLen_ = 0;
+	std::size_t len_ = 0;
+	int memfd_ = -1;
+	void* map_ = nullptr;
+};
+
+#endif
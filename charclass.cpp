@@ -0,0 +1,65 @@
+#include <cstdint>
+#include "charclass.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#if defined(__x86_64__)
+
+/// the vector loops. each load is aligned, so it never reaches into a
+/// page the string is not in, whatever lies past its '\0'
+struct ByteSetScan
+{
+	__attribute__((target("avx2")))
+	static char const* avx2(const ByteSet& s, char const* p)
+	{
+		const __m256i lo = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)s.lo_));
+		const __m256i hi = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)s.hi_));
+		const __m256i nibble = _mm256_set1_epi8(0x0f);
+		const __m256i zero = _mm256_setzero_si256();
+		auto off = reinterpret_cast<uintptr_t>(p) & 31;
+		char const* a = p - off;
+		uint32_t skip = ~0u << off;
+		for (;; a += 32, skip = ~0u) {
+			__m256i v = _mm256_load_si256((const __m256i*)a);
+			__m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(v, nibble));
+			__m256i h = _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+			__m256i none = _mm256_cmpeq_epi8(_mm256_and_si256(l, h), zero);
+			uint32_t found = ~uint32_t(_mm256_movemask_epi8(none)) & skip;
+			if (found)
+				return a + __builtin_ctz(found);
+		}
+	}
+
+	/// no byte shuffle in SSE2: one compare per member
+	static char const* sse2(const ByteSet& s, char const* p)
+	{
+		auto off = reinterpret_cast<uintptr_t>(p) & 15;
+		char const* a = p - off;
+		uint32_t skip = 0xffffu << off;
+		for (;; a += 16, skip = 0xffffu) {
+			__m128i v = _mm_load_si128((const __m128i*)a);
+			__m128i any = _mm_setzero_si128();
+			for (unsigned i = 0; i < s.count_; ++i)
+				any = _mm_or_si128(any, _mm_cmpeq_epi8(v, _mm_set1_epi8(s.members_[i])));
+			uint32_t found = uint32_t(_mm_movemask_epi8(any)) & skip;
+			if (found)
+				return a + __builtin_ctz(found);
+		}
+	}
+};
+
+char const* ByteSet::find(char const* p) const
+{
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+	return avx2 ? ByteSetScan::avx2(*this, p) : ByteSetScan::sse2(*this, p);
+}
+
+#else
+
+char const* ByteSet::find(char const* p) const
+{
+	return findScalar(p);
+}
+
+#endif
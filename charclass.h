@@ -0,0 +1,132 @@
+#ifndef CHARCLASS_H__
+#define CHARCLASS_H__
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+/// what the lexers ask about a byte, answered from one table built at
+/// compile time: no locale, no call
+namespace chars
+{
+
+enum : uint8_t
+{
+	Blank = 1 << 0,		// ' ' '\t'
+	Delim = 1 << 1,		// ( ) ; & | < >
+	WordEnd = 1 << 2,	// '\0', Blank, Delim
+	Special = 1 << 3,	// ' " \ $ ~ * ? [: a word needs more than a copy
+	Wild = 1 << 4,		// * ? [
+	Ifs = 1 << 5,		// ' ' '\t' '\n': what an unquoted expansion splits on
+	Digit = 1 << 6,
+	NameStart = 1 << 7,	// letters and '_'
+};
+
+constexpr std::array<uint8_t, 256> makeTable()
+{
+	std::array<uint8_t, 256> t{};
+	auto mark = [&t](std::string_view s, uint8_t cls) {
+		for (char ch : s)
+			t[static_cast<unsigned char>(ch)] |= cls;
+	};
+	mark(" \t", Blank | WordEnd);
+	mark("();&|<>", Delim | WordEnd);
+	mark(std::string_view("", 1), WordEnd);
+	mark("'\"\\$~*?[", Special);
+	mark("*?[", Wild);
+	mark(" \t\n", Ifs);
+	mark("0123456789", Digit);
+	mark("_", NameStart);
+	for (int ch = 'a'; ch <= 'z'; ++ch)
+		t[ch] |= NameStart;
+	for (int ch = 'A'; ch <= 'Z'; ++ch)
+		t[ch] |= NameStart;
+	return t;
+}
+
+inline constexpr std::array<uint8_t, 256> table = makeTable();
+
+constexpr bool is(char ch, uint8_t cls)
+{
+	return table[static_cast<unsigned char>(ch)] & cls;
+}
+
+/// letters, digits and '_'
+constexpr bool isNameChar(char ch)
+{
+	return is(ch, NameStart | Digit);
+}
+
+/// a-z and A-Z, whatever the locale
+constexpr bool isLetter(char ch)
+{
+	return is(ch, NameStart) && ch != '_';
+}
+
+}
+
+/// a set of bytes to look for in a string, '\0' always one of them.
+/// find() goes 32 bytes at a time with AVX2, 16 with SSE2, and a byte at
+/// a time elsewhere
+class ByteSet
+{
+public:
+	constexpr explicit ByteSet(std::string_view members)
+	{
+		add('\0');
+		for (char ch : members)
+			add(ch);
+	}
+
+	constexpr bool has(char ch) const
+	{
+		auto c = static_cast<unsigned char>(ch);
+		return lo_[c & 15] & hi_[c >> 4];
+	}
+
+	/// the first byte from p on that is in the set
+	char const* find(char const* p) const;
+	/// the bytes from p up to the first one in the set
+	std::string_view span(char const* p) const
+	{
+		return std::string_view(p, find(p) - p);
+	}
+
+	char const* findScalar(char const* p) const
+	{
+		while (!has(*p))
+			++p;
+		return p;
+	}
+
+private:
+	/// a byte is in when the bit its high nibble was given is set for
+	/// its low nibble: lo_[c & 15] & hi_[c >> 4]. with at most eight
+	/// different high nibbles that is exact, and it is what pshufb can
+	/// look up 32 bytes at a time
+	constexpr void add(char ch)
+	{
+		auto c = static_cast<unsigned char>(ch);
+		uint8_t& bit = hi_[c >> 4];
+		if (bit == 0) {
+			// a constant set this big does not compile
+			if (nibbles_ == 8)
+				throw "ByteSet: more than eight high nibbles";
+			bit = uint8_t(1u << nibbles_++);
+		}
+		if (count_ == sizeof(members_))
+			throw "ByteSet: too many members";
+		lo_[c & 15] |= bit;
+		members_[count_++] = ch;
+	}
+
+	alignas(16) uint8_t lo_[16] = {};
+	alignas(16) uint8_t hi_[16] = {};
+	char members_[32] = {};
+	unsigned count_ = 0;
+	unsigned nibbles_ = 0;
+
+	friend struct ByteSetScan;
+};
+
+#endif
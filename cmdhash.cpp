@@ -0,0 +1,163 @@
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cmdhash.h"
+
+namespace
+{
+
+struct timespec mtimeOf(const std::string& dir)
+{
+	struct stat st;
+	if (stat(dir.c_str(), &st) < 0) {
+		return {0, 0};
+	}
+	return st.st_mtim;
+}
+
+bool sameTime(const struct timespec& a, const struct timespec& b)
+{
+	return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+bool isExecutable(const std::string& path)
+{
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)
+		&& access(path.c_str(), X_OK) == 0;
+}
+
+}
+
+CommandHash& getCommandHash()
+{
+	static CommandHash hash;
+	return hash;
+}
+
+void CommandHash::loadPath(const char* path)
+{
+	table_.clear();
+	dirs_.clear();
+	pathVar_ = path ? path : "";
+	loaded_ = true;
+
+	std::size_t beg = 0;
+	for (;;) {
+		std::size_t end = pathVar_.find(':', beg);
+		std::string dir = pathVar_.substr(beg, end == std::string::npos
+										  ? std::string::npos : end - beg);
+		if (dir.empty()) {
+			// an empty PATH entry means the current directory
+			dir = ".";
+		}
+		dirs_.push_back({dir, mtimeOf(dir)});
+		if (end == std::string::npos)
+			break;
+		beg = end + 1;
+	}
+}
+
+/// a directory changed: whatever was found in it or after it, and
+/// every miss, may resolve differently now
+void CommandHash::dropFrom(std::size_t dirIdx)
+{
+	for (auto iter = table_.begin(); iter != table_.end(); ) {
+		if (iter->second.path.empty() || iter->second.dirIdx >= dirIdx) {
+			iter = table_.erase(iter);
+		} else {
+			++iter;
+		}
+	}
+}
+
+void CommandHash::revalidate()
+{
+	// the directories are only looked at by the next lookup, so lines
+	// made of builtins pay nothing
+	checkPending_ = true;
+}
+
+void CommandHash::check()
+{
+	checkPending_ = false;
+	const char* path = pathSource_ ? pathSource_() : std::getenv("PATH");
+	if (!loaded_ || pathVar_ != (path ? path : "")) {
+		loadPath(path);
+		return;
+	}
+	for (std::size_t i = 0; i < dirs_.size(); ++i) {
+		auto now = mtimeOf(dirs_[i].name);
+		if (!sameTime(now, dirs_[i].mtime)) {
+			dirs_[i].mtime = now;
+			dropFrom(i);
+		}
+	}
+}
+
+const char* CommandHash::lookup(const char* name)
+{
+	if (std::strchr(name, '/')) {
+		return name;
+	}
+	if (checkPending_ || !loaded_) {
+		check();
+	}
+
+	auto iter = table_.find(name);
+	if (iter != table_.end()) {
+		++iter->second.hits;
+		return iter->second.path.empty() ? nullptr : iter->second.path.c_str();
+	}
+
+	// results that went through a relative PATH entry depend on the
+	// current directory, so they are not remembered
+	bool cacheable = true;
+	for (std::size_t i = 0; i < dirs_.size(); ++i) {
+		bool relative = dirs_[i].name[0] != '/';
+		cacheable = cacheable && !relative;
+		std::string full = dirs_[i].name + "/" + name;
+		if (isExecutable(full)) {
+			if (!cacheable) {
+				static std::string uncached;
+				uncached = std::move(full);
+				return uncached.c_str();
+			}
+			auto& e = table_[name];
+			e = {std::move(full), i, 1};
+			return e.path.c_str();
+		}
+	}
+	if (cacheable) {
+		table_[name] = {"", dirs_.size(), 1};
+	}
+	return nullptr;
+}
+
+void CommandHash::forget(const char* name)
+{
+	table_.erase(name);
+}
+
+void CommandHash::reset()
+{
+	table_.clear();
+}
+
+std::string CommandHash::dump() const
+{
+	if (table_.empty()) {
+		return "hash: hash table empty\n";
+	}
+	std::string ret = "hits\tcommand\n";
+	for (auto& kv : table_) {
+		ret += std::to_string(kv.second.hits) + "\t";
+		if (kv.second.path.empty()) {
+			ret += kv.first + " (not found)\n";
+		} else {
+			ret += kv.second.path + "\n";
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,58 @@
+#ifndef CMDHASH_H__
+#define CMDHASH_H__
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <ctime>
+
+/// remembers where on PATH each command lives, like bash's hash table.
+/// misses are remembered too, since they are the most expensive
+/// lookups: every PATH directory has to fail
+class CommandHash
+{
+public:
+	/// absolute path to exec for name, or nullptr if name is not on
+	/// PATH. names containing a '/' are returned unchanged
+	const char* lookup(const char* name);
+
+	/// drop what PATH changes or directory modifications made stale.
+	/// called once per command line, not once per lookup
+	void revalidate();
+
+	/// where PATH is read from; the process environment by default
+	void setPathSource(const char* (*fn)()) { pathSource_ = fn; }
+
+	void forget(const char* name);
+	void reset();
+	/// the table as the hash builtin lists it
+	std::string dump() const;
+
+private:
+	struct Entry
+	{
+		std::string path;		// empty: not found
+		std::size_t dirIdx;		// the PATH entry it was found in
+		unsigned hits;
+	};
+	struct Dir
+	{
+		std::string name;
+		struct timespec mtime;
+	};
+
+	void check();
+	void loadPath(const char* path);
+	void dropFrom(std::size_t dirIdx);
+
+	std::unordered_map<std::string, Entry> table_;
+	std::string pathVar_;
+	std::vector<Dir> dirs_;
+	bool loaded_ = false;
+	bool checkPending_ = false;
+	const char* (*pathSource_)() = nullptr;
+};
+
+CommandHash& getCommandHash();
+
+#endif
@@ -1,49 +1,125 @@
 #include "context.h"
+#include "nodes.h"
 #include <cassert>
 #include <sys/wait.h>
 #include <sstream>
 
-template<typename T>
-static inline auto toUInt(T t)
+int Context::minUsableJobId()
 {
-	return static_cast<typename std::underlying_type<T>::type>(t);
+	if (freeIds_.empty()) {
+		return nextJobId_++;
+	}
+	int id = freeIds_.top();
+	freeIds_.pop();
+	return id;
 }
 
-JobStatus resultTable[4][4] = {
-	            /* Running    Stopped    Exited   Signaled*/
-	/*Running*/ {JobStatus::Running, JobStatus::Running, JobStatus::Running, JobStatus::Running},
-	/*Stopped*/ {JobStatus::Running, JobStatus::Stopped, JobStatus::Stopped, JobStatus::Stopped},	
-	/*Exited  */{JobStatus::Running, JobStatus::Stopped, JobStatus::Finished, JobStatus::Finished},	
-	/*Signaled*/{JobStatus::Running, JobStatus::Stopped, JobStatus::Finished, JobStatus::Finished},
-};
+int Context::addJob(std::vector<pid_t> pids, const NodeBase* node)
+{
+	int jid = minUsableJobId();
+	// share the line's lifetime instead of copying its text now
+	std::shared_ptr<const NodeBase> ref(currentLine, node);
+	auto pr = jobMap.emplace(jid, Job(std::move(pids), std::move(ref)));
+	assert(pr.second);
+	auto& job = pr.first->second;
+	for (int i = 0; i < job.nproc; ++i) {
+		pidIndex[job.pid[i]] = {pr.first, i};
+	}
+	return jid;
+}
 
-int Context::minUsableJobId()
+void Context::removeJob(JobMap::iterator iter)
 {
-    int i;
-    for (i = 0; i < jobIdUsed.size() && jobIdUsed[i]; ++i) {
-    }
-
-    if (i == jobIdUsed.size()) {
-        jobIdUsed.push_back(false);
-    }
-    return i;
+	for (pid_t p : iter->second.pid) {
+		pidIndex.erase(p);
+	}
+	freeIds_.push(iter->first);
+	jobMap.erase(iter);
 }
 
+const std::string& Job::command() const
+{
+	if (node_) {
+		jobCmd_ = node_->toString();
+		node_.reset();
+	}
+	return jobCmd_;
+}
+
+JobStatus Job::foldStatus() const
+{
+	// running while any process runs, stopped while the rest are stopped
+	bool stopped = false;
+	for (auto st : statInd) {
+		if (st == ProcStatus::Running)
+			return JobStatus::Running;
+		stopped = stopped || st == ProcStatus::Stopped;
+	}
+	return stopped ? JobStatus::Stopped : JobStatus::Finished;
+}
 
 std::pair<Context::JobMap::iterator, int>
 Context::getJob(pid_t pid)
 {
-	for (auto iter = jobMap.begin(); iter != jobMap.end(); ++iter) {
-		auto& job = iter->second;
-		if (job.pid[0] == pid) {
-			return {iter, 0};
-		}
-		if (job.pid[1] != 0 && job.pid[1] == pid) {
-			return {iter, 1};
+	auto iter = pidIndex.find(pid);
+	if (iter == pidIndex.end()) {
+		return {jobMap.end(), 0};
+	}
+	return {iter->second.job, iter->second.idx};
+}
+
+void Context::report(JobMap::iterator iter, const char* what, bool bg)
+{
+	auto& job = iter->second;
+	if (bg && !interactive) {
+		return;
+	}
+	if (!bg) {
+		// a foreground job that simply ran to completion is not worth a word
+		bool allExited = true;
+		for (auto st : job.statInd) {
+			allExited = allExited && st == ProcStatus::Exited;
 		}
+		if (job.stat == JobStatus::Finished && allExited)
+			return;
+	}
+
+	std::ostringstream os;
+	os << "[" << iter->first << "] " << what << "\t" << job.command() << "\n";
+	for (auto& ev : job.eventStr) {
+		os << '\t' << ev << "\n";
+	}
+	if (!bg) {
+		fprintf(stderr, "%s", os.str().c_str());
+	} else {
+		delayedMsg.push(os.str());
 	}
+}
 
-	return {jobMap.end(), 0};
+void Context::onProcessEvent(pid_t pid, int statloc)
+{
+	auto iter = pidIndex.find(pid);
+	if (iter == pidIndex.end()) {
+		return;
+	}
+	bool bg = iter->second.job->first != fgJob;
+	if (WIFEXITED(statloc)) {
+		onProcessExited(pid, statloc, bg);
+	} else if (WIFSTOPPED(statloc)) {
+		onProcessStopped(pid, statloc, bg);
+	} else if (WIFSIGNALED(statloc)) {
+		onProcessSignaled(pid, statloc, bg);
+	}
+}
+
+void Context::finishJob(JobMap::iterator iter, bool bg)
+{
+	report(iter, "Finished", bg);
+	if (!bg) {
+		lastExitStatus = iter->second.status;
+	}
+	doneStatus[iter->first] = iter->second.status;
+	removeJob(iter);
 }
 
 void Context::onProcessExited(pid_t pid, int statloc, bool bg)
@@ -51,49 +127,20 @@ void Context::onProcessExited(pid_t pid, int statloc, bool bg)
 	assert(WIFEXITED(statloc));
 	auto [iter, idx] = getJob(pid);
 	assert(iter != jobMap.end());
-	lastExitStatus = WEXITSTATUS(statloc);
 	auto& job = iter->second;	
 	job.statInd[idx] = ProcStatus::Exited;
+	if (idx == job.nproc - 1) {
+		job.status = WEXITSTATUS(statloc);
+	}
 	job.eventStr[idx] = std::to_string((long)pid) +
 		" exited with status " + std::to_string((long)WEXITSTATUS(statloc));
-	auto origstat = job.stat;
-	int another = 1 - idx;
-	if (job.nproc == 2) {
-		job.stat = resultTable[toUInt(job.statInd[idx])][toUInt(job.statInd[another])];
-	} else {
-		job.stat = JobStatus::Finished;
-	}
+	job.stat = job.foldStatus();
 
 	if (job.stat == JobStatus::Finished) {
-		std::ostringstream os;
-		os << "[" << iter->first << "] Finished\t" << job.jobCmd << "\n\t"
-		   << job.eventStr[0] << "\n";
-		if (job.nproc == 2)
-			os << '\t' << job.eventStr[1] << "\n";
-		if (!bg) {
-			if (!(job.statInd[0] == ProcStatus::Exited &&
-				(job.nproc == 1 || job.statInd[1] == ProcStatus::Exited))) 
-			fprintf(stderr, "%s", os.str().c_str());
-		} else {
-			delayedMsg.push(os.str());
-		}
-		
-		jobIdUsed[iter->first] = false;
-		jobMap.erase(iter);
+		finishJob(iter, bg);
 	} else if (job.stat == JobStatus::Stopped) {
-		std::ostringstream os;
-		os << "[" << iter->first << "] Stopped\n\t" << job.jobCmd << "\n\t"
-		   << job.eventStr[0] << "\n";
-		if (job.nproc == 2)
-			os << '\t' << job.eventStr[1] << "\n";
-		if (!bg) {
-			fprintf(stderr, "%s", os.str().c_str());
-		} else {
-			delayedMsg.push(os.str());
-		}
+		report(iter, "Stopped", bg);
 	}
-
-	
 }
 
 void Context::onProcessStopped(pid_t pid, int statloc, bool bg)
@@ -104,28 +151,18 @@ void Context::onProcessStopped(pid_t pid, int statloc, bool bg)
 
 	auto& job = iter->second;
 	job.statInd[idx] = ProcStatus::Stopped;
-	lastExitStatus = 128 + WSTOPSIG(statloc);
+	if (idx == job.nproc - 1) {
+		job.status = 128 + WSTOPSIG(statloc);
+	}
+	if (!bg) {
+		lastExitStatus = 128 + WSTOPSIG(statloc);
+	}
 	job.eventStr[idx] = std::to_string((long)pid) +
 		" stopped by signal " + std::to_string((long)WSTOPSIG(statloc));
-	int another = 1 - idx;
-	auto origStat = job.stat;
-	if (job.nproc == 2) {
-		job.stat = resultTable[toUInt(job.statInd[idx])][toUInt(job.statInd[another])];
-	} else {
-		job.stat = JobStatus::Stopped;
-	}
+	job.stat = job.foldStatus();
 
 	if (job.stat == JobStatus::Stopped) {
-		std::ostringstream os;
-		os << "[" << iter->first << "] Stopped\t" << job.jobCmd << "\n\t"
-		   << job.eventStr[0] << "\n";
-		if (job.nproc == 2)
-			os << '\t' << job.eventStr[1] << "\n";
-		if (!bg) {
-			fprintf(stderr, "%s", os.str().c_str());
-		} else {
-			delayedMsg.push(os.str());
-		}
+		report(iter, "Stopped", bg);
 	}
 }
 
@@ -137,41 +174,16 @@ void Context::onProcessSignaled(pid_t pid, int statloc, bool bg)
 
 	auto& job = iter->second;
 	job.statInd[idx] = ProcStatus::Signaled;
-	lastExitStatus = 128 + WTERMSIG(statloc);
-	job.eventStr[idx] = std::to_string(pid) +
-		"terminated by signal " + std::to_string(WTERMSIG(statloc));
-	
-	int another = 1 - idx;
-	if (job.nproc == 2) {
-		job.stat = resultTable[toUInt(job.statInd[idx])][toUInt(job.statInd[another])];
-	} else {
-		job.stat = JobStatus::Finished;
+	if (idx == job.nproc - 1) {
+		job.status = 128 + WTERMSIG(statloc);
 	}
+	job.eventStr[idx] = std::to_string(pid) +
+		" terminated by signal " + std::to_string(WTERMSIG(statloc));
+	job.stat = job.foldStatus();
 
 	if (job.stat == JobStatus::Finished) {
-		std::ostringstream os;
-		os << "[" << iter->first << "] Finished\t" << job.jobCmd << "\n\t"
-		   << job.eventStr[0] << "\n";
-		if (job.nproc == 2)
-			os << '\t' << job.eventStr[1] << "\n";
-		if (!bg) {
-			fprintf(stderr, "%s", os.str().c_str());
-		} else {
-			delayedMsg.push(os.str());
-		}
-
-		jobMap.erase(iter);
-		jobIdUsed[iter->first] = false;
+		finishJob(iter, bg);
 	} else if (job.stat == JobStatus::Stopped) {
-		std::ostringstream os;
-		os << "[" << iter->first << "] Stopped\n\t" << job.jobCmd << "\n\t"
-		   << job.eventStr[0] << "\n";
-		if (job.nproc == 2)
-			os << '\t' << job.eventStr[1] << "\n";
-		if (!bg) {
-			fprintf(stderr, "%s", os.str().c_str());
-		} else {
-			delayedMsg.push(os.str());
-		}
+		report(iter, "Stopped", bg);
 	}
 }
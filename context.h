@@ -2,11 +2,19 @@
 #define CONTEXT_H__
 
 #include <map>
+#include <memory>
+#include <vector>
 #include <queue>
+#include <unordered_map>
+#include <functional>
 #include <utility>
 #include <string>
 #include <cassert>
 #include <iostream>
+#include <sys/types.h>
+
+struct NodeBase;
+struct CmdLine;
 enum class JobStatus
 {
     Running, Stopped, Finished,
@@ -21,57 +29,88 @@ static const char* strJobStatus[3] = {"Running", "Stopped", "Finished"};
 
 struct Job
 {
-    pid_t pid[2];
-	ProcStatus statInd[2] = { ProcStatus::Running, ProcStatus::Running };
-	std::string eventStr[2];
-    std::string jobCmd;
+    std::vector<pid_t> pid;
+	std::vector<ProcStatus> statInd;
+	std::vector<std::string> eventStr;
     JobStatus stat;
 	int nproc;
+	/// what $? becomes for this job: the status of its last stage
+	int status = 0;
 
-	Job(pid_t p, std::string cmd)
-		: jobCmd(std::move(cmd)), stat(JobStatus::Running), nproc(1) {
-		pid[0] = p; pid[1] = 0;
-	}
-	Job(pid_t p, pid_t q, std::string cmd)
-		: jobCmd(std::move(cmd)), stat(JobStatus::Running), nproc(2) {
-		pid[0] = p; pid[1] = q;
+	/// one process per pipeline stage, all in the group of pids[0].
+	/// node is the part of the command line the job runs
+	Job(std::vector<pid_t> pids, std::shared_ptr<const NodeBase> node)
+		: pid(std::move(pids)), statInd(pid.size(), ProcStatus::Running),
+		  eventStr(pid.size()), stat(JobStatus::Running), nproc(pid.size()),
+		  node_(std::move(node)) {}
+
+	pid_t pgid() const {
+		return pid[0];
 	}
+
+	/// fold the state of every process into the state of the job
+	JobStatus foldStatus() const;
+
+	/// the text of the job, built the first time somebody asks
+	const std::string& command() const;
+
+private:
+	mutable std::shared_ptr<const NodeBase> node_;
+	mutable std::string jobCmd_;
 };
 
 struct Context
 {
 	using JobMap = std::map<int, Job>;
-    std::vector<bool> jobIdUsed;
+	struct ProcRef
+	{
+		JobMap::iterator job;
+		int idx;
+	};
+
     JobMap jobMap;
+    /// every live process of every job, so a reaped child costs O(1)
+    std::unordered_map<pid_t, ProcRef> pidIndex;
     //Job* currFg;
     std::queue<std::string> delayedMsg;
     int lastExitStatus = 0;
+    /// job control: jobs get their own process groups and the terminal,
+    /// and their state changes are reported. off for -c and scripts
+    bool interactive = true;
+    /// id of the job the shell is waiting on, -1 if none. everything
+    /// else is background and gets reported at the next prompt
+    int fgJob = -1;
+    /// status of the jobs that finished since the last prompt, for wait
+    std::unordered_map<int, int> doneStatus;
+    /// the line being executed. jobs share ownership of it so their
+    /// command string only has to be built when it is printed
+    std::shared_ptr<CmdLine> currentLine;
 
     Context() {
         //currFg = nullptr;
     }
 
 	std::pair<JobMap::iterator, int> getJob(pid_t pid);
-	template<typename... Args>
-	int /*jobid*/ addJob(Args&&... args);
+	int /*jobid*/ addJob(std::vector<pid_t> pids, const NodeBase* node);
+	int /*jobid*/ addJob(pid_t pid, const NodeBase* node) {
+		return addJob(std::vector<pid_t>{pid}, node);
+	}
 	
+	/// dispatch a waitpid status. pids that belong to no job are ignored
+	void onProcessEvent(pid_t pid, int statloc);
 	void onProcessExited(pid_t pid, int statloc, bool bg);
 	void onProcessStopped(pid_t pid, int statloc, bool bg);
 	void onProcessSignaled(pid_t pid, int statloc, bool bg);
 
 private:
 	int minUsableJobId();
-};
+	void removeJob(JobMap::iterator iter);
+	void finishJob(JobMap::iterator iter, bool bg);
+	void report(JobMap::iterator iter, const char* what, bool bg);
 
-
-template<typename... Args>
-int Context::addJob(Args&&... args)
-{
-	int jid = minUsableJobId();
-	jobIdUsed[jid] = true;
-	auto pr = jobMap.insert({jid, {std::forward<Args>(args)...}});
-	assert(pr.second);
-	return jid;
-}
+	/// ids given back by finished jobs; the smallest is reused first
+	std::priority_queue<int, std::vector<int>, std::greater<int>> freeIds_;
+	int nextJobId_ = 0;
+};
 
 #endif //CONTEXT_H__
@@ -0,0 +1,120 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include "eventloop.h"
+#include "context.h"
+
+// from shell.cpp
+extern Context& getContext();
+
+EventLoop& getEventLoop()
+{
+	static EventLoop loop;
+	return loop;
+}
+
+void EventLoop::init()
+{
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGCHLD);
+	if (sigprocmask(SIG_BLOCK, &set, &origMask_) < 0) {
+		std::perror("sigprocmask error");
+		std::exit(6);
+	}
+	open();
+}
+
+void EventLoop::open()
+{
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGCHLD);
+	if ((sigfd_ = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+		std::perror("signalfd error");
+		std::exit(6);
+	}
+	if ((epfd_ = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		std::perror("epoll_create1 error");
+		std::exit(6);
+	}
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.fd = sigfd_;
+	if (epoll_ctl(epfd_, EPOLL_CTL_ADD, sigfd_, &ev) < 0) {
+		std::perror("epoll_ctl error");
+		std::exit(6);
+	}
+}
+
+void EventLoop::watch(int fd, void (*drain)())
+{
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		std::perror("epoll_ctl error");
+		std::exit(6);
+	}
+	sources_.push_back({fd, drain});
+}
+
+void EventLoop::afterFork()
+{
+	// the parent's sources report to the parent
+	sources_.clear();
+	close(epfd_);
+	close(sigfd_);
+	open();
+}
+
+void EventLoop::restoreChildMask() const
+{
+	if (sigprocmask(SIG_SETMASK, &origMask_, nullptr) < 0) {
+		std::perror("sigprocmask error");
+		std::exit(6);
+	}
+}
+
+void EventLoop::reap()
+{
+	int statloc;
+	pid_t pid;
+	// SIGCHLDs coalesce, so one wakeup may stand for any number of
+	// children: keep going until nothing is left
+	while ((pid = waitpid(-1, &statloc, WUNTRACED | WNOHANG)) > 0) {
+		getContext().onProcessEvent(pid, statloc);
+	}
+	if (pid < 0 && errno != ECHILD) {
+		std::perror("waitpid error");
+		std::exit(15);
+	}
+	drainSources();
+}
+
+void EventLoop::drainSources()
+{
+	for (auto& src : sources_) {
+		src.drain();
+	}
+}
+
+void EventLoop::wait()
+{
+	struct epoll_event ev[4];
+	int n;
+	while ((n = epoll_wait(epfd_, ev, 4, -1)) < 0) {
+		if (errno != EINTR) {
+			std::perror("epoll_wait error");
+			std::exit(15);
+		}
+	}
+	// only the wakeup matters, waitpid tells what happened
+	struct signalfd_siginfo info[16];
+	while (read(sigfd_, info, sizeof(info)) > 0)
+		;
+}
@@ -0,0 +1,60 @@
+#ifndef EVENTLOOP_H__
+#define EVENTLOOP_H__
+
+#include <vector>
+#include <signal.h>
+
+/// the one place child state changes come from. SIGCHLD stays blocked
+/// for the life of the shell and is read from a signalfd, so no shell
+/// code ever runs in signal context
+class EventLoop
+{
+public:
+	EventLoop() = default;
+	EventLoop(const EventLoop&) = delete;
+
+	/// block SIGCHLD and remember the mask children should start with
+	void init();
+
+	/// in a forked child that goes on running shell code: the epoll set
+	/// and signalfd are shared with the parent, so build fresh ones
+	void afterFork();
+
+	/// another fd child statuses arrive on. drain is called on every
+	/// reap() and must not block
+	void watch(int fd, void (*drain)());
+
+	/// reap every child that changed state and hand it to the context.
+	/// never blocks
+	void reap();
+
+	/// sleep until a child changes state
+	void wait();
+
+	/// the watched fds only, for a caller that reaps its own children
+	/// with waitpid and must not let reap() take them
+	void drainSources();
+
+	/// the signal mask the shell had before init(), for exec'd children
+	const sigset_t* childMask() const { return &origMask_; }
+
+	/// put childMask() back in place, right before exec
+	void restoreChildMask() const;
+
+private:
+	void open();
+
+	struct Source
+	{
+		int fd;
+		void (*drain)();
+	};
+	std::vector<Source> sources_;
+	int epfd_ = -1;
+	int sigfd_ = -1;
+	sigset_t origMask_;
+};
+
+EventLoop& getEventLoop();
+
+#endif
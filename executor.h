@@ -17,6 +17,11 @@ public:
     void visit(Ordered*);
     void visit(Background*);
     void visit(Redirected*);
+
+    /// set in forked children: the process exits once the node it was
+    /// forked for is done, so the last command of a list may replace
+    /// it instead of getting a process of its own
+    bool tail = false;
 private:
 
 };
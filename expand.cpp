@@ -1,470 +1,731 @@
-#include <cctype>
-#include <vector>
-#include <memory>
+#include <algorithm>
+#include <charconv>
 #include <cassert>
-#include <string>
+#include <cerrno>
+#include <csignal>
 #include <cstdio>
+#include <cstring>
 #include <cstdlib>
+#include <memory>
+#include <string>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
-#include <exception>
 #include "calc_aslib.h"
+#include "charclass.h"
+#include "capture.h"
+#include "vars.h"
 #include "expand.h"
 #include "context.h"
 #include "parse.h"
+#include "redirect.h"
 
-class NotStringifyException : std::exception
-{
-	
-};
+// from shell.cpp
+extern Context& getContext();
+extern bool captureCmdOutput(std::unique_ptr<NodeBase>&, Capture&);
+extern pid_t startCmdOutput(std::unique_ptr<NodeBase>&, int*);
+extern pid_t startCmdInput(std::unique_ptr<NodeBase>&, int*);
 
-enum class NodeType
+namespace
 {
-	Root, Plain, Space, WithinParen, SingleQuoted, DoubleQuoted,
-	ExprEval, CmdEval, VarEval, HomeExp,
-    PidEval, LastExitStatusEval
-};
 
-struct ExpandBase;
+/// what findClose() stops at
+constexpr ByteSet closeStop("\\'\"()");
+/// what SubstBatch::scan() stops at: the ends of words as well, for
+/// the braces a word may have
+constexpr ByteSet substStop(" \t();&|<>'\"\\$");
 
-using ChildList = std::vector<std::unique_ptr<ExpandBase>>;
-
-// from shell.cpp
-extern Context& getContext();
-
-struct ExpandBase
-{   
-	ExpandBase(NodeType t) : type(t) {}
-	virtual std::string toString() const = 0;
-	NodeType type;
-};
+}
 
-struct Root : public ExpandBase
+char const* findClose(char const* p)
 {
-	Root() : ExpandBase(NodeType::Root) {}
-	ChildList children;
-	std::string toString() const override {
-		std::string res;
-		for (auto& p : children) {
-			res.append(p->toString());
+	int depth = 1;
+	for (p = closeStop.find(p); *p; p = closeStop.find(p + 1)) {
+		switch (*p) {
+		case '\\':
+			if (p[1] != '\0')
+				++p;
+			break;
+		case '\'':
+			p = std::strchr(p + 1, '\'');
+			if (p == nullptr)
+				return nullptr;
+			break;
+		case '\"':
+			for (++p; *p != '\"'; ++p) {
+				if (*p == '\0')
+					return nullptr;
+				if (*p == '\\' && p[1] != '\0')
+					++p;
+			}
+			break;
+		case '(':
+			++depth;
+			break;
+		case ')':
+			if (--depth == 0)
+				return p;
+			break;
 		}
-		return res;
 	}
-};
+	return nullptr;
+}
 
-struct Plain : public ExpandBase
+namespace
 {
-	Plain(std::string s)
-		: ExpandBase(NodeType::Plain), text(std::move(s)) {}
-	std::string text;
-	std::string toString() const override {
-		return text;
-	}
-};
 
-struct Space : public ExpandBase
+bool isNameStart(char ch)
 {
-	Space(std::string s)
-		:  ExpandBase(NodeType::Space), spaces(std::move(s)) {}
-	std::string spaces;
-	std::string toString() const override {
-		return spaces;
-	}
-};
+	return chars::is(ch, chars::NameStart);
+}
 
-struct WithinParen : public ExpandBase
+bool isNameChar(char ch)
 {
-	WithinParen() : ExpandBase(NodeType::WithinParen) {}
-	ChildList children;
-	std::string toString() const override {
-		std::string res("(");
-		for (auto& p : children) {
-			res.append(p->toString());
-		}
-		res.append(")");
-		return res;
-	}
-};
+	return chars::isNameChar(ch);
+}
 
-struct SingleQuoted : public ExpandBase
+void appendVar(std::string_view name, std::string& out)
 {
-	SingleQuoted(std::string s)
-		: ExpandBase(NodeType::SingleQuoted), quoted(std::move(s)) {}
-	std::string quoted;
-	std::string toString() const override {
-		return std::string("'") + quoted + "'";
+	if (auto v = getVarStore().get(name)) {
+		out.append(*v);
 	}
-};
+}
 
-struct DoubleQuoted : public ExpandBase
+/// formatted on the stack, not through a temporary std::string
+void appendNumber(long n, std::string& out)
 {
-	DoubleQuoted()
-		: ExpandBase(NodeType::DoubleQuoted) {}
-	ChildList children;
-	std::string toString() const override {
-		std::string res = "\"";
-		for (auto& p : children) {
-			res.append(p->toString());
-		}
-		return res + "\"";
-	};
-};
+	char buf[24];
+	auto res = std::to_chars(buf, buf + sizeof(buf), n);
+	out.append(buf, res.ptr - buf);
+}
 
-struct ExprEval : public ExpandBase
+/// $((expr)): what is inside is expanded first, then calculated. the
+/// expanded text is built at the end of out and replaced by the result
+ExpandError expandArith(char const* beg, char const* end, std::string& out)
 {
-	ExprEval()
-		: ExpandBase(NodeType::ExprEval) {}
-	ChildList children;
-	std::string toString() const override {
-		std::string expr;
-		for (auto& p : children) {
-			expr.append(p->toString());			
-		}
-		CalcResult res = calc(expr);
-		if (res.error) {
-			throw NotStringifyException{};
+	std::size_t mark = out.size();
+	for (char const* p = beg; p < end; ) {
+		if (*p == '$') {
+			if (expandDollar(p, out) != ExpandError::Ok)
+				return ExpandError::Error;
 		} else {
-			if (res.type == CalcResult::Int) {
-				return std::to_string(res.intResult());
-			} else {
-				return std::to_string(res.doubleResult());
-			}
+			out.push_back(*p++);
 		}
 	}
-};
 
+	CalcResult res = calc(std::string_view(out).substr(mark));
+	out.resize(mark);
+	if (res.error) {
+		return ExpandError::Error;
+	}
+	if (res.type == CalcResult::Int) {
+		appendNumber(res.intResult(), out);
+	} else {
+		char buf[64];
+		int n = std::snprintf(buf, sizeof(buf), "%f", res.doubleResult());
+		out.append(buf, std::min<std::size_t>(n, sizeof(buf) - 1));
+	}
+	return ExpandError::Ok;
+}
+
+SubstBatch* activeBatch = nullptr;
 
-extern std::string strCmdOutput(std::unique_ptr<NodeBase>&);
-struct CmdEval : public ExpandBase
+int substJobs()
 {
-	CmdEval()
-		: ExpandBase(NodeType::CmdEval) {}
-	ChildList children;
-	std::string toString() const override {
-		std::string cmd;
-		for (auto& i : children) {
-			cmd.append(i->toString());
-		}
+	const char* s = std::getenv("SLTSH_SUBST_JOBS");
+	int n = s ? std::atoi(s) : 0;
+	return n > 0 ? n : 8;
+}
 
-		auto parseRes = parseCmdLine(cmd.c_str());
-		if (parseRes.second != ParseErr::Ok) {
-			throw NotStringifyException{};
-		}
+/// $(cmd): run it and take its output, less the trailing newlines
+ExpandError expandCmd(char const* beg, char const* end, std::string& out)
+{
+	ExpandError err;
+	if (activeBatch && activeBatch->take(beg, out, err)) {
+		return err;
+	}
 
-		auto str = strCmdOutput(parseRes.first);
-		if (str.back() == '\n')
-			str.pop_back();
-		return str;
+	std::string cmd(beg, end);
+	auto parseRes = parseCmdLine(cmd.c_str());
+	if (parseRes.second == ParseErr::EmptyCmd) {
+		return ExpandError::Ok;
+	} else if (parseRes.second != ParseErr::Ok) {
+		return ExpandError::Error;
 	}
-};
 
-struct VarEval : public ExpandBase
-{
-	VarEval(std::string s)
-		: ExpandBase(NodeType::VarEval),varName(std::move(s)) {}
-	std::string varName;
-	std::string toString() const override {
-		assert(false && "not implemented");
+	Capture cap;
+	if (!captureCmdOutput(parseRes.first, cap)) {
+		return ExpandError::Error;
 	}
-};
+	out.append(cap.text());
+	return ExpandError::Ok;
+}
 
-struct PidEval : public ExpandBase
-{
-    PidEval() : ExpandBase(NodeType::PidEval) {}
-    std::string toString() const override {
-        long pid = (long) getpid();
-        return std::to_string(pid);
-    }
-};
+} // end anonymous namespace
 
-struct LastExitStatusEval : public ExpandBase
+ExpandError expandDollar(char const*& p, std::string& out)
 {
-    LastExitStatusEval() : ExpandBase(NodeType::LastExitStatusEval) {}
-    std::string toString() const override {
-        return std::to_string(getContext().lastExitStatus);
-    }
-};
+	assert(*p == '$');
+	if (p[1] == '(') {
+		if (p[2] == '(') {
+			// $(( ... )) is arithmetic only when the inner paren closes
+			// right before the outer one; else it is $( (subshell) ... )
+			char const* inner = findClose(p + 3);
+			if (inner != nullptr && inner[1] == ')') {
+				char const* beg = p + 3;
+				p = inner + 2;
+				return expandArith(beg, inner, out);
+			}
+		}
+		char const* close = findClose(p + 2);
+		if (close == nullptr) {
+			return ExpandError::Error;
+		}
+		char const* beg = p + 2;
+		p = close + 1;
+		return expandCmd(beg, close, out);
+	}
 
-struct HomeExp : public ExpandBase
-{
-	HomeExp() : ExpandBase(NodeType::HomeExp) {}
-	std::string toString() const override {
-		char* home = getenv("HOME");
-		if (home == NULL) {
-			std::fprintf(stderr, "getenv error");
-			std::exit(1);
+	++p;
+	if (*p == '?') {
+		++p;
+		appendNumber(getContext().lastExitStatus, out);
+	} else if (*p == '$') {
+		++p;
+		appendNumber(getpid(), out);
+	} else if (isNameStart(*p)) {
+		char const* beg = p;
+		while (isNameChar(*p)) {
+			++p;
 		}
-		return home;
+		appendVar(std::string_view(beg, p - beg), out);
+	} else if (*p == '{') {
+		char const* close = std::strchr(p, '}');
+		if (close == nullptr) {
+			return ExpandError::Error;
+		}
+		std::string_view name(p + 1, close - p - 1);
+		p = close + 1;
+		if (name.empty() || !isNameStart(name[0])) {
+			return ExpandError::Error;
+		}
+		appendVar(name, out);
+	} else {
+		out.push_back('$');
 	}
-};
+	return ExpandError::Ok;
+}
 
-namespace
+ExpandError expandProcSubst(char const*& p, std::string& out, std::vector<int>& fds)
 {
-using ParseRet = std::pair<std::unique_ptr<ExpandBase>, ExpandError>;
+	assert((*p == '<' || *p == '>') && p[1] == '(');
+	bool toCmd = *p == '>';
+	char const* end = findClose(p + 2);
+	if (end == nullptr) {
+		return ExpandError::Error;
+	}
+	std::string cmd(p + 2, end);
+	p = end + 1;
+	auto parseRes = parseCmdLine(cmd.c_str());
+	if (parseRes.second != ParseErr::Ok) {
+		return ExpandError::Error;
+	}
 
-ParseRet parseRoot(const std::string& str);
+	// nobody waits for it: the event loop reaps it like any stray child
+	int fd;
+	if (toCmd) {
+		startCmdInput(parseRes.first, &fd);
+	} else {
+		startCmdOutput(parseRes.first, &fd);
+	}
+	// out of reach of the command's redirections, and closed on exec
+	// in every child but the one it is meant for
+	int high = fcntl(fd, F_DUPFD_CLOEXEC, SHELL_FD_BASE);
+	close(fd);
+	if (high < 0) {
+		return ExpandError::Error;
+	}
+	fds.push_back(high);
+	out.append("/dev/fd/");
+	appendNumber(high, out);
+	return ExpandError::Ok;
+}
 
-ParseRet parseItem(const std::string& str, std::size_t* idx);
+const char* homeDir()
+{
+	auto home = getVarStore().get("HOME");
+	return home ? home->c_str() : "~";
+}
 
-std::pair<std::unique_ptr<WithinParen>, ExpandError>
-parseWithinParen(const std::string& str, std::size_t* idx);
+struct SubstBatch::Hole
+{
+	char const* beg;
+	char const* end;
+	std::unique_ptr<NodeBase> node;
+	ParseErr err;
+	/// run in the shell when the lexer gets to it
+	bool inProcess = false;
+	pid_t pid = -1;
+	int fd = -1;
+	bool done = false;
+	bool failed = false;
+	Capture out;
+};
 
-// ret: ExprEval CmdEval VarEval
-//      and maybe Plain
-ParseRet parseEval(const std::string& str, std::size_t* idx);
+SubstBatch::SubstBatch(char const* line)
+	: limit_(substJobs()), prev_(activeBatch)
+{
+	if (std::strstr(line, "$(") != nullptr) {
+		scan(line);
+	}
+	// parsing the inner lines runs their own batches first
+	for (auto& hole : holes_) {
+		std::string cmd(hole->beg, hole->end);
+		auto res = parseCmdLine(cmd.c_str());
+		hole->node = std::move(res.first);
+		hole->err = res.second;
+		hole->inProcess = hole->err == ParseErr::Ok && hole->node->stateFree();
+	}
+	activeBatch = this;
+	startMore();
+}
 
-ParseRet parseSingleQuoted(const std::string& str, std::size_t* idx);
+SubstBatch::~SubstBatch()
+{
+	// left over when the line failed to parse half way
+	for (auto& hole : holes_) {
+		if (hole && hole->fd >= 0) {
+			kill(hole->pid, SIGTERM);
+			finish(*hole, true);
+		}
+	}
+	activeBatch = prev_;
+}
 
-ParseRet parseDoubleQuoted(const std::string& str, std::size_t* idx);
+/// find the $(...) the lexer will meet, with the same quoting rules
+void SubstBatch::scan(char const* p)
+{
+	bool dquoted = false;
+	// the word scanned and where its holes start
+	char const* word = p;
+	std::size_t first = holes_.size();
+	for (p = substStop.find(p); *p; p = substStop.find(p + 1)) {
+		if (!dquoted && chars::is(*p, chars::WordEnd)) {
+			dropBraced(word, p, first);
+			word = p + 1;
+			first = holes_.size();
+		}
+		switch (*p) {
+		case '\\':
+			if (p[1] != '\0')
+				++p;
+			break;
+		case '\'':
+			if (!dquoted && (p = std::strchr(p + 1, '\'')) == nullptr) {
+				dropBraced(word, word + std::strlen(word), first);
+				return;
+			}
+			break;
+		case '\"':
+			dquoted = !dquoted;
+			break;
+		case '<':
+		case '>':
+			// <(...) is parsed and started on its own
+			if (!dquoted && p[1] == '(') {
+				if ((p = findClose(p + 2)) == nullptr)
+					return;
+				word = p + 1;
+			}
+			break;
+		case '$': {
+			if (p[1] != '(')
+				break;
+			if (p[2] == '(') {
+				// arithmetic: what is inside is left to the lexer
+				char const* inner = findClose(p + 3);
+				if (inner != nullptr && inner[1] == ')') {
+					p = inner + 1;
+					break;
+				}
+			}
+			char const* close = findClose(p + 2);
+			if (close == nullptr) {
+				dropBraced(word, word + std::strlen(word), first);
+				return;
+			}
+			auto hole = std::make_unique<Hole>();
+			hole->beg = p + 2;
+			hole->end = close;
+			holes_.push_back(std::move(hole));
+			p = close;
+			break;
+		}
+		}
+	}
+	dropBraced(word, p, first);
+}
 
-ParseRet parseSpace(const std::string& str, std::size_t* idx);
+/// the holes from first on are in the word [beg, end). if its braces
+/// expand, lexWord() lexes every variant from a copy of the word, so
+/// each variant runs them when it gets to them and none is started here
+void SubstBatch::dropBraced(char const* beg, char const* end, std::size_t first)
+{
+	if (first == holes_.size() || std::memchr(beg, '{', end - beg) == nullptr)
+		return;
+	BraceExpansion braces;
+	if (braces.parse(std::string_view(beg, end - beg))) {
+		holes_.resize(first);
+	}
+}
 
+/// start the next substitutions in line order, up to the limit
+void SubstBatch::startMore()
+{
+	for (; next_ < holes_.size() && running_ < limit_; ++next_) {
+		Hole& hole = *holes_[next_];
+		if (hole.err != ParseErr::Ok || hole.inProcess)
+			continue;
+		hole.pid = startCmdOutput(hole.node, &hole.fd);
+		fcntl(hole.fd, F_SETFL, O_NONBLOCK);
+		Capture::widen(hole.fd);
+		++running_;
+	}
+}
 
-bool notDelimiter(char ch)
+void SubstBatch::finish(Hole& hole, bool failed)
 {
-	return ch != '$' && !std::isspace(ch)
-		   && ch != '\'' && ch != '\"' && ch != ')';
+	close(hole.fd);
+	hole.fd = -1;
+	waitpid(hole.pid, nullptr, 0);
+	hole.done = true;
+	hole.failed = failed;
+	--running_;
 }
-	
-}; // end anonymous namespace
 
-std::pair<std::string, ExpandError>
-expand(const std::string& str)
+/// read every running substitution until the one wanted is complete
+void SubstBatch::waitFor(Hole& wanted)
 {
-	auto result = parseRoot(str);
-	if (result.second != ExpandError::Ok) {
-		// deal with error
-		return {"", ExpandError::Error};
-	} else {
-		try {
-			std::string expanded = result.first->toString();
-			return {std::move(expanded), ExpandError::Ok};
-		} catch (const NotStringifyException&) {
-			return {"", ExpandError::Error};
+	std::vector<pollfd> fds;
+	std::vector<Hole*> polled;
+	while (!wanted.done) {
+		startMore();
+		fds.clear();
+		polled.clear();
+		for (std::size_t i = 0; i < next_; ++i) {
+			Hole* hole = holes_[i].get();
+			if (hole && hole->fd >= 0) {
+				fds.push_back({hole->fd, POLLIN, 0});
+				polled.push_back(hole);
+			}
+		}
+		if (poll(fds.data(), fds.size(), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			std::perror("poll error while expanding");
+			std::exit(1);
+		}
+		for (std::size_t i = 0; i < fds.size(); ++i) {
+			if (fds[i].revents == 0)
+				continue;
+			Hole& hole = *polled[i];
+			long n;
+			while ((n = hole.out.feed(hole.fd)) > 0)
+				;
+			if (n == 0) {
+				finish(hole, false);
+			} else if (errno != EAGAIN && errno != EINTR) {
+				std::perror("sltsh: capture error");
+				finish(hole, true);
+			}
 		}
 	}
 }
 
-
-namespace
+bool SubstBatch::take(char const* beg, std::string& out, ExpandError& err)
 {
-ParseRet parseRoot(const std::string& str)
-{
-	auto root = std::make_unique<Root>();
-	std::size_t idx = 0;
-
-	while (idx < str.size()) {
-		auto res = parseItem(str, &idx);
-		if (res.second != ExpandError::Ok) {
-			return res;
+	for (auto& hole : holes_) {
+		if (!hole || hole->beg != beg)
+			continue;
+		err = ExpandError::Ok;
+		if (hole->err == ParseErr::EmptyCmd) {
+			// nothing to run
+		} else if (hole->err != ParseErr::Ok) {
+			err = ExpandError::Error;
+		} else if (hole->inProcess) {
+			if (captureCmdOutput(hole->node, hole->out)) {
+				out.append(hole->out.text());
+			} else {
+				err = ExpandError::Error;
+			}
 		} else {
-			root->children.push_back(std::move(res.first));
+			waitFor(*hole);
+			if (hole->failed) {
+				err = ExpandError::Error;
+			} else {
+				out.append(hole->out.text());
+			}
 		}
+		// done with: let its output go now rather than with the line
+		hole.reset();
+		return true;
 	}
+	return false;
+}
 
-	return {std::move(root), ExpandError::Ok};
-} // end parseRoot
+namespace
+{
 
-ParseRet parseItem(const std::string& str, std::size_t* idx)
+/// how much of raw at i goes as one unit into a brace's text: a quoted
+/// span, an escaped character, a ${...} or $(...), or one character
+std::size_t unitLen(std::string_view raw, std::size_t i)
 {
-	switch (str[*idx]) {
-	case '(':
-		return parseWithinParen(str, idx);
-	case '$':
-		return parseEval(str, idx);
+	std::size_t rest = raw.size() - i;
+	std::size_t n = 1;
+	switch (raw[i]) {
+	case '\\':
+		n = 2;
+		break;
+	case '\'': {
+		auto close = raw.find('\'', i + 1);
+		n = close == std::string_view::npos ? rest : close + 1 - i;
+		break;
+	}
 	case '\"':
-		return parseDoubleQuoted(str, idx);
-	case '\'':
-		return parseSingleQuoted(str, idx);
-	case '~': {
-		char next = str[*idx + 1];
-		if ((!!std::isspace(next)) | (next == '/')
-			| (next == '\'') | (next == '\"') | (next == ')')
-			| (next == '\0')) {
-			++*idx;
-			return {std::make_unique<HomeExp>(), ExpandError::Ok};
-		} else {
-			// plain text
-			std::string text;
-			do {
-				// if (str[*idx] == '\\') {
-				// 	++*idx;
-				// }
-				text.push_back(str[*idx]);
-				++*idx;
-			} while (*idx < str.size()
-					 && notDelimiter(str[*idx]));
-			return {std::make_unique<Plain>(std::move(text)), ExpandError::Ok};
+		for (n = 1; n < rest && raw[i + n] != '\"'; ++n) {
+			if (raw[i + n] == '\\') {
+				++n;
+			} else if (raw[i + n] == '$' && n + 1 < rest && raw[i + n + 1] == '(') {
+				// its quotes are its own
+				char const* close = findClose(raw.data() + i + n + 2);
+				n = close == nullptr ? rest : close - (raw.data() + i);
+			}
 		}
-	}
-
-	default:
-		if (std::isspace(str[*idx])) {
-			return parseSpace(str, idx);
-		} else {
-			// plain text
-			std::string text;
-			do {
-				// if (str[*idx] == '\\')
-				// 	++*idx;
-				text.push_back(str[*idx]);
-				++*idx;
-			} while (*idx < str.size() && notDelimiter(str[*idx]));
-			return {std::make_unique<Plain>(std::move(text)), ExpandError::Ok};
+		++n;
+		break;
+	case '$':
+		if (rest > 1 && raw[i + 1] == '{') {
+			auto close = raw.find('}', i + 2);
+			n = close == std::string_view::npos ? rest : close + 1 - i;
+		} else if (rest > 1 && raw[i + 1] == '(') {
+			// raw lies in a nul-terminated line
+			char const* close = findClose(raw.data() + i + 2);
+			n = close == nullptr ? rest : close + 1 - (raw.data() + i);
 		}
+		break;
+	}
+	return std::min(n, rest);
+}
 
+/// an integer of a range: optional '-', then digits
+bool rangeInt(std::string_view s, long* v)
+{
+	std::size_t i = !s.empty() && s[0] == '-';
+	if (i == s.size() || s.size() > 18)
+		return false;
+	for (std::size_t j = i; j < s.size(); ++j) {
+		if (!chars::is(s[j], chars::Digit))
+			return false;
 	}
+	*v = std::strtol(std::string(s).c_str(), nullptr, 10);
+	return true;
 }
 
-std::pair<std::unique_ptr<WithinParen>, ExpandError>
-parseWithinParen(const std::string& str, std::size_t* idx)
+bool zeroPadded(std::string_view s)
 {
-	assert(str[*idx] == '(');
-	auto result = std::make_unique<WithinParen>();
-	++*idx;
-	while (*idx < str.size() && str[*idx] != ')') {
-		auto res = parseItem(str, idx);
-		if (res.second != ExpandError::Ok) {
-			return {nullptr, res.second};
+	if (!s.empty() && s[0] == '-')
+		s.remove_prefix(1);
+	return s.size() > 1 && s[0] == '0';
+}
+
+}
+
+void BraceExpansion::parseSeq(std::string_view raw, std::size_t& i, bool nested, Seq& seq)
+{
+	std::string text;
+	auto flush = [&] {
+		if (!text.empty()) {
+			Node node;
+			node.kind = Node::Text;
+			node.text = std::move(text);
+			seq.push_back(std::move(node));
+			text.clear();
+		}
+	};
+	while (i < raw.size()) {
+		char c = raw[i];
+		if (nested && (c == ',' || c == '}'))
+			break;
+		if (c == '{') {
+			Node node;
+			std::size_t j = i;
+			if (parseBrace(raw, j, node)) {
+				flush();
+				seq.push_back(std::move(node));
+				i = j;
+			} else {
+				text.push_back(c);
+				++i;
+			}
+			continue;
 		}
+		std::size_t n = unitLen(raw, i);
+		text.append(raw.substr(i, n));
+		i += n;
+	}
+	flush();
+}
 
-		result->children.push_back(std::move(res.first));
+bool BraceExpansion::parseBrace(std::string_view raw, std::size_t& i, Node& node)
+{
+	auto close = raw.find('}', i);
+	if (close != std::string_view::npos
+		&& parseRange(raw.substr(i + 1, close - i - 1), node)) {
+		i = close + 1;
+		return true;
 	}
 
-	if (str[*idx] != ')') {
-		return {nullptr, ExpandError::Error};
-	} else {
-		++*idx;
-		return {std::move(result), ExpandError::Ok};
+	node.kind = Node::List;
+	std::size_t j = i + 1;
+	for (;;) {
+		Seq alt;
+		parseSeq(raw, j, true, alt);
+		if (j == raw.size())
+			return false;
+		node.alts.push_back(std::move(alt));
+		if (raw[j++] == '}')
+			break;
 	}
+	// {a} is just text
+	if (node.alts.size() < 2)
+		return false;
+	i = j;
+	return true;
 }
 
-
-ParseRet parseSingleQuoted(const std::string& str, std::size_t* idx)
+bool BraceExpansion::parseRange(std::string_view body, Node& node)
 {
-	assert(str[*idx] == '\'');
-	++*idx;
-	std::string quoted;
-	while (*idx < str.size() && str[*idx] != '\'') {
-		quoted.push_back(str[*idx]);
-		++*idx;
+	auto dots = body.find("..");
+	if (dots == std::string_view::npos)
+		return false;
+	std::string_view a = body.substr(0, dots);
+	std::string_view b = body.substr(dots + 2);
+	std::string_view s;
+	auto dots2 = b.find("..");
+	if (dots2 != std::string_view::npos) {
+		s = b.substr(dots2 + 2);
+		b = b.substr(0, dots2);
 	}
 
-	if (str[*idx] == '\'') {
-		// ok
-		++*idx;
-		return {std::make_unique<SingleQuoted>(std::move(quoted)),
-				ExpandError::Ok};
-	} else {
-		return {nullptr, ExpandError::Error};
+	long step = 1;
+	if (!s.empty() && !rangeInt(s, &step))
+		return false;
+	node.step = step == 0 ? 1 : std::abs(step);
+	node.kind = Node::Range;
+	if (rangeInt(a, &node.from) && rangeInt(b, &node.to)) {
+		if (zeroPadded(a) || zeroPadded(b))
+			node.width = std::max(a.size(), b.size());
+		return true;
+	}
+	if (a.size() == 1 && b.size() == 1 && chars::isLetter(a[0])
+		&& chars::isLetter(b[0])) {
+		node.chars = true;
+		node.from = a[0];
+		node.to = b[0];
+		return true;
 	}
+	return false;
 }
 
-ParseRet parseDoubleQuoted(const std::string& str, std::size_t* idx)
+void BraceExpansion::reset(Seq& seq)
 {
-	assert(str[*idx] == '\"');
-	++*idx;
-	auto root = std::make_unique<DoubleQuoted>();
-	while (*idx < str.size() && str[*idx] != '\"') {
-		switch (str[*idx]) {
-		case '$': {
-			auto res = parseEval(str, idx);
-			if (res.second != ExpandError::Ok) {
-				return res;
-			} else {
-				root->children.push_back(std::move(res.first));
+	for (auto& node : seq) {
+		if (node.kind == Node::List) {
+			node.cur = 0;
+			reset(node.alts[0]);
+		} else if (node.kind == Node::Range) {
+			node.val = node.from;
+		}
+	}
+}
+
+/// step to the next variant, the rightmost brace moving fastest.
+/// false, with everything back at the start, after the last one
+bool BraceExpansion::advance(Seq& seq)
+{
+	for (auto node = seq.rbegin(); node != seq.rend(); ++node) {
+		if (node->kind == Node::List) {
+			if (advance(node->alts[node->cur]))
+				return true;
+			if (node->cur + 1 < node->alts.size()) {
+				reset(node->alts[++node->cur]);
+				return true;
 			}
-			break;
+			node->cur = 0;
+			reset(node->alts[0]);
+		} else if (node->kind == Node::Range) {
+			bool up = node->from <= node->to;
+			long left = up ? node->to - node->val : node->val - node->to;
+			if (left >= node->step) {
+				node->val += up ? node->step : -node->step;
+				return true;
+			}
+			node->val = node->from;
 		}
-		default: {
-			std::string text;
-			while (*idx < str.size() && str[*idx] != '$' && str[*idx] != '\"') {
-				text.push_back(str[*idx]);
-				++*idx;
+	}
+	return false;
+}
+
+void BraceExpansion::render(const Seq& seq, std::string& out)
+{
+	for (auto& node : seq) {
+		switch (node.kind) {
+		case Node::Text:
+			out.append(node.text);
+			break;
+		case Node::List:
+			render(node.alts[node.cur], out);
+			break;
+		case Node::Range: {
+			if (node.chars) {
+				// a..Z runs over [ \ ] and the like: the variant is lexed
+				// again, so they go in quoted
+				char c = static_cast<char>(node.val);
+				if (chars::is(c, chars::Special | chars::WordEnd) || c == ']' || c == '`')
+					out.push_back('\\');
+				out.push_back(c);
+				break;
 			}
-			root->children.push_back(
-					std::make_unique<Plain>(std::move(text)));
+			char buf[32];
+			int n = std::snprintf(buf, sizeof(buf), "%0*ld", node.width, node.val);
+			out.append(buf, n);
 			break;
 		}
-
 		}
 	}
-	if (*idx < str.size() && str[*idx] == '\"') {
-		++*idx;
-		return {std::move(root), ExpandError::Ok};
-	} else
-		return {nullptr, ExpandError::Error};
 }
 
-
-ParseRet parseSpace(const std::string& str, std::size_t* idx)
+bool BraceExpansion::parse(std::string_view raw)
 {
-	assert(std::isspace(str[*idx]));
-	std::string spaces;
-	do {
-		spaces.push_back(str[*idx]);
-		++*idx;
-	} while (*idx < str.size() && std::isspace(str[*idx]));
-	return {std::make_unique<Space>(std::move(spaces)),
-			ExpandError::Ok};
+	root_.clear();
+	started_ = false;
+	std::size_t i = 0;
+	parseSeq(raw, i, false, root_);
+	return std::any_of(root_.begin(), root_.end(),
+					   [](const Node& n) { return n.kind != Node::Text; });
 }
 
-ParseRet parseEval(const std::string& str, std::size_t* idx)
+bool BraceExpansion::next(std::string& out)
 {
-	assert(str[*idx] == '$');
-	if (str[*idx + 1] == '(') {
-		++*idx;
-		auto res = parseWithinParen(str, idx);
-		if (res.second != ExpandError::Ok) {
-			return {nullptr, res.second};
-		}
-
-		if (res.first->children.size() == 1
-			&& res.first->children[0]->type == NodeType::WithinParen) {
-			// $(())
-			auto inner = static_cast<WithinParen*>(res.first->children[0].get());
-			auto expr = std::make_unique<ExprEval>();
-			expr->children = std::move(inner->children);
-			return {std::move(expr), ExpandError::Ok};
-		} else {
-			auto cmd = std::make_unique<CmdEval>();
-			cmd->children = std::move(res.first->children);
-			return {std::move(cmd), ExpandError::Ok};
-		}
-
-	} else {
-		// variable eval or plain text
-		++*idx;
-		if (std::isalpha(str[*idx])) {
-			std::string name;
-			do {
-				name.push_back(str[*idx]);
-				++*idx;
-			} while (std::isalnum(str[*idx]));
-
-			return {std::make_unique<VarEval>(std::move(name)),
-					ExpandError::Ok};
-		} else {
-
-			if (str[*idx] == '$') {
-                ++*idx;
-                return {std::make_unique<PidEval>(), ExpandError::Ok};
-			} else if (str[*idx] == '?') {
-				++*idx;
-				return {std::make_unique<LastExitStatusEval>(), ExpandError::Ok};
-			} /* something else */ else {
-				std::string text("$");
-				while (*idx < str.size() && notDelimiter(str[*idx])) {
-					text.push_back(str[*idx]);
-					++*idx;
-				}
-
-				return {std::make_unique<Plain>(std::move(text)),
-						ExpandError::Ok};
-			}
-		}
+	if (!started_) {
+		reset(root_);
+		started_ = true;
+	} else if (!advance(root_)) {
+		return false;
 	}
-} // end parseEval
-
-
-};
+	out.clear();
+	render(root_, out);
+	return true;
+}
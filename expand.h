@@ -1,15 +1,102 @@
 #ifndef EXPAND_H__
 #define EXPAND_H__
 
+#include <memory>
 #include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
 
 enum class ExpandError
 {
 	Ok, Error,
 };
 
-std::pair<std::string, ExpandError>
-expand(const std::string&);
+/// evaluate the $ construct at p and append its value to out:
+/// $(cmd), $((expr)), $?, $$, $NAME, ${NAME}. a $ that starts none of
+/// them is a plain '$'. p is left right after the construct.
+/// called by the lexer in parse.cpp as it meets them
+ExpandError expandDollar(char const*& p, std::string& out);
+
+/// <(cmd) or >(cmd) at p: start cmd on a pipe and append /dev/fd/N,
+/// the shell's end of it, to out. N goes into fds: the command given
+/// the word has to inherit it. cmd runs alongside that command, reading
+/// what it writes for >(...), writing what it reads for <(...)
+ExpandError expandProcSubst(char const*& p, std::string& out, std::vector<int>& fds);
+
+/// the ')' closing the '(' just before p, skipping quoted text and
+/// nested parens, or nullptr when the line ends first
+char const* findClose(char const* p);
+
+/// {a,b,c} and {x..y[..step]} in one word, produced a variant at a time
+/// as the lexer asks for them: {1..1000000} is never held as a list,
+/// it is a counter. lists nest, and several braces in a word multiply
+class BraceExpansion
+{
+public:
+	/// the raw text of one word, quotes and all. false when none of
+	/// its braces expands
+	bool parse(std::string_view raw);
+	/// the next variant, still raw. false after the last one
+	bool next(std::string& out);
+
+private:
+	struct Node
+	{
+		enum Kind { Text, List, Range } kind;
+		std::string text;
+		std::vector<std::vector<Node>> alts;
+		std::size_t cur = 0;
+		long from = 0, to = 0, step = 1, val = 0;
+		int width = 0;
+		bool chars = false;
+	};
+	using Seq = std::vector<Node>;
+
+	static void parseSeq(std::string_view raw, std::size_t& i, bool nested, Seq& seq);
+	static bool parseBrace(std::string_view raw, std::size_t& i, Node& node);
+	static bool parseRange(std::string_view body, Node& node);
+	static void reset(Seq& seq);
+	static bool advance(Seq& seq);
+	static void render(const Seq& seq, std::string& out);
+
+	Seq root_;
+	bool started_ = false;
+};
+
+/// the $(...) of one line, run side by side. parseCmdLine makes one
+/// before lexing: every substitution that needs a child is started up
+/// front, at most SLTSH_SUBST_JOBS (8 by default) at a time, and the
+/// lexer takes the outputs in line order as it meets them, so errors
+/// come out in the same order as before. a word whose braces expand is
+/// left out: each of its variants runs its $(...) when it is lexed
+class SubstBatch
+{
+public:
+	explicit SubstBatch(char const* line);
+	SubstBatch(const SubstBatch&) = delete;
+	~SubstBatch();
+
+	/// append the output of the substitution whose text starts at beg.
+	/// false if it is not one of this batch's
+	bool take(char const* beg, std::string& out, ExpandError& err);
+
+private:
+	struct Hole;
+	void scan(char const* line);
+	void dropBraced(char const* beg, char const* end, std::size_t first);
+	void startMore();
+	void waitFor(Hole& hole);
+	void finish(Hole& hole, bool failed);
+
+	std::vector<std::unique_ptr<Hole>> holes_;
+	std::size_t next_ = 0;
+	int running_ = 0;
+	int limit_;
+	SubstBatch* prev_;
+};
+
+/// what ~ at the start of a word stands for
+const char* homeDir();
 
 #endif
@@ -0,0 +1,374 @@
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "glob.h"
+
+GlobPattern::GlobPattern(std::string_view pat)
+{
+	for (std::size_t i = 0; i < pat.size(); ++i) {
+		unsigned char c = pat[i];
+		switch (c) {
+		case '\\':
+			if (i + 1 < pat.size())
+				c = pat[++i];
+			break;
+		case '*':
+			literal_ = false;
+			if (items_.empty() || items_.back().op != Op::Star)
+				items_.push_back({Op::Star, 0, 0});
+			continue;
+		case '?':
+			literal_ = false;
+			items_.push_back({Op::Any, 0, 0});
+			continue;
+		case '[': {
+			std::size_t j = i + 1;
+			bool negate = j < pat.size() && (pat[j] == '!' || pat[j] == '^');
+			if (negate)
+				++j;
+			std::bitset<256> set;
+			bool first = true;
+			for (; j < pat.size() && (pat[j] != ']' || first); ++j, first = false) {
+				unsigned char lo = pat[j];
+				if (lo == '\\' && j + 1 < pat.size())
+					lo = pat[++j];
+				unsigned char hi = lo;
+				if (j + 2 < pat.size() && pat[j + 1] == '-' && pat[j + 2] != ']') {
+					j += 2;
+					hi = pat[j];
+					if (hi == '\\' && j + 1 < pat.size())
+						hi = pat[++j];
+				}
+				for (unsigned ch = lo; ch <= hi; ++ch)
+					set.set(ch);
+			}
+			if (j == pat.size())
+				break;		// no ']': the '[' is just a character
+			if (negate)
+				set.flip();
+			literal_ = false;
+			items_.push_back({Op::Class, 0, unsigned(classes_.size())});
+			classes_.push_back(set);
+			i = j;
+			continue;
+		}
+		}
+		items_.push_back({Op::Char, c, 0});
+		text_.push_back(c);
+	}
+}
+
+bool GlobPattern::match(std::string_view name) const
+{
+	if (!name.empty() && name[0] == '.'
+		&& (items_.empty() || items_[0].op != Op::Char || items_[0].ch != '.')) {
+		return false;
+	}
+
+	// on a mismatch, let the last * take one more character
+	std::size_t p = 0, n = 0;
+	std::size_t starP = SIZE_MAX, starN = 0;
+	while (n < name.size()) {
+		if (p < items_.size()) {
+			const Item& it = items_[p];
+			unsigned char c = name[n];
+			bool ok = false;
+			switch (it.op) {
+			case Op::Char:  ok = it.ch == c; break;
+			case Op::Any:   ok = true; break;
+			case Op::Class: ok = classes_[it.cls].test(c); break;
+			case Op::Star:
+				starP = p++;
+				starN = n;
+				continue;
+			}
+			if (ok) {
+				++p;
+				++n;
+				continue;
+			}
+		}
+		if (starP == SIZE_MAX)
+			return false;
+		p = starP + 1;
+		n = ++starN;
+	}
+	while (p < items_.size() && items_[p].op == Op::Star)
+		++p;
+	return p == items_.size();
+}
+
+namespace
+{
+
+constexpr std::size_t DENTS_BUF = 256 * 1024;
+
+std::string join(const std::string& dir, std::string_view name)
+{
+	std::string path;
+	path.reserve(dir.size() + name.size() + 1);
+	path = dir;
+	if (!path.empty() && path.back() != '/')
+		path.push_back('/');
+	path.append(name);
+	return path;
+}
+
+/// call fn(name, d_type) for each entry of dir but . and .., reading
+/// many entries per getdents64. DT_UNKNOWN is resolved with lstat
+template<typename F>
+bool readDir(const std::string& dir, F&& fn)
+{
+	int fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	thread_local std::vector<char> buf(DENTS_BUF);
+	long n;
+	while ((n = syscall(SYS_getdents64, fd, buf.data(), buf.size())) > 0) {
+		for (long off = 0; off < n; ) {
+			// struct linux_dirent64: ino, off, reclen, type, name
+			const char* ent = buf.data() + off;
+			unsigned short reclen;
+			std::memcpy(&reclen, ent + 16, sizeof(reclen));
+			unsigned char type = ent[18];
+			const char* name = ent + 19;
+			off += reclen;
+			if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+				continue;
+			if (type == DT_UNKNOWN) {
+				struct stat st;
+				if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+					type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK : DT_REG;
+			}
+			fn(std::string_view(name), type);
+		}
+	}
+	close(fd);
+	return n == 0;
+}
+
+/// may be a directory: worth listing as the next component's parent
+bool dirLike(unsigned char type)
+{
+	return type == DT_DIR || type == DT_LNK || type == DT_UNKNOWN;
+}
+
+struct Listing
+{
+	std::vector<std::pair<std::string, unsigned char>> entries;
+};
+
+/// the listings read for the current line
+std::unordered_map<std::string, Listing> dirCache;
+
+const Listing& listDir(const std::string& dir)
+{
+	auto iter = dirCache.find(dir);
+	if (iter != dirCache.end())
+		return iter->second;
+	Listing& l = dirCache[dir];
+	readDir(dir, [&](std::string_view name, unsigned char type) {
+		l.entries.emplace_back(std::string(name), type);
+	});
+	return l;
+}
+
+/// the trees under some directories, read by a pool of threads. each
+/// one takes a directory off a shared queue, lists it, and puts back
+/// the subdirectories it found. hidden directories are not entered
+class TreeWalk
+{
+public:
+	enum Mode { Match, Dirs, All };
+
+	/// Match: the entries matching last. Dirs: every directory, the
+	/// roots too. All: every entry below the roots
+	TreeWalk(Mode mode, const GlobPattern* last) : mode_(mode), last_(last) {}
+
+	void run(const std::vector<std::string>& roots, std::vector<std::string>& out)
+	{
+		for (auto& r : roots) {
+			queue_.push_back(r);
+			if (mode_ == Dirs)
+				out.push_back(r);
+		}
+		unsigned n = std::min(8u, std::max(1u, std::thread::hardware_concurrency()));
+		std::vector<std::vector<std::string>> found(n);
+		if (n == 1) {
+			work(found[0]);
+		} else {
+			std::vector<std::thread> pool;
+			for (unsigned i = 0; i < n; ++i)
+				pool.emplace_back([this, &found, i] { work(found[i]); });
+			for (auto& t : pool)
+				t.join();
+		}
+		for (auto& f : found)
+			out.insert(out.end(), std::make_move_iterator(f.begin()),
+					   std::make_move_iterator(f.end()));
+	}
+
+private:
+	void work(std::vector<std::string>& found)
+	{
+		std::vector<std::string> subdirs;
+		for (;;) {
+			std::string dir;
+			{
+				std::unique_lock<std::mutex> lock(mu_);
+				cv_.wait(lock, [this] { return !queue_.empty() || busy_ == 0; });
+				if (queue_.empty())
+					return;
+				dir = std::move(queue_.front());
+				queue_.pop_front();
+				++busy_;
+			}
+
+			readDir(dir, [&](std::string_view name, unsigned char type) {
+				bool hidden = name[0] == '.';
+				bool isDir = type == DT_DIR;
+				if (isDir && !hidden)
+					subdirs.push_back(join(dir, name));
+				if (mode_ == Match ? last_->match(name) : mode_ == All && !hidden)
+					found.push_back(join(dir, name));
+			});
+			if (mode_ == Dirs)
+				found.insert(found.end(), subdirs.begin(), subdirs.end());
+
+			std::lock_guard<std::mutex> lock(mu_);
+			for (auto& s : subdirs)
+				queue_.push_back(std::move(s));
+			subdirs.clear();
+			--busy_;
+			// wakes the others for new work, or for the end of it
+			cv_.notify_all();
+		}
+	}
+
+	Mode mode_;
+	const GlobPattern* last_;
+	std::mutex mu_;
+	std::condition_variable cv_;
+	std::deque<std::string> queue_;
+	unsigned busy_ = 0;
+};
+
+std::vector<std::string_view> components(std::string_view pattern)
+{
+	std::vector<std::string_view> comps;
+	std::size_t i = 0;
+	while (i < pattern.size()) {
+		std::size_t j = pattern.find('/', i);
+		if (j == std::string_view::npos)
+			j = pattern.size();
+		if (j > i)
+			comps.push_back(pattern.substr(i, j - i));
+		i = j + 1;
+	}
+	return comps;
+}
+
+bool exists(const std::string& path)
+{
+	struct stat st;
+	return lstat(path.c_str(), &st) == 0;
+}
+
+bool isDir(const std::string& path)
+{
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+} // end anonymous namespace
+
+bool globExpand(std::string_view pattern, std::vector<std::string>& out)
+{
+	auto comps = components(pattern);
+	bool dirsOnly = !pattern.empty() && pattern.back() == '/';
+	std::vector<std::string> cur{ pattern.size() > 0 && pattern[0] == '/' ? "/" : "" };
+	bool unchecked = false;		// literal components not looked up yet
+
+	for (std::size_t i = 0; i < comps.size() && !cur.empty(); ++i) {
+		bool last = i + 1 == comps.size();
+		std::vector<std::string> next;
+		if (comps[i] == "**") {
+			if (unchecked) {
+				cur.erase(std::remove_if(cur.begin(), cur.end(),
+					[](auto& p) { return !isDir(p.empty() ? "." : p); }), cur.end());
+				unchecked = false;
+			}
+			if (last) {
+				TreeWalk(TreeWalk::All, nullptr).run(cur, next);
+			} else if (i + 2 == comps.size() && comps[i + 1] != "**") {
+				// the common a/**/*.c: match while walking
+				GlobPattern gp(comps[i + 1]);
+				if (gp.literal()) {
+					TreeWalk(TreeWalk::Dirs, nullptr).run(cur, next);
+					for (auto& d : next)
+						d = join(d, gp.text());
+					unchecked = true;
+				} else {
+					TreeWalk(TreeWalk::Match, &gp).run(cur, next);
+				}
+				++i;
+			} else {
+				TreeWalk(TreeWalk::Dirs, nullptr).run(cur, next);
+			}
+			cur = std::move(next);
+			continue;
+		}
+
+		GlobPattern gp(comps[i]);
+		if (gp.literal()) {
+			for (auto& p : cur)
+				p = join(p, gp.text());
+			unchecked = true;
+			continue;
+		}
+		for (auto& p : cur) {
+			if (unchecked && !exists(p))
+				continue;
+			for (auto& e : listDir(p).entries) {
+				if ((last || dirLike(e.second)) && gp.match(e.first))
+					next.push_back(join(p, e.first));
+			}
+		}
+		unchecked = false;
+		cur = std::move(next);
+	}
+
+	if (unchecked) {
+		cur.erase(std::remove_if(cur.begin(), cur.end(),
+			[](auto& p) { return !exists(p); }), cur.end());
+	}
+	if (dirsOnly) {
+		cur.erase(std::remove_if(cur.begin(), cur.end(),
+			[](auto& p) { return !isDir(p); }), cur.end());
+		for (auto& p : cur)
+			p.push_back('/');
+	}
+	if (cur.empty() || (cur.size() == 1 && (cur[0].empty() || cur[0] == "/")))
+		return false;
+
+	std::sort(cur.begin(), cur.end());
+	cur.erase(std::unique(cur.begin(), cur.end()), cur.end());
+	out.insert(out.end(), std::make_move_iterator(cur.begin()),
+			   std::make_move_iterator(cur.end()));
+	return true;
+}
+
+void globForgetDirs()
+{
+	dirCache.clear();
+}
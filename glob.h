@@ -0,0 +1,47 @@
+#ifndef GLOB_H__
+#define GLOB_H__
+
+#include <bitset>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// one path component of a glob, compiled once: *, ?, [...] with ! or ^
+/// and ranges, and backslash to take the next character literally
+class GlobPattern
+{
+public:
+	explicit GlobPattern(std::string_view pat);
+
+	/// a name in a directory. a leading '.' is only matched by one
+	/// written in the pattern
+	bool match(std::string_view name) const;
+	/// no wildcard in it: the name is the pattern, unescaped
+	bool literal() const { return literal_; }
+	const std::string& text() const { return text_; }
+
+private:
+	enum class Op : unsigned char { Char, Any, Star, Class };
+	struct Item
+	{
+		Op op;
+		unsigned char ch;	// Char
+		unsigned cls;		// Class: index into classes_
+	};
+
+	std::vector<Item> items_;
+	std::vector<std::bitset<256>> classes_;
+	std::string text_;
+	bool literal_ = true;
+};
+
+/// expand a pattern into the matching paths, sorted. ** as a whole
+/// component matches any number of directories, which are searched by
+/// several threads. false when nothing matches
+bool globExpand(std::string_view pattern, std::vector<std::string>& out);
+
+/// forget the directory listings kept since the last call. the lexer
+/// reads each directory once per line however many globs name it
+void globForgetDirs();
+
+#endif
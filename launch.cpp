@@ -0,0 +1,159 @@
+#include <spawn.h>
+#include <cassert>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include "launch.h"
+#include "redirect.h"
+
+namespace
+{
+
+/// owns the posix_spawn objects and the fds opened for them
+class SpawnActions
+{
+public:
+	SpawnActions() {
+		posix_spawn_file_actions_init(&actions_);
+		posix_spawnattr_init(&attr_);
+	}
+	~SpawnActions() {
+		for (int fd : opened_) {
+			close(fd);
+		}
+		posix_spawn_file_actions_destroy(&actions_);
+		posix_spawnattr_destroy(&attr_);
+	}
+	SpawnActions(const SpawnActions&) = delete;
+
+	/// open the target in the parent, above the fds the user can name,
+	/// and let the child dup2 it into place
+	bool addOpen(const RdUnit& u, int to) {
+		int fd = openRdTarget(u);
+		if (fd < 0) {
+			return false;
+		}
+		int high = fcntl(fd, F_DUPFD_CLOEXEC, SHELL_FD_BASE);
+		close(fd);
+		if (high < 0) {
+			return false;
+		}
+		opened_.push_back(high);
+		return addDup(high, to);
+	}
+
+	bool addDup(int fd, int to) {
+		return posix_spawn_file_actions_adddup2(&actions_, fd, to) == 0;
+	}
+
+	posix_spawn_file_actions_t* actions() { return &actions_; }
+	posix_spawnattr_t* attr() { return &attr_; }
+
+private:
+	posix_spawn_file_actions_t actions_;
+	posix_spawnattr_t attr_;
+	std::vector<int> opened_;
+};
+
+bool addRedirections(SpawnActions& sa, const RdUnits& rdvec)
+{
+	for (auto& u : rdvec) {
+		switch (u.rdTag) {
+		case RdTag::In:
+		case RdTag::Here:
+			if (!sa.addOpen(u, 0))
+				return false;
+			break;
+		case RdTag::Out:
+		case RdTag::App:
+			if (!sa.addOpen(u, u.lhs.tag == RdObj::Empty ? 1 : u.lhs.fd))
+				return false;
+			break;
+		case RdTag::OutDup:
+			assert(u.lhs.tag == RdObj::FD && u.rhs.tag == RdObj::FD);
+			if (u.lhs.fd != u.rhs.fd && !sa.addDup(u.rhs.fd, u.lhs.fd))
+				return false;
+			break;
+		case RdTag::OutErr:
+			if (!sa.addOpen(u, 1) || !sa.addDup(1, 2))
+				return false;
+			break;
+		default:
+			assert(false);
+		}
+	}
+	return true;
+}
+
+} // end anonymous namespace
+
+std::vector<char*> scriptArgv(const char* path, char* const* argv)
+{
+	std::vector<char*> shArgv{ const_cast<char*>("sh"), const_cast<char*>(path) };
+	for (auto a = argv + 1; *a; ++a) {
+		shArgv.push_back(*a);
+	}
+	shArgv.push_back(nullptr);
+	return shArgv;
+}
+
+bool spawnable(const RdUnits& rdvec)
+{
+	for (auto& u : rdvec) {
+		if (u.lhs.tag == RdObj::FD && u.lhs.fd >= SHELL_FD_BASE)
+			return false;
+		if (u.rhs.tag == RdObj::FD && u.rhs.fd >= SHELL_FD_BASE)
+			return false;
+	}
+	return true;
+}
+
+int spawnProcess(const SpawnSpec& spec, pid_t* pid)
+{
+	SpawnActions sa;
+	if ((spec.in >= 0 && !sa.addDup(spec.in, 0))
+		|| (spec.out >= 0 && !sa.addDup(spec.out, 1))
+		|| (spec.err >= 0 && !sa.addDup(spec.err, 2))) {
+		return errno;
+	}
+	if (spec.keepFds) {
+		for (int fd : *spec.keepFds) {
+			// dup2 onto itself only clears FD_CLOEXEC
+			if (!sa.addDup(fd, fd)) {
+				return errno;
+			}
+		}
+	}
+	if (spec.rdUnits && !addRedirections(sa, *spec.rdUnits)) {
+		return -1;
+	}
+
+	short flags = 0;
+	sigset_t def;
+	if (spec.pgid >= 0) {
+		flags |= POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF;
+		posix_spawnattr_setpgroup(sa.attr(), spec.pgid);
+
+		// same set as restoreSignals(): the shell ignores these
+		sigemptyset(&def);
+		sigaddset(&def, SIGTSTP);
+		sigaddset(&def, SIGINT);
+		sigaddset(&def, SIGQUIT);
+		posix_spawnattr_setsigdefault(sa.attr(), &def);
+	}
+
+	if (spec.sigmask) {
+		flags |= POSIX_SPAWN_SETSIGMASK;
+		posix_spawnattr_setsigmask(sa.attr(), spec.sigmask);
+	}
+	posix_spawnattr_setflags(sa.attr(), flags);
+
+	char* const* envp = spec.envp ? spec.envp : environ;
+	int rc = posix_spawn(pid, spec.path, sa.actions(), sa.attr(), spec.argv, envp);
+	if (rc == ENOEXEC) {
+		// no #! line: the same actions and attributes, under sh
+		auto shArgv = scriptArgv(spec.path, spec.argv);
+		rc = posix_spawn(pid, SCRIPT_SHELL, sa.actions(), sa.attr(), shArgv.data(), envp);
+	}
+	return rc;
+}
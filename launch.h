@@ -0,0 +1,54 @@
+#ifndef LAUNCH_H__
+#define LAUNCH_H__
+
+#include <vector>
+#include <signal.h>
+#include <sys/types.h>
+#include "nodes.h"
+
+/// describes one external command to be started without fork()ing
+/// the shell.  posix_spawn() uses clone(CLONE_VM|CLONE_VFORK) under
+/// the hood, so the cost no longer grows with the size of the shell
+struct SpawnSpec
+{
+	/// file to execute, already resolved against PATH
+	const char* path = nullptr;
+	char* const* argv = nullptr;
+	const RdUnits* rdUnits = nullptr;
+	/// 0: the child leads a new process group, >0: join that group,
+	/// -1: no job control, stay in our group and keep our dispositions
+	pid_t pgid = 0;
+	/// signal mask the child starts with
+	const sigset_t* sigmask = nullptr;
+	/// pipe ends that become the child's stdin / stdout before the
+	/// redirections are applied, -1 to inherit
+	int in = -1;
+	int out = -1;
+	/// the same for stderr
+	int err = -1;
+	/// close-on-exec fds the child keeps under the same numbers
+	const std::vector<int>* keepFds = nullptr;
+	/// environment of the command, nullptr for the shell's own environ
+	char* const* envp = nullptr;
+	/// the same for every spawn with the same envp, so a helper can
+	/// keep a copy; 0 when envp is a one-off
+	unsigned long envGen = 0;
+};
+
+/// what runs an executable file that has no #! line, as execvp() does
+constexpr const char* SCRIPT_SHELL = "/bin/sh";
+
+/// argv for SCRIPT_SHELL to run the file at path with the arguments
+/// of argv after the first, null-terminated
+std::vector<char*> scriptArgv(const char* path, char* const* argv);
+
+/// whether every redirection of the command can be expressed as
+/// spawn file actions; if not the caller has to fork
+bool spawnable(const RdUnits& rdvec);
+
+/// start the command.  returns 0 and stores the child's pid, or
+/// returns an errno value.  a failing redirection has already been
+/// reported and yields -1.  a file without #! is run by SCRIPT_SHELL
+int spawnProcess(const SpawnSpec& spec, pid_t* pid);
+
+#endif
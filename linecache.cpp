@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "expand.h"
+#include "linecache.h"
+
+namespace
+{
+
+/// how many lines are kept: SLTSH_LINE_CACHE, 0 to parse every line
+std::size_t capacityFromEnv()
+{
+	const char* s = std::getenv("SLTSH_LINE_CACHE");
+	return s ? std::strtoul(s, nullptr, 10) : 256;
+}
+
+/// longer lines are parsed every time: a driver repeats short lines,
+/// and this keeps copy() from recursing deeper than a few thousand
+/// groups
+constexpr std::size_t LINE_MAX_KEPT = 4096;
+
+}
+
+LineCache& getLineCache()
+{
+	// never destroyed: the kept trees have nothing to give back at exit
+	static auto cache = new LineCache;
+	return *cache;
+}
+
+LineCache::LineCache()
+	: arena_(std::make_unique<Arena>()), capacity_(capacityFromEnv())
+{
+}
+
+LineCache::~LineCache()
+{
+	// the trees before the arena they are in
+	index_.clear();
+	lru_.clear();
+}
+
+ParseResult LineCache::parse(const std::string& line)
+{
+	if (capacity_ == 0 || line.size() > LINE_MAX_KEPT) {
+		return parseCmdLine(line.c_str());
+	}
+	auto iter = index_.find(line);
+	if (iter == index_.end()) {
+		++misses_;
+		LineShape shape;
+		auto res = parseCmdLine(line.c_str(), shape);
+		if (res.second == ParseErr::Ok && shape.reusable) {
+			keep(line, res.first.get(), shape);
+		} else {
+			++unkept_;
+		}
+		return res;
+	}
+
+	++hits_;
+	lru_.splice(lru_.begin(), lru_, iter->second);
+	Entry& e = lru_.front();
+	const char* text = e.line.c_str();
+	// what parseCmdLine() would start before lexing the first word
+	SubstBatch batch(text);
+	Copy c{text, &e.holes, nullptr};
+	auto root = copy(e.root.get(), c);
+	if (c.err != ParseErr::Ok) {
+		return {nullptr, c.err};
+	}
+	return {std::move(root), ParseErr::Ok};
+}
+
+/// node and what is under it, in preorder, into the current arena
+std::unique_ptr<NodeBase> LineCache::copy(NodeBase* node, Copy& c)
+{
+	uint32_t ordinal = c.next++;
+	if (c.order) {
+		c.order->push_back(node);
+	}
+	if (node->isExec()) {
+		return copyExec(static_cast<Exec*>(node), ordinal, c);
+	}
+	if (node->isPipe()) {
+		auto from = static_cast<Pipe*>(node);
+		auto to = std::make_unique<Pipe>();
+		to->bg = from->bg;
+		to->stages.reserve(from->stages.size());
+		for (auto& stage : from->stages) {
+			auto s = copy(stage.get(), c);
+			if (!s) {
+				return nullptr;
+			}
+			to->stages.push_back(std::move(s));
+		}
+		return to;
+	}
+	if (node->isGroup()) {
+		auto from = static_cast<Group*>(node);
+		auto cmd = copy(from->cmd.get(), c);
+		if (!cmd) {
+			return nullptr;
+		}
+		auto to = std::make_unique<Group>(std::move(cmd));
+		to->bg = from->bg;
+		copyRd(from->rdUnits, to->rdUnits, ordinal, c);
+		return c.err == ParseErr::Ok ? std::move(to) : nullptr;
+	}
+	auto from = static_cast<Ordered*>(node);
+	auto to = std::make_unique<Ordered>();
+	to->list.reserve(from->list.size());
+	for (auto& p : from->list) {
+		auto n = copy(p.get(), c);
+		if (!n) {
+			return nullptr;
+		}
+		to->list.push_back(std::move(n));
+	}
+	return to;
+}
+
+/// the holes of a node, in line order: its assignments, then its
+/// words, then its redirections
+std::pair<const LineCache::Hole*, const LineCache::Hole*>
+LineCache::holesOf(const Copy& c, uint32_t ordinal) const
+{
+	if (!c.line) {
+		return {nullptr, nullptr};
+	}
+	auto range = std::equal_range(c.holes->data(), c.holes->data() + c.holes->size(),
+								  ordinal, ByNode());
+	return {range.first, range.second};
+}
+
+std::unique_ptr<NodeBase> LineCache::copyExec(Exec* from, uint32_t ordinal, Copy& c)
+{
+	auto to = std::make_unique<Exec>();
+	to->bg = from->bg;
+	auto [h, end] = holesOf(c, ordinal);
+
+	to->assigns.reserve(from->assigns.size());
+	for (std::size_t i = 0; i < from->assigns.size(); ++i) {
+		if (h == end || h->kind != LineHole::Assign || h->index != i) {
+			to->assigns.push_back(from->assigns[i]);
+			continue;
+		}
+		ArenaVector<char*> words;
+		if ((c.err = lexHole(c.line + h->at, words, false)) != ParseErr::Ok) {
+			return nullptr;
+		}
+		to->assigns.emplace_back(from->assigns[i].first, words.empty() ? "" : words[0]);
+		++holesLexed_;
+		++h;
+	}
+
+	// a hole gave count entries of the kept argv, maybe none; what it
+	// gives now takes their place
+	auto& words = from->argv;
+	to->argv.reserve(words.size());
+	std::size_t j = 0;
+	auto copyUpTo = [&](std::size_t stop) {
+		for (; j < stop; ++j) {
+			to->argv.push_back(Arena::current().copy(words[j], std::strlen(words[j])));
+		}
+	};
+	for (; h != end && h->kind == LineHole::Arg; ++h) {
+		copyUpTo(h->index);
+		if ((c.err = lexHole(c.line + h->at, to->argv, true)) != ParseErr::Ok) {
+			return nullptr;
+		}
+		j += h->count;
+		++holesLexed_;
+	}
+	copyUpTo(words.size() - 1);
+	if (to->argv.empty() && to->assigns.empty()) {
+		c.err = ParseErr::EmptyArgvList;
+		return nullptr;
+	}
+	to->argv.push_back(nullptr);
+
+	copyRd(from->rdUnits, to->rdUnits, ordinal, c);
+	return c.err == ParseErr::Ok ? std::move(to) : nullptr;
+}
+
+void LineCache::copyRd(const RdUnits& from, RdUnits& to, uint32_t ordinal, Copy& c)
+{
+	auto [h, end] = holesOf(c, ordinal);
+	while (h != end && h->kind != LineHole::Redirect) {
+		++h;
+	}
+	to.reserve(from.size());
+	for (std::size_t i = 0; i < from.size(); ++i) {
+		if (h == end || h->index != i) {
+			to.push_back(from[i]);
+			continue;
+		}
+		auto rd = parseHoleRedirection(c.line + h->at);
+		if (rd.second != ParseErr::Ok) {
+			// as parsing the line would say
+			c.err = ParseErr::InvalidRedirection;
+			return;
+		}
+		to.push_back(std::move(rd.first));
+		++holesLexed_;
+		++h;
+	}
+}
+
+/// a copy of the tree just parsed from line, with its holes by node
+void LineCache::keep(const std::string& line, NodeBase* root, const LineShape& shape)
+{
+	if (lru_.size() >= capacity_) {
+		evict();
+	}
+	std::vector<NodeBase*> order;
+	std::unique_ptr<NodeBase> kept;
+	{
+		ArenaScope scope(*arena_);
+		Copy c{nullptr, nullptr, &order};
+		kept = copy(root, c);
+	}
+
+	std::vector<std::pair<const NodeBase*, uint32_t>> ordinals;
+	ordinals.reserve(order.size());
+	for (std::size_t i = 0; i < order.size(); ++i) {
+		ordinals.emplace_back(order[i], uint32_t(i));
+	}
+	std::sort(ordinals.begin(), ordinals.end());
+	std::vector<Hole> holes;
+	holes.reserve(shape.holes.size());
+	for (auto& h : shape.holes) {
+		auto at = std::lower_bound(ordinals.begin(), ordinals.end(),
+								   std::make_pair(h.node, uint32_t(0)));
+		holes.push_back({h.kind, at->second, h.index, h.count, h.at});
+	}
+	// the lexer noted them in line order; by node, and still in line
+	// order within one
+	std::stable_sort(holes.begin(), holes.end(), [](const Hole& a, const Hole& b) {
+		return a.node < b.node;
+	});
+
+	lru_.push_front({line, std::move(kept), std::move(holes)});
+	index_.emplace(lru_.front().line, lru_.begin());
+}
+
+void LineCache::evict()
+{
+	index_.erase(lru_.back().line);
+	lru_.pop_back();
+	++evictions_;
+	if (++evictedSince_ >= capacity_) {
+		compact();
+	}
+}
+
+/// as many lines gone as are kept: most of the arena is theirs. the
+/// kept trees move to a new one
+void LineCache::compact()
+{
+	evictedSince_ = 0;
+	auto fresh = std::make_unique<Arena>();
+	ArenaScope scope(*fresh);
+	for (auto& e : lru_) {
+		Copy c{nullptr, nullptr, nullptr};
+		e.root = copy(e.root.get(), c);
+	}
+	arena_ = std::move(fresh);
+}
+
+void LineCache::reset()
+{
+	index_.clear();
+	lru_.clear();
+	arena_ = std::make_unique<Arena>();
+	evictedSince_ = 0;
+	hits_ = misses_ = unkept_ = evictions_ = holesLexed_ = 0;
+}
+
+std::string LineCache::stats() const
+{
+	char buf[256];
+	uint64_t lookups = hits_ + misses_;
+	std::snprintf(buf, sizeof(buf),
+				  "lines kept\t%zu of %zu\n"
+				  "hits\t\t%llu\n"
+				  "misses\t\t%llu (%llu not kept)\n"
+				  "evictions\t%llu\n"
+				  "holes lexed\t%llu\n"
+				  "hit rate\t%.1f%%\n",
+				  lru_.size(), capacity_,
+				  (unsigned long long)hits_, (unsigned long long)misses_,
+				  (unsigned long long)unkept_, (unsigned long long)evictions_,
+				  (unsigned long long)holesLexed_,
+				  lookups ? 100.0 * hits_ / lookups : 0.0);
+	return buf;
+}
@@ -0,0 +1,94 @@
+#ifndef LINECACHE_H__
+#define LINECACHE_H__
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "arena.h"
+#include "parse.h"
+
+/// the trees of the last lines run, by their text, so a line that comes
+/// again is not lexed and parsed again. the words that depend on when
+/// they are lexed ($ constructs, ~, wildcards) are kept as holes, and a
+/// hit lexes only those, in line order, with the $(...) of the line
+/// started together as a parse would
+class LineCache
+{
+public:
+	LineCache();
+	LineCache(const LineCache&) = delete;
+	~LineCache();
+
+	/// what parseCmdLine(line) gives, into the current arena
+	ParseResult parse(const std::string& line);
+
+	/// forget every line and the counters
+	void reset();
+	/// the counters as the linecache builtin lists them
+	std::string stats() const;
+
+private:
+	struct Hole
+	{
+		LineHole::Kind kind;
+		uint32_t node;		// the node it is in, in preorder
+		uint32_t index;
+		uint32_t count;
+		uint32_t at;
+	};
+	struct Entry
+	{
+		std::string line;
+		/// in arena_, its words as they were lexed the first time
+		std::unique_ptr<NodeBase> root;
+		/// by node
+		std::vector<Hole> holes;
+	};
+	/// a copy of a tree as it is being made: with line, the holes are
+	/// lexed again from its text; without, copied as they are
+	struct Copy
+	{
+		const char* line;
+		const std::vector<Hole>* holes;
+		/// the nodes copied, in preorder
+		std::vector<NodeBase*>* order;
+		uint32_t next = 0;
+		ParseErr err = ParseErr::Ok;
+	};
+
+	struct ByNode
+	{
+		bool operator()(const Hole& h, uint32_t node) const { return h.node < node; }
+		bool operator()(uint32_t node, const Hole& h) const { return node < h.node; }
+	};
+
+	std::unique_ptr<NodeBase> copy(NodeBase* node, Copy& c);
+	std::unique_ptr<NodeBase> copyExec(Exec* from, uint32_t ordinal, Copy& c);
+	void copyRd(const RdUnits& from, RdUnits& to, uint32_t ordinal, Copy& c);
+	std::pair<const Hole*, const Hole*> holesOf(const Copy& c, uint32_t ordinal) const;
+	void keep(const std::string& line, NodeBase* root, const LineShape& shape);
+	void evict();
+	void compact();
+
+	std::list<Entry> lru_;		// most recent first
+	std::unordered_map<std::string_view, std::list<Entry>::iterator> index_;
+	/// where the kept trees are. nothing in it is freed before compact()
+	/// copies the live ones to a new one
+	std::unique_ptr<Arena> arena_;
+	std::size_t capacity_;
+	std::size_t evictedSince_ = 0;
+
+	uint64_t hits_ = 0;
+	uint64_t misses_ = 0;
+	uint64_t unkept_ = 0;
+	uint64_t evictions_ = 0;
+	uint64_t holesLexed_ = 0;
+};
+
+LineCache& getLineCache();
+
+#endif
@@ -0,0 +1,100 @@
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "linereader.h"
+
+namespace
+{
+
+constexpr std::size_t CHUNK = 64 * 1024;
+
+}
+
+LineReader::LineReader(int fd)
+	: fd_(fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		// the whole script in one go, from where the fd stands
+		off_t off = lseek(fd, 0, SEEK_CUR);
+		void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED && off >= 0 && off <= st.st_size) {
+			madvise(p, st.st_size, MADV_SEQUENTIAL);
+			map_ = p;
+			mapLen_ = st.st_size;
+			cur_ = static_cast<const char*>(p) + off;
+			lim_ = static_cast<const char*>(p) + st.st_size;
+			eof_ = true;
+			return;
+		}
+		if (p != MAP_FAILED) {
+			munmap(p, st.st_size);
+		}
+	}
+	buf_.resize(CHUNK);
+	cur_ = lim_ = buf_.data();
+}
+
+LineReader::LineReader(std::string text)
+	: text_(std::move(text)), eof_(true)
+{
+	cur_ = text_.data();
+	lim_ = text_.data() + text_.size();
+}
+
+LineReader::~LineReader()
+{
+	if (map_) {
+		munmap(map_, mapLen_);
+	}
+}
+
+/// keep the partial line, then read behind it. false at end of file
+bool LineReader::fill()
+{
+	std::size_t keep = lim_ - cur_;
+	if (keep == buf_.size()) {
+		// a line longer than the buffer
+		std::size_t at = cur_ - buf_.data();
+		buf_.resize(buf_.size() * 2);
+		cur_ = buf_.data() + at;
+	}
+	std::memmove(buf_.data(), cur_, keep);
+	cur_ = buf_.data();
+	lim_ = cur_ + keep;
+
+	ssize_t n;
+	while ((n = read(fd_, buf_.data() + keep, buf_.size() - keep)) < 0
+		   && errno == EINTR)
+		;
+	if (n <= 0) {
+		eof_ = true;
+		return false;
+	}
+	lim_ += n;
+	return true;
+}
+
+bool LineReader::next(std::string_view* line)
+{
+	const char* nl;
+	std::size_t scanned = 0;
+	while ((nl = static_cast<const char*>(
+				std::memchr(cur_ + scanned, '\n', lim_ - cur_ - scanned))) == nullptr) {
+		scanned = lim_ - cur_;
+		if (eof_ || !fill()) {
+			if (cur_ == lim_) {
+				return false;
+			}
+			// last line without a newline
+			*line = std::string_view(cur_, lim_ - cur_);
+			cur_ = lim_;
+			return true;
+		}
+	}
+	*line = std::string_view(cur_, nl - cur_);
+	cur_ = nl + 1;
+	return true;
+}
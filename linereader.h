@@ -0,0 +1,38 @@
+#ifndef LINEREADER_H__
+#define LINEREADER_H__
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+
+/// hands out the lines of a script without copying them. a regular
+/// file is mapped whole, anything else is read in large chunks
+class LineReader
+{
+public:
+	/// read from fd, which stays the caller's
+	explicit LineReader(int fd);
+	/// the lines of a string, as given to -c
+	explicit LineReader(std::string text);
+	LineReader(const LineReader&) = delete;
+	~LineReader();
+
+	/// the next line without its '\n', valid until the next call.
+	/// false at the end of the input
+	bool next(std::string_view* line);
+
+private:
+	bool fill();
+
+	int fd_ = -1;
+	void* map_ = nullptr;
+	std::size_t mapLen_ = 0;
+	std::string text_;
+	std::vector<char> buf_;
+	bool eof_ = false;
+	const char* cur_ = nullptr;
+	const char* lim_ = nullptr;
+};
+
+#endif
@@ -1,5 +1,83 @@
-#include <set>
 #include "nodes.h"
+#include "builtin.h"
+#include <unistd.h>
+
+NodeBase::~NodeBase() = default;
+
+namespace
+{
+
+std::string render(const NodeBase* root, bool debug)
+{
+    struct Step
+    {
+        const NodeBase* node;
+        std::size_t next;   // the child to write next
+    };
+    std::vector<Step> stack;
+    std::string out;
+    root->writeOpen(out, debug);
+    stack.push_back({root, 0});
+    while (!stack.empty()) {
+        Step& top = stack.back();
+        if (top.next == top.node->childCount()) {
+            top.node->writeClose(out, debug);
+            stack.pop_back();
+            if (!stack.empty()) {
+                Step& parent = stack.back();
+                parent.node->writeAfter(out, parent.next++, debug);
+            }
+            continue;
+        }
+        const NodeBase* c = top.node->child(top.next);
+        c->writeOpen(out, debug);
+        stack.push_back({c, 0});
+    }
+    return out;
+}
+
+}
+
+std::string NodeBase::toStringDebug() const
+{
+    return render(this, true);
+}
+
+std::string NodeBase::toString() const
+{
+    return render(this, false);
+}
+
+void NodeBase::dispose(std::unique_ptr<NodeBase> child)
+{
+    // the children of whatever is being destroyed wait here; only the
+    // outermost call destroys them, so no destructor runs inside another.
+    // never destroyed itself: lines still held at exit go after statics
+    static auto& pending = *new std::vector<std::unique_ptr<NodeBase>>;
+    static bool draining = false;
+    if (!child) {
+        return;
+    }
+    pending.push_back(std::move(child));
+    if (draining) {
+        return;
+    }
+    draining = true;
+    while (!pending.empty()) {
+        auto node = std::move(pending.back());
+        pending.pop_back();
+        node.reset();
+    }
+    draining = false;
+}
+
+void Exec::closeSubstFds()
+{
+    for (int fd : substFds) {
+        close(fd);
+    }
+    substFds.clear();
+}
 
 std::string RdObj::toStringDebug() const
 {
@@ -9,6 +87,8 @@ std::string RdObj::toStringDebug() const
         return ret;
     } else if (tag == FD) {
         return std::to_string(fd);
+    } else if (tag == Text) {
+        return "[text " + std::to_string(fname.size()) + " bytes]";
     } else {
         return "";
     }
@@ -18,6 +98,13 @@ std::string RdObj::toString() const
 {
     if (tag == FN) {
         return fname;
+    } else if (tag == Text) {
+        // a here-document shows as the here-string it amounts to
+        std::string ret = "'";
+        for (char ch : fname.substr(0, fname.size() - (!fname.empty() && fname.back() == '\n'))) {
+            ret += ch == '\'' ? std::string("'\\''") : std::string(1, ch);
+        }
+        return ret + "'";
     } else if (tag == FD) {
         return std::to_string(fd);
     } else {
@@ -35,6 +122,7 @@ std::string RdUnit::toStringDebug() const
     case RdTag::App: ret += ">>"; break;
     case RdTag::OutDup: ret += ">&"; break;
     case RdTag::OutErr: ret += ">&"; break;
+    case RdTag::Here: ret += "<<<"; break;
     case RdTag::Invalid:ret += "INVALIDRD"; break;
     }
 
@@ -53,6 +141,7 @@ std::string RdUnit::toString() const
     case RdTag::App: ret += ">>"; break;
     case RdTag::OutDup: ret += ">&"; break;
     case RdTag::OutErr: ret += ">&"; break;
+    case RdTag::Here: ret += "<<<"; break;
     case RdTag::Invalid:ret += "INVALIDRD"; break;
     }
 
@@ -62,28 +151,30 @@ std::string RdUnit::toString() const
 }
 
 
-std::string Exec::toStringDebug() const
+void Exec::writeOpen(std::string& out, bool debug) const
 {
-    std::string ret = "[argv-list ";
-    for (size_t i = 0; argv[i] != nullptr; ++i) {
-        assert(i < argv.size());
-        ret += "[";
-        ret += argv[i];
-        ret += "] ";
-    }
-    for (auto& rd : rdUnits) {
-        ret += rd.toStringDebug() + " ";
+    std::string ret;
+    if (debug) {
+        ret = "[argv-list ";
+        for (size_t i = 0; argv[i] != nullptr; ++i) {
+            assert(i < argv.size());
+            ret += "[";
+            ret += argv[i];
+            ret += "] ";
+        }
+        for (auto& rd : rdUnits) {
+            ret += rd.toStringDebug() + " ";
+        }
+        ret += "]";
+        if (bg) {
+            ret += " &";
+        }
+        out += ret;
+        return;
     }
-    ret += "]";
-    if (bg) {
-        ret += " &";
+    for (auto& a : assigns) {
+        ret += a.first + "=" + a.second + " ";
     }
-    return ret;
-}
-
-std::string Exec::toString() const
-{
-    std::string ret;
     for (size_t i = 0; argv[i] != nullptr; ++i) {
         assert(i < argv.size());
         ret += argv[i];
@@ -96,89 +187,87 @@ std::string Exec::toString() const
     if (bg) {
         ret += " &";
     }
-    return ret;
+    out += ret;
 }
 
-extern std::set<std::string> builtinCmds;
-
 bool Exec::runInCurrentProcess()
 {
-    return builtinCmds.find(argv[0]) != builtinCmds.end();
+    return assignOnly() || findBuiltin(argv[0]) != nullptr;
 }
 
-std::string Pipe::toStringDebug() const
+bool Exec::stateFree()
 {
-    std::string ret = "[pipe ";
-    ret += left->toStringDebug();
-    ret += " | ";
-    ret += right->toStringDebug();
-    ret += "]";
-    if (bg)
-        ret += " &";
-    return ret;
+    if (assignOnly()) {
+        return false;
+    }
+    auto builtin = findBuiltin(argv[0]);
+    return !bg && builtin != nullptr && builtin->pure;
 }
 
-std::string Pipe::toString() const
+void Pipe::writeOpen(std::string& out, bool debug) const
 {
-    std::string ret;
-    ret += left->toString();
-    ret += " | ";
-    ret += right->toString();
+    if (debug)
+        out += "[pipe ";
+}
+
+void Pipe::writeAfter(std::string& out, std::size_t i, bool) const
+{
+    if (i + 1 != stages.size())
+        out += " | ";
+}
+
+void Pipe::writeClose(std::string& out, bool debug) const
+{
+    if (debug)
+        out += "]";
     if (bg)
-        ret += " &";
-    return ret;
+        out += " &";
 }
 
-std::string Group::toStringDebug() const
+void Group::writeOpen(std::string& out, bool debug) const
 {
-    std::string ret = "[group ";
-    ret += cmd->toStringDebug() + " ";
-    for (auto& rd : rdUnits) {
-        ret += rd.toStringDebug() + " ";
-    }
-    ret += "]";
-    if (bg) {
-        ret += " &";
-    }
-    return ret;
+    out += debug ? "[group " : "(";
 }
 
-std::string Group::toString() const
+void Group::writeAfter(std::string& out, std::size_t, bool) const
 {
-    std::string ret = "(";
-    ret += cmd->toString() + " ";
+    out += " ";
+}
 
-    ret += ")";
-    for (auto& rd : rdUnits) {
-        ret += rd.toString() + " ";
+void Group::writeClose(std::string& out, bool debug) const
+{
+    if (debug) {
+        for (auto& rd : rdUnits) {
+            out += rd.toStringDebug() + " ";
+        }
+        out += "]";
+    } else {
+        out += ")";
+        for (auto& rd : rdUnits) {
+            out += rd.toString() + " ";
+        }
+        if (out.back() == ' ') out.pop_back();
     }
-    if (ret.back() == ' ') ret.pop_back();
     if (bg) {
-        ret += " &";
+        out += " &";
     }
-    return ret;
 }
 
-std::string Ordered::toStringDebug() const
+void Ordered::writeOpen(std::string& out, bool debug) const
 {
-    std::string ret = "[Ordered ";
-    for (auto& p : list) {
-        ret += p->toStringDebug();
-        ret += " ";
-    }
-
-    ret += "]";
-    return ret;
+    if (debug)
+        out += "[Ordered ";
 }
 
-std::string Ordered::toString() const
+void Ordered::writeAfter(std::string& out, std::size_t, bool debug) const
 {
-    std::string ret;
-    for (auto& p : list) {
-        ret += p->toString();
-        ret += "; ";
-    }
-    if (ret.back() == ' ') ret.pop_back();
-    return ret;
+    out += debug ? " " : "; ";
 }
 
+void Ordered::writeClose(std::string& out, bool debug) const
+{
+    if (debug)
+        out += "]";
+    else if (out.back() == ' ')
+        out.pop_back();
+}
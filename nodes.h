@@ -4,32 +4,43 @@
 #include <memory>
 #include <cstdlib>
 #include <string>
+#include <utility>
 #include <vector>
 #include <cassert>
 
+#include "arena.h"
 #include "executor.h"
 
 struct RdObj
 {
     enum {
-        FN, FD, Empty,
+        FN, FD, Empty, Text,
     } tag;
 
     explicit RdObj(std::string fn) : tag(FN), fname(std::move(fn)) {}
 
+    /// what a here-document or here-string feeds in
+    static RdObj text(std::string s) {
+        RdObj obj(std::move(s));
+        obj.tag = Text;
+        return obj;
+    }
+
     explicit RdObj(int fildes) : tag(FD), fd(fildes) {}
 
     RdObj() : tag(Empty) {}
 
+    /// FN: the file name, Text: the text itself
     std::string fname;
     int fd;
     std::string toStringDebug() const;
     std::string toString() const;
 };
 
+/// Here: <<word, <<-word and <<<word, the text in rhs
 enum class RdTag
 {
-    Out, In, App, OutDup, OutErr, Invalid
+    Out, In, App, OutDup, OutErr, Here, Invalid
 };
 
 struct RdUnit
@@ -42,15 +53,43 @@ struct RdUnit
     RdUnit(RdTag tag, RdObj l, RdObj r) : rdTag(tag), lhs(std::move(l)), rhs(std::move(r)) {}
     std::string toStringDebug() const;
     std::string toString() const;
+
+    /// what is read goes to fd 0
+    bool isInput() const {
+        return rdTag == RdTag::In || rdTag == RdTag::Here;
+    }
 };
 
+/// the redirections of one command, in the line's arena
+using RdUnits = ArenaVector<RdUnit>;
+
+/// nodes live in the current arena, and so go with their line: deleting
+/// one only runs its destructor
 struct NodeBase
 {
+    static void* operator new(std::size_t n) {
+        return Arena::current().allocate(n);
+    }
+    static void operator delete(void*) {}
+
     virtual ~NodeBase();
-	virtual std::string toStringDebug() const = 0;
-	virtual std::string toString() const = 0;
+	/// both written with a stack of their own, however deep the tree
+	virtual std::string toStringDebug() const;
+	virtual std::string toString() const;
 	virtual void accept(Executor*) = 0;
 
+	/// how toString() writes a node: writeOpen, each child followed
+	/// by writeAfter(i), then writeClose. all of it appended to out
+	virtual void writeOpen(std::string& out, bool debug) const = 0;
+	virtual void writeAfter(std::string&, std::size_t, bool) const {}
+	virtual void writeClose(std::string&, bool) const {}
+	virtual std::size_t childCount() const {
+		return 0;
+	}
+	virtual const NodeBase* child(std::size_t) const {
+		return nullptr;
+	}
+
 	virtual bool setBg(bool) {
 	    return false;
 	}
@@ -59,7 +98,7 @@ struct NodeBase
 	    assert(false);
 	}
 
-	virtual bool setRd(std::vector<RdUnit>&&) {
+	virtual bool setRd(RdUnits&&) {
 	    return false;
 	}
 
@@ -70,6 +109,25 @@ struct NodeBase
 	virtual bool isPipe() {
 		return false;
 	}
+
+	virtual bool isExec() {
+		return false;
+	}
+
+	virtual bool isGroup() {
+		return false;
+	}
+
+	/// made only of builtins that leave the shell alone, so running it
+	/// in the shell process is the same as running it in a subshell
+	virtual bool stateFree() {
+		return false;
+	}
+
+protected:
+	/// destroy a child after the node, not inside its destructor: a
+	/// deep tree is torn down in a loop instead of recursively
+	static void dispose(std::unique_ptr<NodeBase> child);
 };
 
 /// redirectable backgroundable
@@ -77,17 +135,21 @@ struct Exec final : public NodeBase
 {
     friend class Executor;
     bool bg = false;
-    std::vector<RdUnit> rdUnits;
-	std::vector<char*> argv;
+    RdUnits rdUnits;
+	/// null-terminated once parsed, ready for execve. the array and
+	/// the words are in the line's arena
+	ArenaVector<char*> argv;
+	/// NAME=value words in front of the command
+	std::vector<std::pair<std::string, std::string>> assigns;
+	/// the shell's ends of the pipes of the <(...) and >(...) in argv.
+	/// the command inherits them; the shell's copies go once it starts
+	std::vector<int> substFds;
 	~Exec() override {
-	    size_t i;
-	    for (i = 0; i < argv.size() - 1; ++i) {
-	        if (argv[i])
-	            delete [] argv[i];
-	        argv[i] = nullptr;
-	    }
+	    closeSubstFds();
 	}
 
+	void closeSubstFds();
+
 	bool setBg(bool b) override {
 	    bg = b;
 	    return true;
@@ -97,26 +159,41 @@ struct Exec final : public NodeBase
 	    return bg && !runInCurrentProcess();
 	}
 
-	bool setRd(std::vector<RdUnit>&& v) override {
+	bool setRd(RdUnits&& v) override {
 	    rdUnits = std::move(v);
 	    return true;
 	}
 
-	std::string toStringDebug() const override;
-	std::string toString() const override;
+	void writeOpen(std::string& out, bool debug) const override;
 	void accept(Executor* e) override { e->visit(this); }
 	bool runInCurrentProcess() override;
+
+	bool isExec() override {
+		return true;
+	}
+
+	/// NAME=value and no command: sets shell variables
+	bool assignOnly() const {
+		return argv.size() <= 1;
+	}
+
+	bool stateFree() override;
 };
 
 /// backgroundable
+/// a | b | ... | z, all stages hang off one node so the shell can
+/// start them side by side
 struct Pipe final : public NodeBase
 {
     friend class Executor;
     bool bg = false;
-    Pipe(std::unique_ptr<NodeBase> l, std::unique_ptr<NodeBase> r)
-            : left(std::move(l)), right(std::move(r)) {}
-	std::unique_ptr<NodeBase> left;
-	std::unique_ptr<NodeBase> right;
+    Pipe() = default;
+    ~Pipe() override {
+        for (auto& s : stages) {
+            dispose(std::move(s));
+        }
+    }
+	ArenaVector<std::unique_ptr<NodeBase>> stages;
 
     bool setBg(bool b) override {
         bg = b;
@@ -131,8 +208,15 @@ struct Pipe final : public NodeBase
 		return true;
 	}
 
-	std::string toStringDebug() const override;
-    std::string toString() const override;
+	void writeOpen(std::string& out, bool debug) const override;
+	void writeAfter(std::string& out, std::size_t i, bool debug) const override;
+	void writeClose(std::string& out, bool debug) const override;
+	std::size_t childCount() const override {
+		return stages.size();
+	}
+	const NodeBase* child(std::size_t i) const override {
+		return stages[i].get();
+	}
 	void accept(Executor* e) override { e->visit(this); }
 };
 
@@ -141,10 +225,16 @@ struct Group final : public NodeBase
 {
     friend class Executor;
     bool bg = false;
-    std::vector<RdUnit> rdUnits;
+    RdUnits rdUnits;
+    /// what cmd says about itself is taken now: asking later would
+    /// recurse down every group inside
     explicit Group(std::unique_ptr<NodeBase> p)
-            : cmd(std::move(p)) {}
+            : cmd(std::move(p)), cmdStateFree(cmd->stateFree()) {}
+    ~Group() override {
+        dispose(std::move(cmd));
+    }
 	std::unique_ptr<NodeBase> cmd;
+	bool cmdStateFree;
 
     bool setBg(bool b) override {
         bg = b;
@@ -155,24 +245,73 @@ struct Group final : public NodeBase
         return bg;
     }
 
-    bool setRd(std::vector<RdUnit>&& v) override {
+    bool setRd(RdUnits&& v) override {
         rdUnits = std::move(v);
         return true;
     }
 
-    std::string toStringDebug() const override;
-    std::string toString() const override;
+	void writeOpen(std::string& out, bool debug) const override;
+	void writeAfter(std::string& out, std::size_t i, bool debug) const override;
+	void writeClose(std::string& out, bool debug) const override;
+	std::size_t childCount() const override {
+		return 1;
+	}
+	const NodeBase* child(std::size_t) const override {
+		return cmd.get();
+	}
 	void accept(Executor* e) override { e->visit(this); }
+
+	bool isGroup() override {
+		return true;
+	}
+
+	bool runInCurrentProcess() override {
+		return !bg && cmdStateFree;
+	}
+
+	bool stateFree() override {
+		return !bg && cmdStateFree;
+	}
 };
 
 struct Ordered final : public NodeBase
 {
     friend class Executor;
-	std::vector<std::unique_ptr<NodeBase>> list;
-	std::string toStringDebug() const override;
-	std::string toString() const override;
+	ArenaVector<std::unique_ptr<NodeBase>> list;
+	~Ordered() override {
+		for (auto& p : list) {
+			dispose(std::move(p));
+		}
+	}
+	void writeOpen(std::string& out, bool debug) const override;
+	void writeAfter(std::string& out, std::size_t i, bool debug) const override;
+	void writeClose(std::string& out, bool debug) const override;
+	std::size_t childCount() const override {
+		return list.size();
+	}
+	const NodeBase* child(std::size_t i) const override {
+		return list[i].get();
+	}
 	void accept(Executor* e) override { e->visit(this); }
 	bool runInCurrentProcess() override { return true; }
+
+	bool stateFree() override {
+		for (auto& p : list) {
+			if (!p->stateFree())
+				return false;
+		}
+		return true;
+	}
+};
+
+/// one parsed command line. shared by the jobs it starts
+struct CmdLine
+{
+    explicit CmdLine(std::unique_ptr<NodeBase> r, Arena::Lease a = nullptr)
+            : arena(std::move(a)), root(std::move(r)) {}
+    /// where root was parsed into; released after root is gone
+    Arena::Lease arena;
+    std::unique_ptr<NodeBase> root;
 };
 
 #endif
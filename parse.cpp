@@ -1,291 +1,674 @@
 #include "parse.h"
-#include <cctype>
+#include "arena.h"
+#include "charclass.h"
+#include "expand.h"
+#include "glob.h"
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <deque>
 #include <limits.h>
+#include <stdexcept>
+#include <string>
 #include <utility>
-#include <thread>
+#include <vector>
 namespace
 {
 
-class StrBuffer
+bool isDelim(char ch)
 {
-public:
-    StrBuffer()
-		: size(0), cap(15), buff(new char[cap+1])
-    {
-        buff[0] = '\0';	   
+    return chars::is(ch, chars::Delim);
+}
+
+/// <(...) or >(...): a word, not a redirection
+bool isProcSubst(char const* p)
+{
+    return (*p == '<' || *p == '>') && p[1] == '(';
+}
+
+bool endsWord(char ch)
+{
+    return chars::is(ch, chars::WordEnd);
+}
+
+bool isWild(char ch)
+{
+    return chars::is(ch, chars::Wild);
+}
+
+bool isIfs(char ch)
+{
+    return chars::is(ch, chars::Ifs);
+}
+
+bool isDigit(char ch)
+{
+    return chars::is(ch, chars::Digit);
+}
+
+/// what ends a word, and what it needs more than a copy for. ] too,
+/// for the wildcards a split word keeps track of
+constexpr ByteSet wordStop(" \t();&|<>'\"\\$~*?[]");
+/// where a quote or $(...) may start, or the word ends
+constexpr ByteSet rawStop(" \t();&|<>'\"\\$");
+/// what is more than text between double quotes
+constexpr ByteSet dquoteStop("\"\\$");
+/// what is more than text in an unquoted here-document body
+constexpr ByteSet hereStop("\\$");
+
+/// the length of NAME when p starts NAME=, else 0
+std::size_t assignmentName(char const* p)
+{
+    if (!chars::is(*p, chars::NameStart)) {
+        return 0;
+    }
+    char const* q = p + 1;
+    while (chars::isNameChar(*q)) {
+        ++q;
     }
+    return *q == '=' ? q - p : 0;
+}
+
+/// an argv word in the line's arena
+char* copyWord(char const* p, std::size_t n)
+{
+    return Arena::current().copy(p, n);
+}
 
-    StrBuffer(const StrBuffer&) = delete;
-    StrBuffer(StrBuffer&& rhs) {
-        buff = rhs.buff;
-        rhs.buff = nullptr;
-        size = rhs.size;
-        cap = rhs.cap;	   
+/// where parseCmdLine(line, shape) notes what it finds: null while
+/// parsing anything else
+LineShape* shape = nullptr;
+char const* shapeLine = nullptr;
+/// set by the lexer once the word it is on depends on when it is
+/// lexed: an expansion, a ~, a wildcard
+bool lexedDynamic = false;
+
+void noteHole(LineHole::Kind kind, const NodeBase* node, std::size_t index,
+              std::size_t count, char const* at)
+{
+    if (shape) {
+        shape->holes.push_back({kind, node, uint32_t(index), uint32_t(count),
+                                uint32_t(at - shapeLine)});
     }
-    ~StrBuffer() {
-        if (buff)
-            delete [] buff;
-		
+}
+
+/// finish a word and start cur over. if it has unquoted wildcards
+/// (wildAt: where the unquoted *?[] are) it is replaced by the paths it
+/// matches, if any
+void pushWord(std::string& cur, std::vector<std::size_t>& wildAt, bool wild,
+              ArenaVector<char*>& out)
+{
+    if (!wild) {
+        wildAt.clear();
+        out.push_back(copyWord(cur.data(), cur.size()));
+        cur.clear();
+        return;
     }
+    // quoted wildcards only stand for themselves
+    const std::string& word = cur;
+    std::string pat;
+    std::size_t k = 0;
+    for (std::size_t i = 0; i < word.size(); ++i) {
+        if (k < wildAt.size() && wildAt[k] == i) {
+            ++k;
+        } else if (isWild(word[i]) || word[i] == ']' || word[i] == '\\') {
+            pat.push_back('\\');
+        }
+        pat.push_back(word[i]);
+    }
+    wildAt.clear();
 
-    void push_back(char ch) {
-        assert(buff);
-        if (size == cap) {
-            auto nbuff = new char[2 * cap + 1];
-            for (std::size_t i = 0; i < size; ++i) {
-                nbuff[i] = buff[i];
-            }
-            delete [] buff;
-            buff = nbuff;
-            cap = 2 * cap;
-			std::vector<int> vvv;
+    std::vector<std::string> paths;
+    if (!globExpand(pat, paths)) {
+        out.push_back(copyWord(cur.data(), cur.size()));
+        cur.clear();
+        return;
+    }
+    cur.clear();
+    for (auto& path : paths) {
+        out.push_back(copyWord(path.data(), path.size()));
+    }
+}
+
+/// the scratch space of one word: the word so far, expansion values and
+/// where the unquoted wildcards are. kept for the next word rather than
+/// freed, so a warm lexer allocates nothing outside the line's arena.
+/// a substitution lexed in the middle of a word gets a set of its own
+class LexScratch
+{
+public:
+    LexScratch() : depth_(depth++) {
+        if (pool.size() == depth_) {
+            pool.emplace_back();
         }
-        buff[size++] = ch;
-        buff[size] = '\0';
+        word().clear();
+        val().clear();
+        wildAt().clear();
+    }
+    LexScratch(const LexScratch&) = delete;
+    ~LexScratch() {
+        --depth;
     }
 
-    char* release() {
-        assert(buff);
-        auto ret = buff;
-        buff = nullptr;
-        ret[size] = '\0';
+    std::string& word() {
+        return pool[depth_].word;
+    }
 
-        return ret;
+    std::string& val() {
+        return pool[depth_].val;
     }
 
-    char* get() {
-        return buff;
+    std::vector<std::size_t>& wildAt() {
+        return pool[depth_].wildAt;
     }
+
 private:
-    std::size_t size;
-    std::size_t cap;
-    char* buff;
+    struct Set
+    {
+        std::string word;
+        std::string val;
+        std::vector<std::size_t> wildAt;
+    };
+    // a deque: growing it leaves the sets in use where they are
+    static inline std::deque<Set> pool;
+    static inline std::size_t depth = 0;
+    std::size_t depth_;
 };
 
-bool isDelim(char ch)
+/// lex one shell word at p into out. quotes and backslashes are removed
+/// and expansions done on the way, in the same pass. with split, an
+/// unquoted expansion is split on blanks, so one word can give zero or
+/// more entries
+ParseErr lexUnbraced(char const*& p, ArenaVector<char*>& out, bool split)
 {
-    return ch == '(' || ch == ')' || ch == ';' || ch == '&' || ch == '|'
-            || ch == '<' || ch == '>';
-}
+    assert(!endsWord(*p));
+    // fast path: nothing to unquote or expand, copy it in one go
+    std::string_view plain = wordStop.span(p);
+    p += plain.size();
+    if (endsWord(*p)) {
+        out.push_back(copyWord(plain.data(), plain.size()));
+        return ParseErr::Ok;
+    }
 
-std::pair<StrBuffer, ParseErr> nextArgv(char const*& p)
-{
-    assert(!isDelim(*p));
-    StrBuffer chunk;
-    if (*p == '\"') {
-        ++p;
-        while (*p != '\0' && *p != '\"') {
-            chunk.push_back(*p++);
+    LexScratch scratch;
+    std::string& cur = scratch.word();
+    cur.append(plain);
+    bool have = !plain.empty();     // an empty word counts too, once quoted
+    std::string& val = scratch.val();
+    std::vector<std::size_t>& wildAt = scratch.wildAt();
+    bool wild = false;
+    while (!endsWord(*p)) {
+        switch (*p) {
+        case '\\':
+            ++p;
+            if (*p != '\0') {
+                cur.push_back(*p++);
+            }
+            have = true;
+            break;
+        case '\'': {
+            char const* end = std::strchr(p + 1, '\'');
+            if (end == nullptr) {
+                return ParseErr::UnpairedSingleQuotationMark;
+            }
+            cur.append(p + 1, end - p - 1);
+            p = end + 1;
+            have = true;
+            break;
         }
-
-        if (*p == '\"') {
-            // ok
+        case '\"':
+            for (++p; *p != '\"'; ) {
+                if (*p == '\0') {
+                    return ParseErr::UnpairedDoubleQuotationMark;
+                } else if (*p == '\\' && std::strchr("\"\\$`", p[1]) && p[1] != '\0') {
+                    cur.push_back(p[1]);
+                    p += 2;
+                } else if (*p == '$') {
+                    val.clear();
+                    if (expandDollar(p, val) != ExpandError::Ok) {
+                        return ParseErr::BadExpansion;
+                    }
+                    lexedDynamic = true;
+                    cur.append(val);
+                } else if (*p == '\\') {
+                    cur.push_back(*p++);
+                } else {
+                    std::string_view text = dquoteStop.span(p);
+                    cur.append(text);
+                    p += text.size();
+                }
+            }
             ++p;
-            return {std::move(chunk), ParseErr::Ok};
-        } else {
-            return {std::move(chunk), ParseErr::UnpairedDoubleQuotationMark};
+            have = true;
+            break;
+        case '$': {
+            val.clear();
+            if (expandDollar(p, val) != ExpandError::Ok) {
+                return ParseErr::BadExpansion;
+            }
+            lexedDynamic = true;
+            if (!split) {
+                cur.append(val);
+                have = have || !val.empty();
+                break;
+            }
+            // blanks in the value end the word; text around them
+            // becomes words of its own
+            std::size_t i = 0;
+            for (;;) {
+                std::size_t b = i;
+                while (i < val.size() && !isIfs(val[i])) {
+                    ++i;
+                }
+                if (i > b) {
+                    cur.append(val.data() + b, i - b);
+                    have = true;
+                }
+                if (i == val.size()) {
+                    break;
+                }
+                while (i < val.size() && isIfs(val[i])) {
+                    ++i;
+                }
+                if (have) {
+                    pushWord(cur, wildAt, wild, out);
+                    have = wild = false;
+                }
+            }
+            break;
         }
-    } else if (*p == '\'') {
-        ++p;
-        while (*p != '\0' && *p != '\'') {
-            chunk.push_back(*p++);
+        case '~':
+            if (!have && (endsWord(p[1]) || p[1] == '/')) {
+                cur.append(homeDir(), std::strlen(homeDir()));
+                ++p;
+                have = true;
+                lexedDynamic = true;
+                break;
+            }
+            // fall through
+        default:
+            if (split && (isWild(*p) || *p == ']')) {
+                wild = wild || *p != ']';
+                lexedDynamic = lexedDynamic || wild;
+                wildAt.push_back(cur.length());
+            }
+            cur.push_back(*p++);
+            // and the plain run after it in one go
+            plain = wordStop.span(p);
+            cur.append(plain);
+            p += plain.size();
+            have = true;
         }
+    }
+    if (have) {
+        pushWord(cur, wildAt, wild, out);
+    }
+    return ParseErr::Ok;
+}
 
-        if (*p == '\'') {
-            ++p;
-            return {std::move(chunk), ParseErr::Ok};
-        } else {
-            return {std::move(chunk), ParseErr::UnpairedSingleQuotationMark};
+/// where the word at p ends, quotes and $(...) taken whole. an unpaired
+/// quote runs to the end of the line
+char const* rawWordEnd(char const* p)
+{
+    for (p = rawStop.find(p); !endsWord(*p); p = rawStop.find(p)) {
+        switch (*p) {
+        case '\\':
+            p += p[1] != '\0' ? 2 : 1;
+            break;
+        case '\'': {
+            char const* end = std::strchr(p + 1, '\'');
+            p = end ? end + 1 : p + std::strlen(p);
+            break;
         }
-    } else {
-        while (*p != '\0' && !std::isblank(*p) &&
-               !isDelim(*p)) {
-            if (*p == '\\') {
+        case '\"':
+            for (++p; *p != '\0' && *p != '\"'; ++p) {
+                if (*p == '\\' && p[1] != '\0') {
+                    ++p;
+                } else if (*p == '$' && p[1] == '(') {
+                    // its quotes are its own
+                    char const* close = findClose(p + 2);
+                    p = close ? close : p + std::strlen(p) - 1;
+                }
+            }
+            if (*p != '\0') {
                 ++p;
             }
-            chunk.push_back(*p++);
+            break;
+        case '$':
+            if (p[1] == '(') {
+                char const* close = findClose(p + 2);
+                p = close ? close + 1 : p + std::strlen(p);
+                break;
+            }
+            // fall through
+        default:
+            ++p;
+        }
+    }
+    return p;
+}
+
+/// lexUnbraced, after brace expansion when split: a{b,c}d is lexed as
+/// abd then acd. the variants are made one at a time as they are lexed,
+/// so even {1..1000000} never exists as one list
+ParseErr lexWord(char const*& p, ArenaVector<char*>& out, bool split)
+{
+    char const* end = split ? rawWordEnd(p) : p;
+    // the { of ${NAME} opens no braces: not worth a parse
+    char const* open = p;
+    while ((open = std::find(open, end, '{')) != end && open != p && open[-1] == '$') {
+        ++open;
+    }
+    BraceExpansion braces;
+    if (open == end || !braces.parse(std::string_view(p, end - p))) {
+        return lexUnbraced(p, out, split);
+    }
+    std::string variant;
+    while (braces.next(variant)) {
+        // {,a} gives an empty first variant, which is no word at all
+        if (variant.empty()) {
+            continue;
+        }
+        char const* v = variant.c_str();
+        auto err = lexUnbraced(v, out, split);
+        if (err != ParseErr::Ok) {
+            return err;
         }
+    }
+    p = end;
+    return ParseErr::Ok;
+}
 
-        return {std::move(chunk), ParseErr::Ok};
+/// one word where exactly one is wanted: a file name, an fd
+std::pair<std::string, ParseErr> nextWord(char const*& p)
+{
+    if (endsWord(*p)) {
+        return {"", ParseErr::InvalidRedirection};
+    }
+    ArenaVector<char*> words;
+    auto err = lexWord(p, words, false);
+    std::string word;
+    if (err == ParseErr::Ok && words.size() != 1) {
+        err = ParseErr::InvalidRedirection;
     }
+    if (!words.empty()) {
+        word = words[0];
+    }
+    return {std::move(word), err};
 }
 
 void skipBlank(char const*& p) {
-    while (*p != '\0' && std::isblank(*p))
+    while (chars::is(*p, chars::Blank))
         ++p;
 }
 
 std::pair<RdUnit, ParseErr> parseRdUnit(char const*& p);
 
+std::function<bool(std::string&)> hereDocSource;
+
 }
 
-ParseResult parsePrimary(char const*& p)
+namespace
 {
-	if (*p == '(') {
-		++p;
-		auto result = parseList(p);
-        if (result.second != ParseErr::Ok) {
-            return result;
-        }
-
-        skipBlank(p);
-        if (*p != ')') {
-            return {nullptr, ParseErr::MissRightParen};
-        }
-        ++p;
-
-        auto ret = std::make_unique<Group>(std::move(result.first));
-        return {std::move(ret), ParseErr::Ok};
-	} else {
-	    assert(!isDelim(*p));
-		auto execNode = std::make_unique<Exec>();
-        while (*p != '\0' && !isDelim(*p)) {
-            if (std::isdigit(*p)) {
-                char const* currPos = p;
-                do { ++currPos; } while (std::isdigit(*currPos));
-                //skipBlank(currPos);
-                if (*currPos == '>' || *currPos == '<') {
-                    break;
-                }
 
-            } else if (*p == '>' || *p == '<') {
+/// a simple command: NAME=value words, then the argv words up to a
+/// delimiter or a redirection
+ParseResult parseExec(char const*& p)
+{
+    auto execNode = std::make_unique<Exec>();
+    // most commands fit: one allocation instead of a doubling series
+    execNode->argv.reserve(8);
+    while (*p != '\0' && (!isDelim(*p) || isProcSubst(p))) {
+        if (isProcSubst(p)) {
+            if (shape) {
+                shape->reusable = false;
+            }
+            std::string word;
+            if (expandProcSubst(p, word, execNode->substFds) != ExpandError::Ok) {
+                return {nullptr, ParseErr::BadExpansion};
+            }
+            execNode->argv.push_back(copyWord(word.data(), word.size()));
+            skipBlank(p);
+            continue;
+        } else if (isDigit(*p)) {
+            char const* currPos = p;
+            do { ++currPos; } while (isDigit(*currPos));
+            //skipBlank(currPos);
+            if (*currPos == '>' || *currPos == '<') {
                 break;
             }
 
-            auto pair = nextArgv(p);
-            if (pair.second != ParseErr::Ok) {
-                return {nullptr, pair.second};
-            }
+        } else if (*p == '>' || *p == '<') {
+            break;
+        }
 
-            execNode->argv.push_back(pair.first.release());
+        std::size_t nameLen;
+        if (execNode->argv.empty() && (nameLen = assignmentName(p)) > 0) {
+            /// NAME=value before the command word: not split
+            std::string name(p, nameLen);
+            p += nameLen + 1;
+            ArenaVector<char*> words;
+            char const* at = p;
+            lexedDynamic = false;
+            auto err = endsWord(*p) ? ParseErr::Ok : lexWord(p, words, false);
+            if (lexedDynamic) {
+                noteHole(LineHole::Assign, execNode.get(), execNode->assigns.size(), 0, at);
+            }
+            execNode->assigns.emplace_back(std::move(name),
+                                           words.empty() ? "" : words[0]);
+            if (err != ParseErr::Ok) {
+                return {nullptr, err};
+            }
             skipBlank(p);
+            continue;
+        }
+
+        char const* at = p;
+        std::size_t before = execNode->argv.size();
+        lexedDynamic = false;
+        auto err = lexWord(p, execNode->argv, true);
+        if (err != ParseErr::Ok) {
+            return {nullptr, err};
         }
-        if (execNode->argv.empty()) {
-            return {nullptr, ParseErr::EmptyArgvList};
+        if (lexedDynamic) {
+            noteHole(LineHole::Arg, execNode.get(), before,
+                     execNode->argv.size() - before, at);
         }
-        execNode->argv.push_back(nullptr);
+        skipBlank(p);
+    }
+    if (execNode->argv.empty() && execNode->assigns.empty()) {
+        return {nullptr, ParseErr::EmptyArgvList};
+    }
+    execNode->argv.push_back(nullptr);
 
-        return {std::move(execNode), ParseErr::Ok};
-	}
+    return {std::move(execNode), ParseErr::Ok};
 }
 
-ParseResult parseRedirected(char const*& p)
+/// at [n]< or [n]>
+bool atRedirection(char const* p)
 {
-    assert(!isDelim(*p) || *p == '(');
-    auto primary = parsePrimary(p);
-    if (primary.second != ParseErr::Ok) {
-        return {nullptr, primary.second};
+    while (isDigit(*p)) {
+        ++p;
     }
+    return *p == '<' || *p == '>';
+}
 
-    skipBlank(p);
-
-    if (std::isdigit(*p) || *p == '>' || *p == '<') {
-        std::vector<RdUnit> rdUnits;
-        do {
-            auto rdpair = parseRdUnit(p);
-            if (rdpair.second != ParseErr::Ok) {
-                return {nullptr, ParseErr::InvalidRedirection};
-            } else {
-                rdUnits.push_back(rdpair.first);
-            }
-            skipBlank(p);
-        } while (std::isdigit(*p) || *p == '>' || *p == '<');
-
-        primary.first->setRd(std::move(rdUnits));
-        return {std::move(primary.first), ParseErr::Ok};
-
-    } else {
-        return primary;
-    }
+/// the redirections after a command or a group
+ParseErr parseRedirections(char const*& p, NodeBase* node)
+{
+    RdUnits rdUnits;
+    do {
+        char const* at = p;
+        lexedDynamic = false;
+        auto rdpair = parseRdUnit(p);
+        if (rdpair.second != ParseErr::Ok) {
+            return ParseErr::InvalidRedirection;
+        }
+        if (lexedDynamic) {
+            noteHole(LineHole::Redirect, node, rdUnits.size(), 0, at);
+        }
+        rdUnits.push_back(std::move(rdpair.first));
+        skipBlank(p);
+    } while (atRedirection(p));
+    node->setRd(std::move(rdUnits));
+    return ParseErr::Ok;
 }
 
-ParseResult parsePipe(char const*& p)
+/// one ( ... ) being parsed, or the outermost list: the list and the
+/// pipe it has so far. the ones around it wait further down the stack
+struct Frame
 {
-    auto pair = parseRedirected(p);
-    if (pair.second != ParseErr::Ok) {
-        return {nullptr, pair.second};
+    std::unique_ptr<Ordered> ordered;   // once there was a ; or &
+    std::unique_ptr<Pipe> pipe;         // once there was a |
+};
+
+/// the frames of the parses in progress, on the heap rather than the
+/// native stack, so nesting costs a few words per level. a $(...) lexed
+/// halfway through a line parses on top of the line's frames. kept
+/// between lines, so a warm parser does not allocate here
+class FrameStack
+{
+public:
+    FrameStack() : base_(frames.size()) {
+        push();
+    }
+    FrameStack(const FrameStack&) = delete;
+    /// what an unfinished parse built goes with its frames
+    ~FrameStack() {
+        frames.resize(base_);
     }
-    skipBlank(p);
 
-    if (*p != '|') {
-        return pair;
-    } else {
-        auto root = std::move(pair.first);
-        do {
-            ++p;
-            skipBlank(p);
-            auto rhs = parseRedirected(p);
-            if (rhs.second != ParseErr::Ok) {
-                return {nullptr, rhs.second};
-            }
-            root = std::make_unique<Pipe>(std::move(root), std::move(rhs.first));
-            skipBlank(p);
-        } while (*p == '|');
-        return {std::move(root), ParseErr::Ok};
+    void push() {
+        frames.emplace_back();
+    }
+    void pop() {
+        frames.pop_back();
+    }
+    Frame& top() {
+        return frames.back();
+    }
+    bool outermost() const {
+        return frames.size() == base_ + 1;
     }
+
+private:
+    static inline std::vector<Frame> frames;
+    std::size_t base_;
+};
+
 }
 
 ParseResult parseList(char const*& p)
 {
-    auto lhspair = parsePipe(p);
-    if (lhspair.second != ParseErr::Ok) {
-        return {nullptr, lhspair.second};
-    }
-    skipBlank(p);
-
-    if (*p == '&' || *p == ';') {
-        auto curr = std::move(lhspair.first);
-        auto ordered = std::make_unique<Ordered>();
-        if (*p == '&') {
-            auto canSet = curr->setBg(true);
-            if (!canSet) {
-                return {nullptr, ParseErr::NotBgable};
-            }
-        } else {
-            assert(*p == ';');
-        }
-        ordered->list.push_back(std::move(curr));
-        ++p;
+    FrameStack stack;
+    for (;;) {
         skipBlank(p);
+        // a primary: ( opens a frame, anything else is a command
+        if (*p == '(') {
+            ++p;
+            stack.push();
+            continue;
+        }
+        auto res = parseExec(p);
+        if (res.second != ParseErr::Ok) {
+            return res;
+        }
+        std::unique_ptr<NodeBase> node = std::move(res.first);
 
-        while (*p != '\0' && !isDelim(*p)) {
-            auto pr = parsePipe(p);
-            if (pr.second != ParseErr::Ok) {
-                return {nullptr, pr.second};
-            }
-
+        // the primary is done, and with it maybe the pipe, the list and
+        // the group around it; a closed group is the primary of the frame
+        // below, and so on down
+        for (;;) {
             skipBlank(p);
-            if (*p == '&') {
-                pr.first->setBg(true);
-                ordered->list.push_back(std::move(pr.first));
-                ++p;
-            } else if(*p == ';') {
-                ordered->list.push_back(std::move(pr.first));
+            if (atRedirection(p)) {
+                auto err = parseRedirections(p, node.get());
+                if (err != ParseErr::Ok) {
+                    return {nullptr, err};
+                }
+            }
+            Frame& f = stack.top();
+            if (*p == '|') {
+                if (!f.pipe) {
+                    f.pipe = std::make_unique<Pipe>();
+                }
+                f.pipe->stages.push_back(std::move(node));
                 ++p;
-            } else {
-                ordered->list.push_back(std::move(pr.first));
                 break;
             }
+            if (f.pipe) {
+                f.pipe->stages.push_back(std::move(node));
+                node = std::move(f.pipe);
+            }
+
+            if (*p == '&' || *p == ';') {
+                if (*p == '&' && !node->setBg(true)) {
+                    return {nullptr, ParseErr::NotBgable};
+                }
+                if (!f.ordered) {
+                    f.ordered = std::make_unique<Ordered>();
+                }
+                f.ordered->list.push_back(std::move(node));
+                ++p;
+                skipBlank(p);
+                // a trailing ; or & ends the list as well
+                if (*p != '\0' && (!isDelim(*p) || *p == '(')) {
+                    break;
+                }
+            } else if (f.ordered) {
+                f.ordered->list.push_back(std::move(node));
+            }
+            if (f.ordered) {
+                auto& list = f.ordered->list;
+                if (list.size() == 1) {
+                    node = std::move(list[0]);
+                } else {
+                    node = std::move(f.ordered);
+                }
+            }
+
+            if (stack.outermost()) {
+                return {std::move(node), ParseErr::Ok};
+            }
             skipBlank(p);
+            if (*p != ')') {
+                return {nullptr, ParseErr::MissRightParen};
+            }
+            ++p;
+            stack.pop();
+            node = std::make_unique<Group>(std::move(node));
         }
-        if (ordered->list.size() == 1) {
-            return {std::move(ordered->list[0]), ParseErr::Ok};
-        } else {
-            return {std::move(ordered), ParseErr::Ok};
-        }
-
-    } else {
-        return lhspair;
     }
 }
 
-ParseResult parseCmdLine(char const* begin)
+void setHereDocSource(std::function<bool(std::string&)> next)
+{
+    hereDocSource = std::move(next);
+}
+
+namespace
+{
+
+ParseResult parseLine(char const* begin)
 {
+    // each $(...) in a $(...) parses and runs from inside the one around
+    // it, on the native stack: past this depth it is an error, not a
+    // crash
+    constexpr int NEST_MAX = 200;
+    static int nesting = 0;
+    struct Nest {
+        Nest() { ++nesting; }
+        ~Nest() { --nesting; }
+    } nest;
+    if (nesting > NEST_MAX) {
+        return {nullptr, ParseErr::BadExpansion};
+    }
+
     skipBlank(begin);
     if (*begin == '\0') {
         return {nullptr, ParseErr::EmptyCmd};
     }
+    // start the line's $(...) together before the lexer needs them
+    SubstBatch batch(begin);
     auto res = parseList(begin);
     if (res.second != ParseErr::Ok) {
         return {nullptr, res.second};
@@ -299,31 +682,158 @@ ParseResult parseCmdLine(char const* begin)
     return res;
 }
 
+/// makes s the shape noted in, or none, until it goes
+class ShapeScope
+{
+public:
+    ShapeScope(LineShape* s, char const* line)
+            : prev_(shape), prevLine_(shapeLine) {
+        shape = s;
+        shapeLine = line;
+    }
+    ShapeScope(const ShapeScope&) = delete;
+    ~ShapeScope() {
+        shape = prev_;
+        shapeLine = prevLine_;
+    }
+
+private:
+    LineShape* prev_;
+    char const* prevLine_;
+};
+
+}
+
+ParseResult parseCmdLine(char const* begin)
+{
+    ShapeScope scope(nullptr, nullptr);
+    return parseLine(begin);
+}
+
+ParseResult parseCmdLine(char const* line, LineShape& shape)
+{
+    ShapeScope scope(&shape, line);
+    return parseLine(line);
+}
+
+ParseErr lexHole(char const* p, ArenaVector<char*>& out, bool split)
+{
+    ShapeScope scope(nullptr, nullptr);
+    return endsWord(*p) ? ParseErr::Ok : lexWord(p, out, split);
+}
+
+std::pair<RdUnit, ParseErr> parseHoleRedirection(char const* p)
+{
+    ShapeScope scope(nullptr, nullptr);
+    return parseRdUnit(p);
+}
+
 
 namespace
 {
 
 std::pair<std::string, ParseErr> parseFilename(char const*& p)
 {
-    std::string filename;
-    auto pair = nextArgv(p);
-    if (pair.second != ParseErr::Ok) {
-        return {"", pair.second};
-    } else {
-        return {pair.first.get(), ParseErr::Ok};
+    return nextWord(p);
+}
+
+/// the body of a here-document, up to the line that is just delim.
+/// with strip (<<-) leading tabs go first. when the delimiter was not
+/// quoted, $ constructs are expanded and \$ \` \\ lose the backslash
+ParseErr readHereDoc(const std::string& delim, bool strip, bool expand, std::string& body)
+{
+    std::string line;
+    while (hereDocSource && hereDocSource(line)) {
+        char const* q = line.c_str();
+        if (strip) {
+            while (*q == '\t') {
+                ++q;
+            }
+        }
+        if (q == delim) {
+            return ParseErr::Ok;
+        }
+        if (!expand) {
+            body.append(q);
+        } else {
+            while (*q != '\0') {
+                if (*q == '\\' && std::strchr("$`\\", q[1]) && q[1] != '\0') {
+                    body.push_back(q[1]);
+                    q += 2;
+                } else if (*q == '$') {
+                    if (expandDollar(q, body) != ExpandError::Ok) {
+                        return ParseErr::BadExpansion;
+                    }
+                } else if (*q == '\\') {
+                    body.push_back(*q++);
+                } else {
+                    std::string_view text = hereStop.span(q);
+                    body.append(text);
+                    q += text.size();
+                }
+            }
+        }
+        body.push_back('\n');
     }
+    // the end of input ends the body too
+    return ParseErr::Ok;
+}
+
+/// after the <<: [-]word and the body it delimits, or <word, the text
+/// word and a newline
+std::pair<RdUnit, ParseErr> parseHere(char const*& p)
+{
+    if (*p == '<') {
+        ++p;
+        skipBlank(p);
+        // not a file name: a word that expands to nothing is an empty line
+        if (endsWord(*p)) {
+            return {{}, ParseErr::InvalidRedirection};
+        }
+        ArenaVector<char*> words;
+        auto err = lexWord(p, words, false);
+        if (err != ParseErr::Ok) {
+            return {{}, err};
+        }
+        std::string text = words.empty() ? "" : words[0];
+        text.push_back('\n');
+        return {{RdTag::Here, RdObj(), RdObj::text(std::move(text))}, ParseErr::Ok};
+    }
+    // the body comes from the lines after this one
+    if (shape) {
+        shape->reusable = false;
+    }
+    bool strip = *p == '-';
+    if (strip) {
+        ++p;
+    }
+    skipBlank(p);
+    // any quoting in the delimiter keeps the body as it is written
+    char const* end = rawWordEnd(p);
+    bool quoted = std::find_if(p, end, [](char ch) {
+        return ch == '\'' || ch == '\"' || ch == '\\';
+    }) != end;
+    auto res = nextWord(p);
+    if (res.second != ParseErr::Ok) {
+        return {{}, res.second};
+    }
+    std::string body;
+    auto err = readHereDoc(res.first, strip, !quoted, body);
+    if (err != ParseErr::Ok) {
+        return {{}, err};
+    }
+    return {{RdTag::Here, RdObj(), RdObj::text(std::move(body))}, ParseErr::Ok};
 }
 
 std::pair<int, ParseErr> parseFd(char const*& p)
 {
-    std::string lexeme;
-    auto pair = nextArgv(p);
+    auto pair = nextWord(p);
     if (pair.second != ParseErr::Ok) {
         return {0, pair.second};
     } else {
         int fd;
         try {
-            fd = std::stoi(pair.first.get());
+            fd = std::stoi(pair.first);
         } catch (const std::invalid_argument& ) {
             return {0, ParseErr::ExpectNumber};
         } catch (const std::out_of_range& ) {
@@ -341,8 +851,8 @@ std::pair<int, ParseErr> parseFd(char const*& p)
 
 std::pair<RdUnit, ParseErr> parseRdUnit(char const*& p)
 {
-    assert(std::isdigit(*p) || *p == '<' || *p == '>');
-    if (std::isdigit(*p)) {
+    assert(isDigit(*p) || *p == '<' || *p == '>');
+    if (isDigit(*p)) {
         int fd = parseFd(p).first;
 
         if (*p == '>') {
@@ -368,7 +878,7 @@ std::pair<RdUnit, ParseErr> parseRdUnit(char const*& p)
                 if (res.second != ParseErr::Ok) {
                     return {{}, res.second};
                 } else {
-                    if (*p == '\0' || std::isblank(*p) || isDelim(*p)) {
+                    if (endsWord(*p)) {
                         return {{RdTag::OutDup, RdObj(fd), RdObj(res.first)},
                                 ParseErr::Ok};
                     } else {
@@ -426,6 +936,9 @@ std::pair<RdUnit, ParseErr> parseRdUnit(char const*& p)
     } else {
         assert(*p == '<');
         p += 1;
+        if (*p == '<') {
+            return parseHere(++p);
+        }
         skipBlank(p);
         auto res = parseFilename(p);
         if (res.second != ParseErr::Ok) {
@@ -1,8 +1,12 @@
 #ifndef PARSE_H__
 #define PARSE_H__
 
+#include <cstdint>
+#include <functional>
+#include <string>
 #include <utility>
 #include <memory>
+#include <vector>
 #include "nodes.h"
 
 enum class ParseErr
@@ -10,19 +14,59 @@ enum class ParseErr
 	Ok, MissRightParen, ExpectNumber, UnpairedDoubleQuotationMark,
     UnpairedSingleQuotationMark, FdOutOfRange, NotSingular, InvalidRedirection,
     EmptyArgvList,
-	NotBgable, EmptyCmd,
+	NotBgable, EmptyCmd, BadExpansion,
 };
 
 using ParseResult = std::pair<std::unique_ptr<NodeBase>, ParseErr>;
 
 ParseResult parseCmdLine(char const*);
 
-ParseResult parsePrimary(char const*&);
+/// a word of a line whose value is only known once it is lexed: it
+/// has a $ construct, a ~ or a wildcard. the rest of the line lexes to
+/// the same every time
+struct LineHole
+{
+	enum Kind : uint8_t { Arg, Assign, Redirect } kind;
+	/// the command or group it is in
+	const NodeBase* node;
+	/// Arg: its first argv entry, Assign: which NAME=value, Redirect:
+	/// which redirection
+	uint32_t index;
+	/// Arg: how many argv entries it gave this time
+	uint32_t count;
+	/// where its text starts in the line: the word, the value after
+	/// NAME=, or the whole redirection
+	uint32_t at;
+};
 
-ParseResult parseRedirected(char const*&);
+/// what parseCmdLine(line, shape) found out about a line besides its tree
+struct LineShape
+{
+	std::vector<LineHole> holes;
+	/// false once the line has something its text alone does not give
+	/// again: a here-document body, a <(...)
+	bool reusable = true;
+};
 
-ParseResult parsePipe(char const*&);
+/// parseCmdLine, noting the holes of the line in shape. the $(...) in
+/// it are parsed without
+ParseResult parseCmdLine(char const* line, LineShape& shape);
 
+/// lex the text of an Arg hole again (an Assign one without split),
+/// appending the words it gives now to out
+ParseErr lexHole(char const* p, ArenaVector<char*>& out, bool split);
+
+/// parse the text of a Redirect hole again
+std::pair<RdUnit, ParseErr> parseHoleRedirection(char const* p);
+
+/// a list of pipes, up to what cannot continue it. groups are parsed
+/// with a stack of their own, so any depth of ( ) parses in linear time
+/// and a few native frames
 ParseResult parseList(char const*&);
 
+/// where the bodies of <<word here-documents come from: the lines after
+/// the one being parsed. next(line) gives false at the end of input.
+/// with no source set a body is empty
+void setHereDocSource(std::function<bool(std::string&)> next);
+
 #endif
@@ -0,0 +1,177 @@
+#include <cstdio>
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "redirect.h"
+
+namespace
+{
+
+/// up to this much text goes through a pipe: it is never full before
+/// the text is in, whatever its size was set to
+constexpr std::size_t HERE_PIPE_MAX = PIPE_BUF;
+
+bool writeAll(int fd, const char* p, std::size_t n)
+{
+	while (n > 0) {
+		ssize_t w = write(fd, p, n);
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		p += w;
+		n -= w;
+	}
+	return true;
+}
+
+/// an fd to read text from, with no file behind it: a pipe for a
+/// little, a sealed memfd for more
+int openHereText(const std::string& text)
+{
+	if (text.size() <= HERE_PIPE_MAX) {
+		int fd[2];
+		if (pipe2(fd, O_CLOEXEC) < 0)
+			return -1;
+		bool ok = writeAll(fd[1], text.data(), text.size());
+		close(fd[1]);
+		if (!ok) {
+			close(fd[0]);
+			return -1;
+		}
+		return fd[0];
+	}
+
+	int fd = memfd_create("sltsh-here", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -1;
+	// sealed, so the reader can neither change it nor truncate it
+	if (!writeAll(fd, text.data(), text.size())
+		|| fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0
+		|| lseek(fd, 0, SEEK_SET) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+}
+
+int openRdTarget(const RdUnit& u)
+{
+	if (u.rdTag == RdTag::Here) {
+		assert(u.rhs.tag == RdObj::Text);
+		int fd = openHereText(u.rhs.fname);
+		if (fd < 0)
+			std::perror("sltsh: here-document");
+		return fd;
+	}
+	assert(u.rhs.tag == RdObj::FN);
+	const char* fn = u.rhs.fname.c_str();
+	int fd;
+	switch (u.rdTag) {
+	case RdTag::In:
+		fd = open(fn, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			std::fprintf(stderr, "can't open %s for read\n", fn);
+		return fd;
+	case RdTag::Out:
+	case RdTag::OutErr:
+		fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, CREATMODE);
+		if (fd < 0)
+			std::fprintf(stderr, "can't open %s for write\n", fn);
+		return fd;
+	case RdTag::App:
+		fd = open(fn, O_WRONLY | O_APPEND | O_CLOEXEC);
+		if (fd < 0)
+			std::fprintf(stderr, "can't open %s for append\n", fn);
+		return fd;
+	default:
+		assert(false);
+		return -1;
+	}
+}
+
+bool RedirectScope::save(int fd)
+{
+	for (auto& sv : saved_) {
+		if (sv.fd == fd)
+			return true;
+	}
+	int copy = fcntl(fd, F_DUPFD_CLOEXEC, SHELL_FD_BASE);
+	if (copy < 0 && errno != EBADF) {
+		std::perror("sltsh: can't save fd");
+		return false;
+	}
+	saved_.push_back({fd, copy});
+	return true;
+}
+
+bool RedirectScope::redirect(int from, int to)
+{
+	if (!save(to))
+		return false;
+	if (from != to && dup2(from, to) < 0) {
+		std::perror("dup2 error");
+		return false;
+	}
+	return true;
+}
+
+bool RedirectScope::apply(const RdUnits& rdvec)
+{
+	for (auto& u : rdvec) {
+		switch (u.rdTag) {
+		case RdTag::In:
+		case RdTag::Here:
+		case RdTag::Out:
+		case RdTag::App:
+		case RdTag::OutErr: {
+			int to = u.isInput() ? 0
+				: u.lhs.tag == RdObj::Empty ? 1 : u.lhs.fd;
+			// save first: the new file may land right on a closed target
+			if (!save(to) || (u.rdTag == RdTag::OutErr && !save(2)))
+				return false;
+			int fd = openRdTarget(u);
+			if (fd < 0)
+				return false;
+			bool ok = redirect(fd, to)
+				&& (u.rdTag != RdTag::OutErr || redirect(fd, 2));
+			if (fd != to) {
+				close(fd);
+			} else {
+				fcntl(fd, F_SETFD, 0);
+			}
+			if (!ok)
+				return false;
+			break;
+		}
+		case RdTag::OutDup:
+			assert(u.lhs.tag == RdObj::FD && u.rhs.tag == RdObj::FD);
+			if (!redirect(u.rhs.fd, u.lhs.fd))
+				return false;
+			break;
+		default:
+			assert(false);
+		}
+	}
+	return true;
+}
+
+void RedirectScope::restore()
+{
+	for (auto iter = saved_.rbegin(); iter != saved_.rend(); ++iter) {
+		if (iter->copy >= 0) {
+			dup2(iter->copy, iter->fd);
+			close(iter->copy);
+		} else {
+			close(iter->fd);
+		}
+	}
+	saved_.clear();
+}
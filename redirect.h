@@ -0,0 +1,48 @@
+#ifndef REDIRECT_H__
+#define REDIRECT_H__
+
+#include <vector>
+#include <sys/stat.h>
+#include "nodes.h"
+
+constexpr unsigned CREATMODE = S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH;
+
+/// open the file named by a redirection unit (the rhs of In, Out,
+/// App, OutErr) with the flags that redirection needs, or an fd that
+/// reads the text of a Here. returns the new fd, or -1 after printing
+/// a diagnostic
+int openRdTarget(const RdUnit& u);
+
+/// lowest fd number used by the shell for descriptors it keeps
+/// open on behalf of a child, so they never collide with the
+/// fds the user names in redirections
+constexpr int SHELL_FD_BASE = 10;
+
+/// applies redirections to the shell's own fds and puts the previous
+/// ones back when it goes out of scope, so a redirected group can run
+/// without a subshell
+class RedirectScope
+{
+public:
+	RedirectScope() = default;
+	RedirectScope(const RedirectScope&) = delete;
+	~RedirectScope() { restore(); }
+
+	/// false after a diagnostic when a target can't be opened. what was
+	/// changed up to then is still undone by restore()
+	bool apply(const RdUnits& rdvec);
+	void restore();
+
+private:
+	struct Saved
+	{
+		int fd;
+		int copy;	// -1: fd was not open before
+	};
+	bool save(int fd);
+	bool redirect(int from, int to);
+
+	std::vector<Saved> saved_;
+};
+
+#endif
@@ -1,21 +1,30 @@
 #include <string>
-#include <set>
 #include <sstream>
 #include <iostream>
-#include <type_traits>
 #include <cstring>
+#include <cstdlib>
 #include <signal.h>
 #include <cstdio>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
-#include "expand.h"
+#include <sys/mman.h>
 #include "context.h"
 #include "parse.h"
 #include "executor.h"
-
-constexpr unsigned CREATMODE = S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH;
+#include "redirect.h"
+#include "launch.h"
+#include "cmdhash.h"
+#include "linecache.h"
+#include "builtin.h"
+#include "eventloop.h"
+#include "zygote.h"
+#include "linereader.h"
+#include "capture.h"
+#include "vars.h"
+#include "glob.h"
+#include "arena.h"
 
 Context& getContext()
 {
@@ -24,68 +33,42 @@ Context& getContext()
 }
 
 
-std::set<std::string> builtinCmds = {
-        "cd", "fg", "bg", "umask", "exit", "jobs"
-};
-
 using SigHandler = void(*)(int);
 SigHandler setSignalHandler(int sig, SigHandler handler);
 void init();
 void restoreSignals();
-void stopAndWait(pid_t pid);
-void prepareRedirection(const std::vector<RdUnit>& rdvec);
+void initForkedChild();
+void runLine(const std::string& cmd);
+void prepareRedirection(const RdUnits& rdvec);
 void dup2Checked(int fd, int to);
 void newContextRun(std::unique_ptr<NodeBase>& node, Executor* executor);
-void sigchldHandler(int signo);
-void doBuiltinCmd(Exec* node);
 void becomeTtyFgPgrp();
 void newPipeContextRun(Pipe* node, Executor* executor);
+pid_t spawnExec(Exec* node, const sigset_t* mask,
+                pid_t pgid = 0, int in = -1, int out = -1);
+void waitFgJob(int jid);
+void addColorFlag(Exec* node);
 
 void doBg(int jid);
 void doFg(int jid);
 
-std::string strCmdOutput(std::unique_ptr<NodeBase> node);
+bool captureCmdOutput(std::unique_ptr<NodeBase>& node, Capture& out);
+pid_t startCmdOutput(std::unique_ptr<NodeBase>& node, int* rfd);
+pid_t startCmdInput(std::unique_ptr<NodeBase>& node, int* wfd);
 
 void SIGTTOU_handler(int signo)
 {
     abort();
 }
 
-class SignalBlockGuard
+/// keeps the zygote from reaping the processes of a job until the job
+/// is complete and owns the terminal
+class ZygoteHold
 {
-private:
-    sigset_t set_;
-	sigset_t oldset_;
-    template<typename S, typename... Args>
-    void addRest(S s, Args... rest) {
-        static_assert(std::is_same<S, int>::value, "Not the correct signal type");
-        sigaddset(&set_, s);
-        addRest(rest...);
-    };
-    void addRest(int signo) {
-        sigaddset(&set_, signo);
-    }
 public:
-    template<typename S, typename... Args>
-    SignalBlockGuard(S s1, Args... rest) {
-        sigemptyset(&set_);
-        addRest(s1, rest...);
-        if (sigprocmask(SIG_BLOCK, &set_, &oldset_) < 0) {
-            std::perror("sigpromask error");
-            std::exit(6);
-        }
-    }
-
-    void unblock() {
-        if (sigprocmask(SIG_SETMASK, &oldset_, nullptr) < 0) {
-            std::perror("sigpromask error");
-            std::exit(6);
-        }
-    }
-
-    ~SignalBlockGuard() {
-        unblock();
-    }
+    ZygoteHold() { getZygote().hold(); }
+    ~ZygoteHold() { release(); }
+    void release() { getZygote().release(); }
 };
 
 void prPrompt()
@@ -113,32 +96,67 @@ void prPrompt()
 	free(path);
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+    /// -c string, a script file, or stdin when it is not a terminal:
+    /// nobody to prompt and no terminal to hand around
+    std::unique_ptr<LineReader> reader;
+    if (argc > 1 && !std::strcmp(argv[1], "-c")) {
+        if (argc < 3) {
+            std::fprintf(stderr, "sltsh: -c: option requires an argument\n");
+            std::exit(2);
+        }
+        reader = std::make_unique<LineReader>(std::string(argv[2]));
+    } else if (argc > 1) {
+        int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            std::fprintf(stderr, "sltsh: %s: %s\n", argv[1], std::strerror(errno));
+            std::exit(127);
+        }
+        // out of reach of the script's own redirections
+        int high = fcntl(fd, F_DUPFD_CLOEXEC, SHELL_FD_BASE);
+        close(fd);
+        if (high < 0) {
+            std::perror("sltsh: fcntl error");
+            std::exit(2);
+        }
+        reader = std::make_unique<LineReader>(high);
+    } else if (!isatty(STDIN_FILENO)) {
+        reader = std::make_unique<LineReader>(STDIN_FILENO);
+    }
+    getContext().interactive = reader == nullptr;
     init();
-    std::string cmd;
 
-	prPrompt();
-    while (std::getline(std::cin, cmd)) {
-        auto expandRes = expand(cmd);
-        if (expandRes.second != ExpandError::Ok) {
-            std::cerr << "sltsh: expand error" << std::endl;
-        } else {
-            auto parseRes = parseCmdLine(expandRes.first.c_str());
-            if (parseRes.second != ParseErr::Ok) {
-                if (parseRes.second != ParseErr::EmptyCmd) {
-                    std::cerr << "sltsh: syntax error" << std::endl;
-                }
-            } else {
-                Executor executor;
-                if (parseRes.first->runInCurrentProcess()) {
-                    parseRes.first->accept(&executor);
-                } else {
-                    newContextRun(parseRes.first, &executor);
-                }
+    if (reader) {
+        // here-document bodies are the lines that follow
+        setHereDocSource([&reader](std::string& s) {
+            std::string_view body;
+            if (!reader->next(&body)) {
+                return false;
             }
+            s.assign(body);
+            return true;
+        });
+        std::string_view line;
+        while (reader->next(&line)) {
+            runLine(std::string(line));
+            // nobody is told about background jobs, but they are reaped
+            getEventLoop().reap();
         }
+        std::exit(getContext().lastExitStatus);
+    }
 
+    setHereDocSource([](std::string& s) {
+        std::cerr << "> ";
+        return bool(std::getline(std::cin, s));
+    });
+    std::string cmd;
+	prPrompt();
+    while (std::getline(std::cin, cmd)) {
+        runLine(cmd);
+
+        getEventLoop().reap();
+        getContext().doneStatus.clear();
         auto& delayed = getContext().delayedMsg;
         while (!delayed.empty()) {
             std::cerr << delayed.front();
@@ -156,6 +174,38 @@ int main()
     std::exit(getContext().lastExitStatus);
 }
 
+void runLine(const std::string& cmd)
+{
+    getCommandHash().revalidate();
+    // the tree and its words go to an arena of their own, let go with
+    // the line once no job needs it any more
+    auto arena = Arena::acquire();
+    ArenaScope scope(*arena);
+    // expansions are done by the lexer, as it meets them; a line seen
+    // before only has its holes lexed again
+    auto parseRes = getLineCache().parse(cmd);
+    // listings are only good for the line they were read for
+    globForgetDirs();
+    if (parseRes.second == ParseErr::BadExpansion) {
+        std::cerr << "sltsh: expand error" << std::endl;
+        return;
+    } else if (parseRes.second != ParseErr::Ok) {
+        if (parseRes.second != ParseErr::EmptyCmd) {
+            std::cerr << "sltsh: syntax error" << std::endl;
+        }
+        return;
+    }
+    Executor executor;
+    auto& line = getContext().currentLine;
+    line = std::make_shared<CmdLine>(std::move(parseRes.first), std::move(arena));
+    if (line->root->runInCurrentProcess()) {
+        line->root->accept(&executor);
+    } else {
+        newContextRun(line->root, &executor);
+    }
+    line.reset();
+}
+
 void init()
 {
     auto setSH = [](int signo, SigHandler sh) {
@@ -164,15 +214,37 @@ void init()
             std::exit(1);
         }
     };
-    setSH(SIGTSTP, SIG_IGN);
-    setSH(SIGINT, SIG_IGN);
-    setSH(SIGQUIT, SIG_IGN);
+    if (getContext().interactive) {
+        setSH(SIGTSTP, SIG_IGN);
+        setSH(SIGINT, SIG_IGN);
+        setSH(SIGQUIT, SIG_IGN);
+    }
 
-    setSH(SIGCHLD, sigchldHandler);
+    getEventLoop().init();
+
+    getVarStore().import(environ);
+    getCommandHash().setPathSource([]() -> const char* {
+        auto path = getVarStore().get("PATH");
+        return path ? path->c_str() : nullptr;
+    });
+
+    const char* zygote = std::getenv("SLTSH_ZYGOTE");
+    if (zygote && *zygote && std::strcmp(zygote, "0") != 0) {
+        auto onStatus = [](pid_t pid, int statloc) {
+            getContext().onProcessEvent(pid, statloc);
+        };
+        if (getZygote().start(getEventLoop().childMask(), onStatus)) {
+            getEventLoop().watch(getZygote().fd(), [] { getZygote().drain(); });
+        }
+    }
 }
 
 void restoreSignals()
 {
+    if (!getContext().interactive) {
+        // nothing was changed: what we inherited is for our children too
+        return;
+    }
     auto setSH = [](int signo, SigHandler sh) {
         if (setSignalHandler(signo, sh) == SIG_ERR) {
             std::perror("restore failed");
@@ -184,48 +256,129 @@ void restoreSignals()
     setSH(SIGQUIT, SIG_DFL);
 }
 
+/// a forked child that goes on running shell code: it waits for its
+/// own children only, and launches them itself
+void initForkedChild()
+{
+    getEventLoop().afterFork();
+    getZygote().detach();
+    restoreSignals();
+}
+
 
 
 void Executor::visit(Exec* node)
 {
-    if (builtinCmds.find(node->argv[0]) != builtinCmds.end()) {
+    if (node->assignOnly()) {
+        auto& vars = getVarStore();
+        for (auto& a : node->assigns) {
+            vars.set(a.first, a.second);
+        }
+        getContext().lastExitStatus = 0;
+    } else if (auto builtin = findBuiltin(node->argv[0])) {
         /// builtin command
-        doBuiltinCmd(node);
+        getContext().lastExitStatus = runBuiltin(builtin, node);
     } else {
         prepareRedirection(node->rdUnits);
-		if (!strcmp(node->argv[0], "ls") || !strcmp(node->argv[0], "grep")) {
-			node->argv.back() = strdup("--color=auto");
-			node->argv.push_back(nullptr);
-		}
-        if (execvp(node->argv[0], node->argv.data()) < 0) {
-            std::ostringstream os;
-            os << "sltsh: " << node->argv[0];
-            std::perror(os.str().c_str());
-            std::exit(3);
+		addColorFlag(node);
+        const char* path = getCommandHash().lookup(node->argv[0]);
+        if (path == nullptr) {
+            std::fprintf(stderr, "sltsh: %s: command not found\n", node->argv[0]);
+            std::exit(127);
         }
-        assert(false);
+        auto env = node->assigns.empty() ? getVarStore().environment()
+            : getVarStore().environment(node->assigns);
+        for (int fd : node->substFds) {
+            fcntl(fd, F_SETFD, 0);
+        }
+        getEventLoop().restoreChildMask();
+        execve(path, node->argv.data(), env->envp.data());
+        if (errno == ENOEXEC) {
+            // no #! line: let sh run it, as execvp would
+            auto shArgv = scriptArgv(path, node->argv.data());
+            execve(SCRIPT_SHELL, shArgv.data(), env->envp.data());
+        }
+        std::ostringstream os;
+        os << "sltsh: " << node->argv[0];
+        std::perror(os.str().c_str());
+        std::exit(3);
     }
 }
 
-void stopAndWait(pid_t pid)
+void addColorFlag(Exec* node)
 {
-	//TODO
-	pid_t waitret;
-	int statloc;
-    if ((waitret = waitpid(pid, &statloc, WUNTRACED)) < 0) {
-        std::perror("waitpid error");
-        std::exit(5);
-    }
+	if (!strcmp(node->argv[0], "ls") || !strcmp(node->argv[0], "grep")) {
+		static char color[] = "--color=auto";
+		node->argv.back() = color;
+		node->argv.push_back(nullptr);
+	}
+}
 
-	becomeTtyFgPgrp();
-    if (WIFEXITED(statloc)) {
-		getContext().onProcessExited(waitret, statloc, false);
-    } else if (WIFSTOPPED(statloc)) {
-        getContext().onProcessStopped(waitret, statloc, false);
-    } else if (WIFSIGNALED(statloc)) {
-		getContext().onProcessSignaled(waitret, statloc, false);
-    } else
-        assert(false);
+/// start a plain external command through the spawn engine.
+/// returns the child's pid, or -1 after reporting why it could not start
+pid_t spawnExec(Exec* node, const sigset_t* mask, pid_t pgid, int in, int out)
+{
+	addColorFlag(node);
+	SpawnSpec spec;
+	spec.argv = node->argv.data();
+	spec.rdUnits = &node->rdUnits;
+	spec.sigmask = mask;
+	spec.pgid = pgid;
+	spec.in = in;
+	spec.out = out;
+	// shared with every other spawn until an exported variable changes
+	auto env = node->assigns.empty() ? getVarStore().environment()
+		: getVarStore().environment(node->assigns);
+	spec.envp = env->envp.data();
+	spec.envGen = env->gen;
+	spec.keepFds = &node->substFds;
+
+	pid_t pid;
+	int err;
+	for (int attempt = 0; ; ++attempt) {
+		spec.path = getCommandHash().lookup(node->argv[0]);
+		if (spec.path == nullptr) {
+			std::fprintf(stderr, "sltsh: %s: command not found\n", node->argv[0]);
+			getContext().lastExitStatus = 127;
+			return -1;
+		}
+		err = getZygote().spawn(spec, &pid);
+		if (err != ENOENT || attempt > 0 || spec.path == node->argv[0]) {
+			break;
+		}
+		// the remembered file went away: look again
+		getCommandHash().forget(node->argv[0]);
+	}
+	// the command has its own copies now, if it started at all
+	node->closeSubstFds();
+	if (err == 0) {
+		return pid;
+	} else if (err > 0) {
+		std::fprintf(stderr, "sltsh: %s: %s\n", node->argv[0], std::strerror(err));
+		getContext().lastExitStatus = (err == ENOENT) ? 127 : 126;
+	} else {
+		getContext().lastExitStatus = 1;
+	}
+	return -1;
+}
+
+/// wait until every process of the foreground job has finished or stopped
+void waitFgJob(int jid)
+{
+	auto& ctx = getContext();
+	ctx.fgJob = jid;
+	for (;;) {
+		getEventLoop().reap();
+		auto iter = ctx.jobMap.find(jid);
+		if (iter == ctx.jobMap.end() || iter->second.stat != JobStatus::Running) {
+			break;
+		}
+		getEventLoop().wait();
+	}
+	ctx.fgJob = -1;
+	if (ctx.interactive) {
+		becomeTtyFgPgrp();
+	}
 }
 
 void Executor::visit(Pipe* node)
@@ -235,16 +388,49 @@ void Executor::visit(Pipe* node)
 
 void Executor::visit(Group* node)
 {
-    prepareRedirection(node->rdUnits);
-    node->cmd->accept(this);
+    // ((...)) is walked in a loop, not by a visit per level: directly
+    // nested groups only add their redirections
+    auto inner = [](NodeBase* cmd) -> Group* {
+        return cmd->isGroup() ? static_cast<Group*>(cmd) : nullptr;
+    };
+    if (node->runInCurrentProcess()) {
+        /// no subshell: redirect the shell's own fds for the duration.
+        /// the groups inside are in-process too, and share the scope
+        RedirectScope scope;
+        NodeBase* cmd = node;
+        for (Group* g = node; g != nullptr; g = inner(cmd)) {
+            if (!scope.apply(g->rdUnits)) {
+                getContext().lastExitStatus = 1;
+                return;
+            }
+            cmd = g->cmd.get();
+        }
+        cmd->accept(this);
+        return;
+    }
+
+    // already the subshell: the groups inside that would be subshells
+    // too are this one
+    NodeBase* cmd = node;
+    for (Group* g = node; g != nullptr && !g->runInCurrentProcess(); g = inner(cmd)) {
+        prepareRedirection(g->rdUnits);
+        cmd = g->cmd.get();
+    }
+    cmd->accept(this);
 	// if reached here:
 	std::exit(getContext().lastExitStatus);
 }
 
 void Executor::visit(Ordered* node)
 {
-    for (auto& child : node->list) {
-        if (child->runInCurrentProcess()) {
+    auto& list = node->list;
+    for (std::size_t i = 0; i < list.size(); ++i) {
+        auto& child = list[i];
+        bool last = i + 1 == list.size();
+        if (child->runInCurrentProcess()
+            || (last && tail && !child->getBg())) {
+            /// nothing runs after the last command of a child process:
+            /// it takes over the process (exec) instead of forking again
             child->accept(this);
         } else {
             newContextRun(child, this);
@@ -252,32 +438,6 @@ void Executor::visit(Ordered* node)
     }
 }
 
-void sigchldHandler(int signo)
-{
-    int statloc;
-    pid_t pid;
-    while ((pid = waitpid(-1, &statloc, WUNTRACED | WNOHANG)) > 0) {
-		if (WIFEXITED(statloc)) {
-			getContext().onProcessExited(pid, statloc, true);
-		} else if (WIFSTOPPED(statloc)) {
-			getContext().onProcessStopped(pid, statloc, true);
-		} else if (WIFSIGNALED(statloc)) {
-			getContext().onProcessSignaled(pid, statloc, true);
-		} else
-			assert(false);
-    }
-
-    if (pid == 0) {
-        return;
-    } else {
-        if (errno != ECHILD) {
-            std::perror("waitpid error");
-            std::exit(15);
-        }
-    }
-}
-
-
 void newContextRun(std::unique_ptr<NodeBase>& node, Executor* executor)
 {
 	if (node->isPipe()) {
@@ -286,19 +446,28 @@ void newContextRun(std::unique_ptr<NodeBase>& node, Executor* executor)
 		return;
 	}
 	
-    SignalBlockGuard blockGuard(SIGCHLD);
-    pid_t pid = fork();
-    if (pid < 0) {
+    ZygoteHold hold;
+    bool jobControl = getContext().interactive;
+    pid_t pid;
+    if (node->isExec()
+        && spawnable(static_cast<Exec*>(node.get())->rdUnits)) {
+        /// plain command: no need to copy the shell, fork is the fallback
+        pid = spawnExec(static_cast<Exec*>(node.get()), getEventLoop().childMask(),
+                        jobControl ? 0 : -1);
+        if (pid < 0) {
+            return;
+        }
+    } else if ((pid = fork()) < 0) {
         std::perror("fork error");
         std::exit(2);
     } else if (pid == 0) {
         /// child
-        if (setpgid(0, 0) < 0) {
+        if (jobControl && setpgid(0, 0) < 0) {
             std::perror("setpgid error");
             std::exit(3);
         }
-        blockGuard.unblock();
-        restoreSignals();
+        initForkedChild();
+        executor->tail = true;
         // if (node->getBg()) {
 		// 	// why don't work ??
         //     becomeTtyFgPgrp();
@@ -307,107 +476,123 @@ void newContextRun(std::unique_ptr<NodeBase>& node, Executor* executor)
 
     } else {
         /// parent
-        if (setpgid(pid, pid) < 0) {
+        if (jobControl && setpgid(pid, pid) < 0) {
             std::perror("setpgid error");
             std::exit(4);
         }
+        if (node->isExec()) {
+            static_cast<Exec*>(node.get())->closeSubstFds();
+        }
+    }
 
-		//std::cerr << "hapi" << node->toString() << std::endl;
-		int jid = getContext().addJob(pid, node->toString());
-        if (!node->getBg()) {
-			if (tcsetpgrp(STDIN_FILENO, pid) < 0) {
-				std::perror("tcsetpgrp error");
-				std::exit(3);
-			}
-            stopAndWait(pid);
-        } else {
-            std::fprintf(stderr, "[%d] %ld Running\n", jid, (long)pid);
+    //std::cerr << "hapi" << node->toString() << std::endl;
+    int jid = getContext().addJob(pid, node.get());
+    if (!node->getBg()) {
+        if (jobControl && tcsetpgrp(STDIN_FILENO, pid) < 0) {
+            std::perror("tcsetpgrp error");
+            std::exit(3);
         }
+        hold.release();
+        waitFgJob(jid);
+    } else if (jobControl) {
+        std::fprintf(stderr, "[%d] %ld Running\n", jid, (long)pid);
     }
 }
 
+/// all N stages are children of the shell: N-1 pipes are created
+/// up front and every stage joins the process group of the first one.
+/// without job control they all stay in the shell's group (pgid -1)
 void newPipeContextRun(Pipe* node, Executor* executor)
 {
-	int fd[2];
-	if (pipe(fd) < 0) {
-		std::perror("pipe error");
-		std::exit(20);
-	}
-	
-	pid_t lhs, rhs;
-	SignalBlockGuard guard(SIGCHLD);
-	if ((rhs = fork()) < 0) {
-		std::perror("fork error");
-		std::exit(20);
-	} else if (rhs == 0) {
-		// rhs child
-		guard.unblock();
-		restoreSignals();
-		if (setpgid(0, 0)) {
-			std::perror("setpgid error");
-			std::exit(21);
-		}
-		close(fd[1]);
-		dup2Checked(fd[0], 0);
-		close(fd[0]);
-
-		node->right->accept(executor);
-
-		// if reaches here
-		std::exit(getContext().lastExitStatus);
-		
-	} else {
-		// parent
-		if (setpgid(rhs, rhs) < 0) {
-			std::perror("setpgid error");
+	auto& stages = node->stages;
+	std::vector<pid_t> pids;
+	bool jobControl = getContext().interactive;
+	pid_t pgid = jobControl ? 0 : -1;
+	int prevRead = -1;
+
+	ZygoteHold hold;
+	for (std::size_t i = 0; i < stages.size(); ++i) {
+		int fd[2] = { -1, -1 };
+		if (i + 1 < stages.size() && pipe2(fd, O_CLOEXEC) < 0) {
+			std::perror("pipe error");
 			std::exit(20);
 		}
-		
-		if ((lhs = fork()) < 0) {
+
+		auto& stage = stages[i];
+		pid_t pid;
+		if (stage->isExec() && !stage->runInCurrentProcess()
+			&& spawnable(static_cast<Exec*>(stage.get())->rdUnits)) {
+			pid = spawnExec(static_cast<Exec*>(stage.get()), getEventLoop().childMask(),
+							pgid, prevRead, fd[1]);
+		} else if ((pid = fork()) < 0) {
 			std::perror("fork error");
 			std::exit(21);
-		} else if (lhs == 0) {
-			// lhs child
-			guard.unblock();
-			restoreSignals();
-			if (setpgid(0, rhs) < 0) {
+		} else if (pid == 0) {
+			// stage child
+			initForkedChild();
+			executor->tail = true;
+			if (jobControl && setpgid(0, pgid) < 0) {
 				std::perror("setpgid error");
 				std::exit(22);
 			}
-			close(fd[0]);
-			dup2Checked(fd[1], 1);
-			close(fd[1]);
+			if (prevRead >= 0) {
+				dup2Checked(prevRead, 0);
+				close(prevRead);
+			}
+			if (fd[1] >= 0) {
+				close(fd[0]);
+				dup2Checked(fd[1], 1);
+				close(fd[1]);
+			}
 
-			node->left->accept(executor);
+			stage->accept(executor);
 
 			// if reaches here
 			std::exit(getContext().lastExitStatus);
-			
 		} else {
 			// parent
-			close(fd[0]);
-			close(fd[1]);
-			if (setpgid(lhs, rhs) < 0) {
+			if (jobControl && setpgid(pid, pgid == 0 ? pid : pgid) < 0) {
 				std::perror("setpgid error");
 				std::exit(23);
 			}
+			if (stage->isExec()) {
+				static_cast<Exec*>(stage.get())->closeSubstFds();
+			}
+		}
+
+		if (prevRead >= 0) {
+			close(prevRead);
+		}
+		if (fd[1] >= 0) {
+			close(fd[1]);
+		}
+		prevRead = fd[0];
 
-			int jid = getContext().addJob(rhs, lhs, node->toString());
-			
-			if (!node->getBg()) {
-				if (tcsetpgrp(STDIN_FILENO, rhs) < 0) {
-					std::perror("tcsetpgrp error");
-					std::exit(23);
-				}
-				// both lhs and rhs have group id 'rhs'
-				stopAndWait(-rhs);
-				stopAndWait(-rhs);
-			} else {
-				std::fprintf(stderr, "[%d] Running\n", jid);
+		// a stage that failed to start just leaves its neighbours
+		// with EOF / SIGPIPE, like any other stage that exits early
+		if (pid > 0) {
+			if (pgid == 0) {
+				pgid = pid;
 			}
-			
+			pids.push_back(pid);
 		}
-	}	
+	}
+
+	if (pids.empty()) {
+		return;
+	}
+
+	int jid = getContext().addJob(std::move(pids), node);
+	if (!node->getBg()) {
+		if (jobControl && tcsetpgrp(STDIN_FILENO, pgid) < 0) {
+			std::perror("tcsetpgrp error");
+			std::exit(23);
+		}
+		hold.release();
+		waitFgJob(jid);
+	} else if (jobControl) {
+		std::fprintf(stderr, "[%d] Running\n", jid);
+	}
 }
 
 SigHandler setSignalHandler(int sig, SigHandler handler)
@@ -430,46 +615,25 @@ SigHandler setSignalHandler(int sig, SigHandler handler)
     return osa.sa_handler;
 }
 
-void prepareRedirection(const std::vector<RdUnit>& rdvec)
+void prepareRedirection(const RdUnits& rdvec)
 {
     for (auto& u : rdvec) {
         switch (u.rdTag) {
-        case RdTag::In: {
-            assert(u.lhs.tag == RdObj::Empty
-                   && u.rhs.tag == RdObj::FN);
-            int fd = open(u.rhs.fname.c_str(), O_RDONLY);
+        case RdTag::In:
+        case RdTag::Here: {
+            assert(u.lhs.tag == RdObj::Empty);
+            int fd = openRdTarget(u);
             if (fd < 0) {
-                std::fprintf(stderr, "can't open %s for read\n", u.rhs.fname.c_str());
                 std::exit(7);
             }
             dup2Checked(fd, 0);
             close(fd);
             break;
         }
-        case RdTag::Out: {
-            assert(u.rhs.tag == RdObj::FN);
-			int fd = creat(u.rhs.fname.c_str(), CREATMODE);// TODO temporary
-            if (fd < 0) {
-                std::fprintf(stderr, "can't open %s for write\n", u.rhs.fname.c_str());
-                std::exit(8);
-            }
-            if (u.lhs.tag == RdObj::Empty) {
-                dup2Checked(fd, 1);
-            } else {
-                assert(u.lhs.tag == RdObj::FD);
-                dup2Checked(fd, u.lhs.fd);
-            }
-            close(fd);
-            break;
-        }
+        case RdTag::Out:
         case RdTag::App: {
-            assert(u.rhs.tag == RdObj::FN);
-            int fd = open(u.rhs.fname.c_str(), O_WRONLY | O_APPEND);
-			// int flags = fcntl(fd, F_GETFD);
-			// flags &= ~FD_CLOEXEC;
-			// fcntl(fd, F_SETFD, flags);
+            int fd = openRdTarget(u);
             if (fd < 0) {
-                std::fprintf(stderr, "can't open %s for append\n", u.rhs.fname.c_str());
                 std::exit(8);
             }
             if (u.lhs.tag == RdObj::Empty) {
@@ -489,9 +653,8 @@ void prepareRedirection(const std::vector<RdUnit>& rdvec)
         }
         case RdTag::OutErr: {
             /// >& file
-			int fd = creat(u.rhs.fname.c_str(), CREATMODE);
+            int fd = openRdTarget(u);
             if (fd < 0) {
-                std::fprintf(stderr, "can't open %s for write\n", u.rhs.fname.c_str());
                 std::exit(9);
             }
             dup2Checked(fd, 1);
@@ -515,91 +678,6 @@ void dup2Checked(int fd, int to)
     }
 }
 
-void doBuiltinCmd(Exec* node)
-{
-    auto& argv = node->argv;
-    if (!strcmp(argv[0], "cd")) {
-		if (argv.size() == 2) {
-			argv.back() = strdup(getenv("HOME"));
-			argv.push_back(nullptr);
-		}
-		
-        if (argv.size() != 3) {
-            std::fprintf(stderr, "sltsh: cd: wrong number of arguments\n");
-            return;
-        }
-
-        if (chdir(argv[1]) < 0) {
-            std::perror("sltsh: cd error");
-            return;
-        }
-    } else if (!strcmp(argv[0], "exit")) {
-        if (argv.size() != 2) {
-            std::fprintf(stderr, "sltsh: exit: wrong number of arguments\n");
-        } else
-			std::exit(0);
-    } else if (!strcmp(argv[0], "bg")) {
-		if (argv.size() - 1 != 2) {
-			std::fprintf(stderr, "sltsh: bg: usage: bg <jobid>\n");
-			return;
-		}
-		char* endptr;
-		long jid = std::strtol(argv[1], &endptr, 10);
-		if (*endptr != '\0' || endptr == argv[1] || errno == ERANGE) {
-			std::fprintf(stderr, "sltsh: bg: invalid argument");
-			return;
-		}
-
-		doBg(jid);
-		
-    } else if (!strcmp(argv[0], "fg")) {
-		if (argv.size() - 1 != 2) {
-			std::fprintf(stderr, "sltsh: fg: usage: bg <jobid>\n");
-			return;
-		}
-		char* endptr;
-		long jid = std::strtol(argv[1], &endptr, 10);
-		if (*endptr != '\0' || endptr == argv[1] || errno == ERANGE) {
-			std::fprintf(stderr, "sltsh: fg: invalid argument");
-			return;
-		}
-
-		doFg(jid);
-		
-    } else if (!strcmp(argv[0], "jobs")){
-		if (argv.size() - 1 != 1) {
-			std::fprintf(stderr, "sltsh: jobs: wrong number of arguments\n");
-			return;
-		}
-		for (auto& kv: getContext().jobMap) {
-			std::fprintf(stderr, "[%ld] %s\t%s\n",
-					kv.first, strJobStatus[(int)kv.second.stat], kv.second.jobCmd.c_str());
-		}
-    } else {
-        assert(!strcmp(argv[0], "umask"));
-		if (argv.size() - 1 == 1) {
-			auto oldmask = umask(0);
-			umask(oldmask);
-			std::printf("%04o\n", oldmask);
-		} else if (argv.size() - 1 == 2) {
-			char* endptr;
-			auto mask = std::strtol(argv[1], &endptr, 8);
-			if (*endptr != '\0') {
-				std::fprintf(stderr, "sltsh: umask: wrong argument type\n");
-				return;
-			}
-			if (mask > 0777 || mask < 0) {
-				std::fprintf(stderr, "sltsh: umask: invalid range");
-				return;
-			}
-
-			umask(mask);	
-		} else {
-			std::fprintf(stderr, "sltsh: umask: wrong number of arguments\n");
-		}
-    }
-}
-
 void becomeTtyFgPgrp()
 {
     SigHandler old = setSignalHandler(SIGTTOU, SIG_IGN);
@@ -617,13 +695,6 @@ void becomeTtyFgPgrp()
     }
 }
 
-template<typename T>
-static inline auto toUInt(T t)
-{
-	return static_cast<typename std::underlying_type<T>::type>(t);
-}
-extern JobStatus resultTable[3][3];
-
 void doBg(int jid)
 {
 	auto& jobMap = getContext().jobMap;
@@ -634,21 +705,13 @@ void doBg(int jid)
 	}
 	auto& job = iter->second;
 	if (job.stat == JobStatus::Stopped) {
-		if (job.nproc == 1) {
-			kill(job.pid[0], SIGCONT);
-			job.statInd[0] = ProcStatus::Running;
-			job.stat = JobStatus::Running;
-		} else {
-			assert(job.nproc == 2);
-			kill(-job.pid[0], SIGCONT);
-			if (job.statInd[0] == ProcStatus::Stopped) {
-				job.statInd[0] = ProcStatus::Running;
-			}
-			if (job.statInd[1] == ProcStatus::Stopped) {
-				job.statInd[1] = ProcStatus::Running;
+		kill(-job.pgid(), SIGCONT);
+		for (auto& st : job.statInd) {
+			if (st == ProcStatus::Stopped) {
+				st = ProcStatus::Running;
 			}
-			job.stat = resultTable[toUInt(job.statInd[0])][toUInt(job.statInd[1])];
 		}
+		job.stat = job.foldStatus();
 		std::fprintf(stderr, "[%d] Continued\n", jid);
 	} else {
 		assert(false);
@@ -657,9 +720,6 @@ void doBg(int jid)
 
 void doFg(int jid)
 {
-	SignalBlockGuard guard(SIGCHLD);
-	// enable the guard early to avoid race condition
-	
 	auto& jobMap = getContext().jobMap;
 	auto iter = jobMap.find(jid);
 	if (iter == jobMap.end()) {
@@ -669,6 +729,11 @@ void doFg(int jid)
 	auto& job = iter->second;
 	if (job.stat == JobStatus::Stopped
 		|| job.stat == JobStatus::Running) {
+		// hand over the terminal before the job gets to touch it
+		if (tcsetpgrp(STDIN_FILENO, job.pgid()) < 0) {
+			std::perror("tcsetpgrp error");
+			std::exit(3);
+		}
 		for (int i = 0; i < job.nproc; ++i) {
 			if (job.statInd[i] == ProcStatus::Stopped) {
 				kill(job.pid[i], SIGCONT);
@@ -676,105 +741,139 @@ void doFg(int jid)
 			}
 		}
 
-		job.stat = resultTable[(int)job.statInd[0]][(int)job.statInd[1]];
-		if (job.nproc == 1) {
-			stopAndWait(job.pid[0]);
-		} else {
-			assert(job.nproc == 2);
-			stopAndWait(-job.pid[0]);
-			stopAndWait(-job.pid[0]);
+		job.stat = job.foldStatus();
+		waitFgJob(jid);
+	}
+}
+
+/// a memfd in the shell's fd range, for the output of in-process
+/// substitutions
+int openSink()
+{
+	int fd = memfd_create("sltsh-sink", MFD_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	int high = fcntl(fd, F_DUPFD_CLOEXEC, SHELL_FD_BASE);
+	close(fd);
+	return high;
+}
+
+/// $(...) of pure builtins: run them in the shell with fd 1 pointed at
+/// a memfd, so there is no child to fork. false if the sink failed
+bool captureInProcess(NodeBase* node, Capture& out)
+{
+	// kept across substitutions and emptied after each; one made only
+	// by a substitution nested in another
+	static int sharedSink = -1;
+	static bool busy = false;
+	int sink;
+	if (busy) {
+		sink = openSink();
+	} else {
+		if (sharedSink < 0) {
+			sharedSink = openSink();
 		}
+		sink = sharedSink;
 	}
-	
-	// if (job.stat == JobStatus::Stopped) {
-	// 	if (job.nproc == 1) {
-	// 		job.statInd[0] = ProcStatus::Running;
-	// 		job.stat = JobStatus::Running;
-	// 		kill(job.pid[0], SIGCONT);
-	// 		stopAndWait(job.pid[0]);
-	// 	} else {
-	// 		// must be pipe
-	// 		assert(job.nproc == 2);
-	// 		kill(-job.pid[0], SIGCONT);
-	// 		if (job.statInd[0] == ProcStatus::Stopped) {
-	// 			job.statInd[0] = ProcStatus::Running;
-	// 		}
-	// 		if (job.statInd[1] == ProcStatus::Stopped) {
-	// 			job.statInd[1] = ProcStatus::Running;
-	// 		}
-	// 		job.stat = resultTable[(int)job.statInd[0]][(int)job.statInd[1]];
-
-	// 		stopAndWait(-job.pid[0]);
-	// 		stopAndWait(-job.pid[0]);
-	// 	}
-
-		
-		
-	// } else if (job.stat == JobStatus::Running) {
-	// 	// the job must be running background
-	// 	for (int i = 0; i < job.nproc; ++i) {
-	// 		if (job.statInd[i] == ProStatus::Stopped) {
-	// 			kill(job.pid[i], SIGCONT);
-	// 			job.statInd[i] = ProcStatus::Running;
-	// 		}
-	// 	}
-	// 	job.stat = resultTable[(int)job.statInd[0]][(int)job.statInd[1]];
-	// 	if (job.nproc == 1) {
-	// 		stopAndWait(job.pid[0]);
-	// 	} else {
-	// 		assert(job.nproc == 2);
-	// 		stopAndWait(-job.pid[0]);
-	// 		stopAndWait(-job.pid[0]);
-	// 	}
-	// } else {
-	// 	assert(false);
-	// }
+	if (sink < 0) {
+		return false;
+	}
+
+	bool nested = busy;
+	busy = true;
+	auto& ctx = getContext();
+	// a substitution does not change $? of the shell
+	int status = ctx.lastExitStatus;
+	{
+		RedirectScope scope;
+		RdUnits toSink;
+		toSink.emplace_back(RdTag::OutDup, RdObj(1), RdObj(sink));
+		if (scope.apply(toSink)) {
+			Executor executor;
+			node->accept(&executor);
+		}
+	}
+	ctx.lastExitStatus = status;
+
+	bool ok = lseek(sink, 0, SEEK_SET) == 0 && out.drain(sink);
+	if (nested) {
+		close(sink);
+	} else {
+		// the offset is shared with the fd 1 of the next run
+		ftruncate(sink, 0);
+		lseek(sink, 0, SEEK_SET);
+		busy = false;
+	}
+	return ok;
+}
+
+bool captureCmdOutput(std::unique_ptr<NodeBase>& node, Capture& out)
+{
+	if (node->stateFree()) {
+		if (captureInProcess(node.get(), out)) {
+			return true;
+		}
+		std::perror("sltsh: capture error");
+		return false;
+	}
+
+	int rfd;
+	pid_t pid = startCmdOutput(node, &rfd);
+	bool ok = out.drain(rfd);
+	if (!ok) {
+		std::perror("sltsh: capture error");
+	}
+	// a child still writing gets SIGPIPE if the capture gave up
+	close(rfd);
+	waitpid(pid, nullptr, 0);
+	return ok;
 }
 
-std::string strCmdOutput(std::unique_ptr<NodeBase>& node)
+/// fork a child running node with its fd `to` (0 or 1) on a pipe, and
+/// return the shell's end of the pipe in ours
+pid_t startPiped(std::unique_ptr<NodeBase>& node, int to, int* ours)
 {
 	Executor executor;
 	int fd[2];
-	if (pipe(fd) < 0) {
+	// close-on-exec: children of sibling substitutions must not
+	// inherit each other's pipe ends
+	if (pipe2(fd, O_CLOEXEC) < 0) {
 		std::fprintf(stderr, "pipe error while expanding");
 		std::exit(1);
 	}
+	int theirs = to == 1 ? fd[1] : fd[0];
+	*ours = to == 1 ? fd[0] : fd[1];
 
-	SignalBlockGuard guard(SIGCHLD);
 	pid_t pid = fork();
 	if (pid == 0) {
-		close(fd[0]);
-		dup2Checked(fd[1], 1);
-		close(fd[1]);
+		// jobs started from here belong to the substituted command
+		getContext().currentLine = std::make_shared<CmdLine>(std::move(node));
+		auto& root = getContext().currentLine->root;
+		close(*ours);
+		dup2Checked(theirs, to);
+		close(theirs);
 
-		guard.unblock();
-		restoreSignals();
+		initForkedChild();
 
-		node->accept(&executor);
+		executor.tail = true;
+		root->accept(&executor);
 		// if reaches here
 		std::exit(getContext().lastExitStatus);
-		
-	} else if (pid > 0) {
-		std::string ret;
-		
-		close(fd[1]);
-		constexpr std::size_t bufsz = 512;
-		char buf[bufsz];
-		ssize_t n;
-		while ((n = read(fd[0], buf, bufsz)) > 0) {
-			ret.append(buf, buf + n);
-		}
-		if (n < 0) {
-			std::perror("read error while expanding");
-			std::exit(1);
-		}
-		
-		close(fd[0]);	
-		waitpid(pid, nullptr, 0);
-
-		return ret;
-	} else {
+	} else if (pid < 0) {
 		std::perror("fork error while expanding");
 		std::exit(1);
 	}
+	close(theirs);
+	return pid;
+}
+
+pid_t startCmdOutput(std::unique_ptr<NodeBase>& node, int* rfd)
+{
+	return startPiped(node, 1, rfd);
+}
+
+pid_t startCmdInput(std::unique_ptr<NodeBase>& node, int* wfd)
+{
+	return startPiped(node, 0, wfd);
 }
@@ -1,16 +1,17 @@
 #include <iostream>
-#include "expand.h"
+#include "parse.h"
 
+// expansion happens while parsing, so compare the parsed line
 void test(const std::string& before, const std::string& after, int linum)
 {
-	using RT = std::pair<std::string, ExpandError>;
-	RT res = expand(before);
-	if (res.second == ExpandError::Ok) {
-		if (res.first != after) {
+	auto res = parseCmdLine(before.c_str());
+	if (res.second == ParseErr::Ok) {
+		auto got = res.first->toString();
+		if (got != after) {
 			std::cout << "In line " << linum << ":\n"
 					  << "original:\t" << before
 					  << "\nwant:\t" << after
-					  << "\ngot:\t" << res.first << "\n";
+					  << "\ngot:\t" << got << "\n";
 		} else {
 			std::cout << "Line " << linum << " is ok\n";
 		}
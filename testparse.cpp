@@ -1,22 +1,16 @@
 #include <cstdio>
 #include <iostream>
 #include "parse.h"
-#include "expand.h"
 
 void printAst__(const std::string& txt, int lineno)
 {
     using namespace std;
     cout << "line " << lineno << ":\n";
-    auto expres = expand(txt);
-    if (expres.second != ExpandError::Ok) {
-        cout << "expand error\n";
+    auto parseres = parseCmdLine(txt.c_str());
+    if (parseres.second != ParseErr::Ok) {
+        cout << "parse error: " << (int)parseres.second << endl;
     } else {
-        auto parseres = parseCmdLine(expres.first.c_str());
-        if (parseres.second != ParseErr::Ok) {
-            cout << "parse error: " << (int)parseres.second << endl;
-        } else {
-            cout << parseres.first->toString() << endl;
-        }
+        cout << parseres.first->toString() << endl;
     }
 }
 
@@ -0,0 +1,97 @@
+// how often a $(...) runs: once each time the lexer meets it, whether
+// the line's batch started it early or not. a word with braces is lexed
+// once per variant, so its $(...) run once per variant and no more.
+// every case goes through ./sltsh; exits 1 on the first that is off
+// usage: testsubst
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+namespace
+{
+
+struct Case
+{
+	/// the script, RUN standing for a $(...) that counts its runs
+	const char* script;
+	const char* out;
+	int runs;
+};
+
+const Case cases[] = {
+	{ "echo RUN", "X\n", 1 },
+	{ "echo {a,b}RUN", "aX bX\n", 2 },
+	{ "echo RUN{1..3}", "X1 X2 X3\n", 3 },
+	{ "echo {a,b}\"RUN\"", "aX bX\n", 2 },
+	{ "echo {a,b}RUN RUN", "aX bX X\n", 3 },
+	{ "echo {a}RUN", "{a}X\n", 1 },
+	{ "echo ${HOME+}RUN", "X\n", 1 },
+	// a line is lexed before it runs: $A on the next one
+	{ "A=RUN{a,b}\necho $A", "X{a,b}\n", 1 },
+	{ "echo '{a,b}'RUN", "{a,b}X\n", 1 },
+	// the second line is the line cache's
+	{ "echo {a,b}RUN\necho {a,b}RUN", "aX bX\naX bX\n", 4 },
+};
+
+std::string replaceRun(std::string s, const std::string& with)
+{
+	for (std::size_t at; (at = s.find("RUN")) != std::string::npos; ) {
+		s.replace(at, 3, with);
+	}
+	return s;
+}
+
+int countLines(const std::string& path)
+{
+	FILE* f = std::fopen(path.c_str(), "r");
+	if (!f)
+		return 0;
+	int n = 0;
+	for (int c; (c = std::fgetc(f)) != EOF; )
+		n += c == '\n';
+	std::fclose(f);
+	return n;
+}
+
+}
+
+int main()
+{
+	std::string dir = "/tmp/testsubst." + std::to_string(getpid());
+	std::string counter = dir + ".runs";
+	std::string script = dir + ".sh";
+	std::string run = "$(/bin/sh -c \"echo >> " + counter + "; echo X\")";
+
+	int failed = 0;
+	for (const Case& c : cases) {
+		std::remove(counter.c_str());
+		FILE* f = std::fopen(script.c_str(), "w");
+		if (!f) {
+			std::perror("testsubst: script");
+			return 1;
+		}
+		std::fprintf(f, "%s\n", replaceRun(c.script, run).c_str());
+		std::fclose(f);
+
+		std::string cmd = "./sltsh " + script;
+		FILE* p = popen(cmd.c_str(), "r");
+		std::string out;
+		char buf[256];
+		for (std::size_t n; (n = std::fread(buf, 1, sizeof(buf), p)) > 0; )
+			out.append(buf, n);
+		pclose(p);
+
+		int runs = countLines(counter);
+		if (out != c.out || runs != c.runs) {
+			std::printf("testsubst: %s\n  gave %s  ran %d times, want %s  %d times\n",
+						c.script, out.c_str(), runs, c.out, c.runs);
+			failed = 1;
+		}
+	}
+	std::remove(counter.c_str());
+	std::remove(script.c_str());
+	if (!failed)
+		std::printf("testsubst: %zu cases ok\n", sizeof(cases) / sizeof(cases[0]));
+	return failed;
+}
@@ -0,0 +1,102 @@
+// VarStore against a std::map doing the same random set, unset and
+// export calls: every lookup, the exported list and the envp have to
+// agree after each step. exits 1 on the first mismatch.
+// usage: testvars [iterations]
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include "vars.h"
+
+namespace
+{
+
+struct Want
+{
+	std::string value;
+	bool exported = false;
+};
+
+int fail(long iter, const std::string& what)
+{
+	std::printf("mismatch at iter %ld: %s\n", iter, what.c_str());
+	return 1;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	long iters = argc > 1 ? std::atol(argv[1]) : 200000;
+	VarStore store;
+	std::map<std::string, Want> want;
+	std::mt19937 rng(1);
+	// few enough names that sets, unsets and reuses of slots mix
+	constexpr int NAMES = 64;
+
+	for (long iter = 0; iter < iters; ++iter) {
+		std::string name = "V" + std::to_string(rng() % NAMES);
+		switch (rng() % 4) {
+		case 0:
+		case 1: {
+			std::string value = std::to_string(iter);
+			store.set(name, value);
+			want[name].value = value;
+			break;
+		}
+		case 2:
+			store.unset(name);
+			want.erase(name);
+			break;
+		default:
+			store.exportVar(name);
+			want[name].exported = true;
+			break;
+		}
+
+		for (int k = 0; k < NAMES; ++k) {
+			std::string n = "V" + std::to_string(k);
+			const std::string* got = store.get(n);
+			auto it = want.find(n);
+			if ((got == nullptr) != (it == want.end())) {
+				return fail(iter, "for " + n + ": got " + (got ? *got : "null")
+							+ " want " + (it == want.end() ? "null" : it->second.value));
+			}
+			if (got && *got != it->second.value) {
+				return fail(iter, "for " + n + ": got " + *got + " want " + it->second.value);
+			}
+		}
+
+		// the exported list is sorted by name, as the map is
+		std::string env;
+		for (auto& kv : want) {
+			if (kv.second.exported)
+				env += kv.first + "=" + kv.second.value + "\n";
+		}
+		std::string listed;
+		for (auto v : store.exported()) {
+			listed += v->name + "=" + v->value + "\n";
+		}
+		if (listed != env) {
+			return fail(iter, "exported list\n" + listed + "want\n" + env);
+		}
+		// envp is in store order; compare it as a set
+		std::map<std::string, int> envp;
+		auto block = store.environment();
+		for (char* const* e = block->envp.data(); *e; ++e) {
+			++envp[*e];
+		}
+		std::map<std::string, int> wantEnvp;
+		for (auto& kv : want) {
+			if (kv.second.exported)
+				++wantEnvp[kv.first + "=" + kv.second.value];
+		}
+		if (envp != wantEnvp) {
+			return fail(iter, "envp");
+		}
+	}
+	std::printf("testvars: %ld iterations ok\n", iters);
+	return 0;
+}
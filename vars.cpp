@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include "vars.h"
+
+VarStore& getVarStore()
+{
+	static VarStore store;
+	return store;
+}
+
+namespace
+{
+
+uint32_t hashName(std::string_view name)
+{
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	for (char ch : name) {
+		h = (h ^ static_cast<unsigned char>(ch)) * 16777619u;
+	}
+	return h;
+}
+
+using Entry = std::pair<std::string_view, std::string_view>;
+
+std::shared_ptr<EnvBlock> build(const std::vector<Entry>& entries)
+{
+	auto block = std::make_shared<EnvBlock>();
+	std::size_t total = 0;
+	for (auto& e : entries) {
+		total += e.first.size() + e.second.size() + 2;
+	}
+	// sized once, so the pointers below stay valid
+	block->text.resize(total);
+	block->envp.reserve(entries.size() + 1);
+	char* p = block->text.data();
+	for (auto& e : entries) {
+		block->envp.push_back(p);
+		std::memcpy(p, e.first.data(), e.first.size());
+		p += e.first.size();
+		*p++ = '=';
+		std::memcpy(p, e.second.data(), e.second.size());
+		p += e.second.size();
+		*p++ = '\0';
+	}
+	block->envp.push_back(nullptr);
+	return block;
+}
+
+}
+
+void VarStore::import(char** env)
+{
+	for (; *env; ++env) {
+		const char* eq = std::strchr(*env, '=');
+		if (eq == nullptr)
+			continue;
+		Var& v = insert(std::string_view(*env, eq - *env));
+		v.value = eq + 1;
+		v.exported = true;
+	}
+	env_.reset();
+	++gen_;
+}
+
+std::size_t VarStore::probe(std::string_view name, uint32_t hash) const
+{
+	std::size_t mask = slots_.size() - 1;
+	std::size_t firstDeleted = slots_.size();
+	for (std::size_t i = hash & mask; ; i = (i + 1) & mask) {
+		int32_t s = slots_[i];
+		if (s == EMPTY) {
+			return firstDeleted < slots_.size() ? firstDeleted : i;
+		} else if (s == DELETED) {
+			firstDeleted = std::min(firstDeleted, i);
+		} else if (vars_[s].hash == hash && vars_[s].name == name) {
+			return i;
+		}
+	}
+}
+
+const VarStore::Var* VarStore::find(std::string_view name) const
+{
+	if (slots_.empty())
+		return nullptr;
+	int32_t s = slots_[probe(name, hashName(name))];
+	return s >= 0 ? &vars_[s] : nullptr;
+}
+
+const std::string* VarStore::get(std::string_view name) const
+{
+	auto v = find(name);
+	return v ? &v->value : nullptr;
+}
+
+VarStore::Var& VarStore::insert(std::string_view name)
+{
+	// a quarter of the slots stays empty, so a probe always ends
+	if ((vars_.size() + deleted_ + 1) * 4 > slots_.size() * 3) {
+		std::size_t cap = 16;
+		while (cap < (vars_.size() + 1) * 2) {
+			cap *= 2;
+		}
+		rehash(cap);
+	}
+	uint32_t hash = hashName(name);
+	std::size_t i = probe(name, hash);
+	if (slots_[i] >= 0) {
+		return vars_[slots_[i]];
+	}
+	if (slots_[i] == DELETED) {
+		--deleted_;
+	}
+	slots_[i] = static_cast<int32_t>(vars_.size());
+	vars_.push_back({std::string(name), std::string(), hash, false});
+	return vars_.back();
+}
+
+void VarStore::rehash(std::size_t cap)
+{
+	slots_.assign(cap, EMPTY);
+	deleted_ = 0;
+	std::size_t mask = cap - 1;
+	for (std::size_t idx = 0; idx < vars_.size(); ++idx) {
+		std::size_t i = vars_[idx].hash & mask;
+		while (slots_[i] != EMPTY) {
+			i = (i + 1) & mask;
+		}
+		slots_[i] = static_cast<int32_t>(idx);
+	}
+}
+
+void VarStore::changed(const Var& v)
+{
+	if (v.exported) {
+		env_.reset();
+		++gen_;
+	}
+}
+
+void VarStore::set(std::string_view name, std::string_view value)
+{
+	Var& v = insert(name);
+	if (v.value != value) {
+		v.value.assign(value.data(), value.size());
+		changed(v);
+	}
+}
+
+void VarStore::exportVar(std::string_view name)
+{
+	Var& v = insert(name);
+	if (!v.exported) {
+		v.exported = true;
+		changed(v);
+	}
+}
+
+void VarStore::unset(std::string_view name)
+{
+	if (slots_.empty())
+		return;
+	std::size_t i = probe(name, hashName(name));
+	int32_t idx = slots_[i];
+	if (idx < 0)
+		return;
+	slots_[i] = DELETED;
+	++deleted_;
+	changed(vars_[idx]);
+
+	// keep the array dense: the last variable takes the hole. its slot
+	// is found by its name before the move empties it
+	int32_t last = static_cast<int32_t>(vars_.size()) - 1;
+	if (idx != last) {
+		slots_[probe(vars_[last].name, vars_[last].hash)] = idx;
+		vars_[idx] = std::move(vars_[last]);
+	}
+	vars_.pop_back();
+}
+
+std::vector<const VarStore::Var*> VarStore::exported() const
+{
+	std::vector<const Var*> ret;
+	for (auto& v : vars_) {
+		if (v.exported)
+			ret.push_back(&v);
+	}
+	std::sort(ret.begin(), ret.end(), [](const Var* a, const Var* b) {
+		return a->name < b->name;
+	});
+	return ret;
+}
+
+std::shared_ptr<const EnvBlock> VarStore::environment()
+{
+	if (!env_) {
+		std::vector<Entry> entries;
+		for (auto& v : vars_) {
+			if (v.exported)
+				entries.emplace_back(v.name, v.value);
+		}
+		auto block = build(entries);
+		block->gen = gen_;
+		env_ = std::move(block);
+	}
+	return env_;
+}
+
+std::shared_ptr<const EnvBlock> VarStore::environment(const Assigns& extra)
+{
+	std::vector<Entry> entries;
+	for (auto& v : vars_) {
+		if (!v.exported)
+			continue;
+		bool overridden = std::any_of(extra.begin(), extra.end(),
+			[&](auto& a) { return a.first == v.name; });
+		if (!overridden)
+			entries.emplace_back(v.name, v.value);
+	}
+	for (auto a = extra.begin(); a != extra.end(); ++a) {
+		// A=1 A=2 cmd: the last one counts
+		bool again = std::any_of(a + 1, extra.end(),
+			[&](auto& b) { return b.first == a->first; });
+		if (!again)
+			entries.emplace_back(a->first, a->second);
+	}
+	return build(entries);
+}
+
+bool VarStore::validName(std::string_view name)
+{
+	if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0])))
+		return false;
+	return std::all_of(name.begin(), name.end(), [](char ch) {
+		return std::isalnum(static_cast<unsigned char>(ch)) || ch == '_';
+	});
+}
@@ -0,0 +1,80 @@
+#ifndef VARS_H__
+#define VARS_H__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/// an environment ready to be handed to execve(): NAME=value strings
+/// laid out in one block. never changed once built, so a spawn in
+/// progress can keep using it while the store moves on
+struct EnvBlock
+{
+	std::vector<char> text;
+	std::vector<char*> envp;
+	/// differs between any two blocks of one store, never 0
+	unsigned long gen = 0;
+};
+
+/// the shell's variables. an open-addressing table of indices into one
+/// dense array, so lookups touch two small arrays and listing walks one
+class VarStore
+{
+public:
+	using Assigns = std::vector<std::pair<std::string, std::string>>;
+
+	struct Var
+	{
+		std::string name;
+		std::string value;
+		uint32_t hash;
+		bool exported;
+	};
+
+	/// take over the process environment, every entry exported
+	void import(char** env);
+
+	/// nullptr when unset
+	const std::string* get(std::string_view name) const;
+	void set(std::string_view name, std::string_view value);
+	/// mark name exported, set to "" if it has no value yet
+	void exportVar(std::string_view name);
+	void unset(std::string_view name);
+
+	/// the exported variables, sorted by name
+	std::vector<const Var*> exported() const;
+
+	/// the exported variables as an envp. rebuilt only after an
+	/// exported variable changed; until then every call shares one block
+	std::shared_ptr<const EnvBlock> environment();
+	/// the environment with a command's own NAME=value prefixes on top.
+	/// built for the one command, gen 0
+	std::shared_ptr<const EnvBlock> environment(const Assigns& extra);
+
+	/// letters, digits and '_', not starting with a digit
+	static bool validName(std::string_view name);
+
+private:
+	static constexpr int32_t EMPTY = -1;
+	static constexpr int32_t DELETED = -2;
+
+	/// the slot holding name, or the slot to put it in when absent
+	std::size_t probe(std::string_view name, uint32_t hash) const;
+	const Var* find(std::string_view name) const;
+	Var& insert(std::string_view name);
+	void rehash(std::size_t cap);
+	void changed(const Var& v);
+
+	std::vector<int32_t> slots_;
+	std::vector<Var> vars_;
+	std::size_t deleted_ = 0;
+	std::shared_ptr<const EnvBlock> env_;
+	unsigned long gen_ = 1;
+};
+
+VarStore& getVarStore();
+
+#endif
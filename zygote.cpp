@@ -0,0 +1,540 @@
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "arena.h"
+#include "zygote.h"
+#include "redirect.h"
+
+Zygote& getZygote()
+{
+	static Zygote zygote;
+	return zygote;
+}
+
+namespace
+{
+
+/// one request is one datagram: the header, then path, cwd and the
+/// argv strings, then the redirections. in and out travel as SCM_RIGHTS.
+/// an Env request carries argc NAME=value strings that later spawns
+/// with useEnv get as their environment
+struct ReqHeader
+{
+	enum : int32_t { Spawn, Release, Env } kind;
+	/// leave children unreaped until the next request without it
+	int32_t hold;
+	int32_t pgid;
+	uint32_t umask;
+	uint32_t argc;
+	uint32_t nrd;
+	int32_t hasIn;
+	int32_t hasOut;
+	int32_t useEnv;
+};
+
+struct RdHeader
+{
+	int32_t tag;
+	int32_t lhsTag;
+	int32_t lhsFd;
+	int32_t rhsTag;
+	int32_t rhsFd;
+};
+
+/// what the helper sends back: the answer to a request, or a status
+/// of one of its children whenever waitpid has one
+struct Reply
+{
+	enum : int32_t { Started, Status } kind;
+	int32_t pid;
+	int32_t value;	// Started: 0 or an errno, Status: the wait status
+};
+
+/// bigger command lines and environments are spawned by the shell itself
+constexpr std::size_t MAX_REQUEST = 64 * 1024;
+
+template<typename T>
+void putPod(std::vector<char>& buf, const T& v)
+{
+	const char* p = reinterpret_cast<const char*>(&v);
+	buf.insert(buf.end(), p, p + sizeof(v));
+}
+
+void putStr(std::vector<char>& buf, const char* s)
+{
+	buf.insert(buf.end(), s, s + std::strlen(s) + 1);
+}
+
+/// walks a received request. every get fails once the datagram is
+/// used up, so a malformed request can't read past it
+class Reader
+{
+public:
+	Reader(char* p, std::size_t n) : p_(p), end_(p + n) {}
+
+	template<typename T>
+	bool getPod(T* v) {
+		if (std::size_t(end_ - p_) < sizeof(T))
+			return false;
+		std::memcpy(v, p_, sizeof(T));
+		p_ += sizeof(T);
+		return true;
+	}
+
+	char* getStr() {
+		char* s = p_;
+		char* nul = static_cast<char*>(std::memchr(p_, '\0', end_ - p_));
+		if (nul == nullptr)
+			return nullptr;
+		p_ = nul + 1;
+		return s;
+	}
+
+private:
+	char* p_;
+	char* end_;
+};
+
+/// fds the user can't name in a redirection
+int moveHigh(int fd)
+{
+	int high = fcntl(fd, F_DUPFD_CLOEXEC, SHELL_FD_BASE);
+	close(fd);
+	return high;
+}
+
+void sendReply(int sock, int32_t kind, pid_t pid, int value)
+{
+	Reply r;
+	r.kind = static_cast<decltype(r.kind)>(kind);
+	r.pid = pid;
+	r.value = value;
+	while (send(sock, &r, sizeof(r), MSG_NOSIGNAL) < 0) {
+		if (errno != EINTR)
+			_exit(0);
+	}
+}
+
+/// start the command a request describes. returns what spawnProcess()
+/// returns
+int handle(Reader& in, const ReqHeader& h, const int* fds, int nfd,
+		   const sigset_t* childMask, std::string& cwd,
+		   std::vector<char*>& env, pid_t* pid)
+{
+	if (nfd != h.hasIn + h.hasOut)
+		return EINVAL;
+	const char* path = in.getStr();
+	const char* dir = in.getStr();
+	if (path == nullptr || dir == nullptr)
+		return EINVAL;
+	std::vector<char*> argv;
+	for (uint32_t i = 0; i < h.argc; ++i) {
+		char* s = in.getStr();
+		if (s == nullptr)
+			return EINVAL;
+		argv.push_back(s);
+	}
+	argv.push_back(nullptr);
+
+	// the units are gone by the next request: their arena starts over
+	static Arena scratch;
+	scratch.reset();
+	RdUnits rdUnits{ArenaAllocator<RdUnit>(scratch)};
+	for (uint32_t i = 0; i < h.nrd; ++i) {
+		RdHeader rh;
+		char* lhsName;
+		char* rhsName;
+		if (!in.getPod(&rh) || !(lhsName = in.getStr()) || !(rhsName = in.getStr()))
+			return EINVAL;
+		auto obj = [](int32_t tag, int32_t fd, char* name) {
+			switch (tag) {
+			case RdObj::FN: return RdObj(std::string(name));
+			case RdObj::Text: return RdObj::text(name);
+			case RdObj::FD: return RdObj(int(fd));
+			default:		return RdObj();
+			}
+		};
+		rdUnits.emplace_back(static_cast<RdTag>(rh.tag),
+							 obj(rh.lhsTag, rh.lhsFd, lhsName),
+							 obj(rh.rhsTag, rh.rhsFd, rhsName));
+	}
+
+	// relative redirection targets and the child's cwd come from here
+	if (cwd != dir) {
+		if (chdir(dir) < 0)
+			return errno;
+		cwd = dir;
+	}
+	umask(h.umask);
+
+	SpawnSpec spec;
+	spec.path = path;
+	spec.argv = argv.data();
+	spec.rdUnits = &rdUnits;
+	spec.pgid = h.pgid;
+	spec.sigmask = childMask;
+	spec.in = h.hasIn ? fds[0] : -1;
+	spec.out = h.hasOut ? fds[h.hasIn] : -1;
+	spec.envp = h.useEnv && !env.empty() ? env.data() : nullptr;
+	return spawnProcess(spec, pid);
+}
+
+/// keep the environment of an Env request for the spawns to come
+void takeEnv(Reader& in, const ReqHeader& h, std::vector<char>& text,
+			 std::vector<char*>& env)
+{
+	env.clear();
+	std::vector<std::size_t> offs;
+	text.clear();
+	for (uint32_t i = 0; i < h.argc; ++i) {
+		char* s = in.getStr();
+		if (s == nullptr)
+			break;
+		offs.push_back(text.size());
+		text.insert(text.end(), s, s + std::strlen(s) + 1);
+	}
+	for (std::size_t off : offs) {
+		env.push_back(text.data() + off);
+	}
+	env.push_back(nullptr);
+}
+
+[[noreturn]] void serve(int sock, sigset_t childMask)
+{
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &set, nullptr);
+	int sigfd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (sigfd < 0)
+		_exit(1);
+
+	struct pollfd pfd[2] = { { sock, POLLIN, 0 }, { sigfd, POLLIN, 0 } };
+	std::vector<char> buf(MAX_REQUEST);
+	std::string cwd;
+	std::vector<char> envText;
+	std::vector<char*> env;
+	bool holding = false;
+	for (;;) {
+		pfd[1].events = holding ? 0 : POLLIN;
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			_exit(1);
+		}
+
+		if (pfd[1].revents & POLLIN) {
+			struct signalfd_siginfo info[16];
+			while (read(sigfd, info, sizeof(info)) > 0)
+				;
+			int statloc;
+			pid_t pid;
+			while ((pid = waitpid(-1, &statloc, WUNTRACED | WNOHANG)) > 0) {
+				sendReply(sock, Reply::Status, pid, statloc);
+			}
+		}
+
+		if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+			union {
+				struct cmsghdr hdr;
+				char space[CMSG_SPACE(2 * sizeof(int))];
+			} ctl;
+			struct iovec iov = { buf.data(), buf.size() };
+			struct msghdr msg = {};
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = ctl.space;
+			msg.msg_controllen = sizeof(ctl.space);
+			ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				_exit(0);	// the shell is gone
+
+			int fds[2];
+			int nfd = 0;
+			for (auto c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+				if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+					int cnt = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+					for (int i = 0; i < cnt; ++i) {
+						int fd;
+						std::memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+						if (nfd < 2)
+							fds[nfd++] = moveHigh(fd);
+						else
+							close(fd);
+					}
+				}
+			}
+
+			pid_t pid = -1;
+			int err;
+			Reader in(buf.data(), n);
+			ReqHeader h = {};
+			if (!in.getPod(&h)) {
+				err = EINVAL;
+			} else if (h.kind == ReqHeader::Release) {
+				holding = false;
+				continue;
+			} else if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+				err = E2BIG;
+			} else if (h.kind == ReqHeader::Env) {
+				// no reply: the spawn that follows gets one
+				takeEnv(in, h, envText, env);
+				for (int i = 0; i < nfd; ++i) {
+					close(fds[i]);
+				}
+				continue;
+			} else {
+				err = handle(in, h, fds, nfd, &childMask, cwd, env, &pid);
+			}
+			holding = h.hold;
+			for (int i = 0; i < nfd; ++i) {
+				close(fds[i]);
+			}
+			sendReply(sock, Reply::Started, pid, err);
+		}
+	}
+}
+
+} // end anonymous namespace
+
+bool Zygote::start(const sigset_t* childMask, StatusFn onStatus)
+{
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+		return false;
+	}
+	// keep the socket out of reach of 2>&3 and the like
+	sv[0] = moveHigh(sv[0]);
+	sv[1] = moveHigh(sv[1]);
+	if (sv[0] < 0 || sv[1] < 0) {
+		close(sv[0]);
+		close(sv[1]);
+		return false;
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		close(sv[0]);
+		close(sv[1]);
+		return false;
+	} else if (pid == 0) {
+		close(sv[0]);
+		serve(sv[1], *childMask);
+	}
+	close(sv[1]);
+	sock_ = sv[0];
+	pid_ = pid;
+	onStatus_ = onStatus;
+	return true;
+}
+
+void Zygote::stop()
+{
+	// the helper exits when it reads EOF. statuses already received
+	// are still handed out by drain()
+	if (sock_ >= 0) {
+		close(sock_);
+		sock_ = -1;
+	}
+	pid_ = -1;
+	envGen_ = 0;
+}
+
+void Zygote::detach()
+{
+	stop();
+	pending_.clear();
+}
+
+int Zygote::spawn(const SpawnSpec& spec, pid_t* pid)
+{
+	// the request only carries stdin and stdout, and fds sent over
+	// would not keep their numbers
+	if (!running() || spec.err >= 0 || (spec.keepFds && !spec.keepFds->empty())) {
+		return spawnProcess(spec, pid);
+	}
+
+	char cwd[PATH_MAX];
+	if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+		return spawnProcess(spec, pid);
+	}
+	mode_t mask = umask(0);
+	umask(mask);
+
+	if (spec.envp && (spec.envGen == 0 || spec.envGen != envGen_)) {
+		// one-off environments are not worth a round of their own
+		if (spec.envGen == 0 || !sendEnv(spec.envp)) {
+			return spawnProcess(spec, pid);
+		}
+		envGen_ = spec.envGen;
+	}
+
+	ReqHeader h;
+	h.kind = ReqHeader::Spawn;
+	h.hold = hold_;
+	h.pgid = spec.pgid;
+	h.umask = mask;
+	h.argc = 0;
+	while (spec.argv[h.argc]) {
+		++h.argc;
+	}
+	h.nrd = spec.rdUnits ? spec.rdUnits->size() : 0;
+	h.hasIn = spec.in >= 0;
+	h.hasOut = spec.out >= 0;
+	h.useEnv = spec.envp != nullptr;
+
+	buf_.clear();
+	putPod(buf_, h);
+	putStr(buf_, spec.path);
+	putStr(buf_, cwd);
+	for (uint32_t i = 0; i < h.argc; ++i) {
+		putStr(buf_, spec.argv[i]);
+	}
+	for (uint32_t i = 0; i < h.nrd; ++i) {
+		auto& u = (*spec.rdUnits)[i];
+		RdHeader rh = { int32_t(u.rdTag), u.lhs.tag, u.lhs.fd, u.rhs.tag, u.rhs.fd };
+		putPod(buf_, rh);
+		putStr(buf_, u.lhs.fname.c_str());
+		putStr(buf_, u.rhs.fname.c_str());
+	}
+	if (buf_.size() > MAX_REQUEST) {
+		return spawnProcess(spec, pid);
+	}
+
+	union {
+		struct cmsghdr hdr;
+		char space[CMSG_SPACE(2 * sizeof(int))];
+	} ctl;
+	int fds[2];
+	int nfd = 0;
+	if (spec.in >= 0)
+		fds[nfd++] = spec.in;
+	if (spec.out >= 0)
+		fds[nfd++] = spec.out;
+
+	struct iovec iov = { buf_.data(), buf_.size() };
+	struct msghdr msg = {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (nfd > 0) {
+		msg.msg_control = ctl.space;
+		msg.msg_controllen = CMSG_SPACE(nfd * sizeof(int));
+		auto c = CMSG_FIRSTHDR(&msg);
+		c->cmsg_level = SOL_SOCKET;
+		c->cmsg_type = SCM_RIGHTS;
+		c->cmsg_len = CMSG_LEN(nfd * sizeof(int));
+		std::memcpy(CMSG_DATA(c), fds, nfd * sizeof(int));
+	}
+
+	ssize_t n;
+	while ((n = sendmsg(sock_, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+		;
+	if (n < 0) {
+		// the helper is gone: carry on without it
+		stop();
+		return spawnProcess(spec, pid);
+	}
+
+	heldSent_ = heldSent_ || hold_;
+	int err;
+	if (!recvReply(pid, &err)) {
+		stop();
+		return EIO;
+	}
+	return err;
+}
+
+bool Zygote::sendEnv(char* const* envp)
+{
+	ReqHeader h = {};
+	h.kind = ReqHeader::Env;
+	while (envp[h.argc]) {
+		++h.argc;
+	}
+	buf_.clear();
+	putPod(buf_, h);
+	for (uint32_t i = 0; i < h.argc; ++i) {
+		putStr(buf_, envp[i]);
+	}
+	if (buf_.size() > MAX_REQUEST) {
+		return false;
+	}
+	if (send(sock_, buf_.data(), buf_.size(), MSG_NOSIGNAL) < 0) {
+		stop();
+		return false;
+	}
+	return true;
+}
+
+void Zygote::release()
+{
+	bool sent = heldSent_;
+	hold_ = heldSent_ = false;
+	if (sent && running()) {
+		ReqHeader h = {};
+		h.kind = ReqHeader::Release;
+		if (send(sock_, &h, sizeof(h), MSG_NOSIGNAL) < 0) {
+			stop();
+		}
+	}
+}
+
+bool Zygote::recvReply(pid_t* pid, int* err)
+{
+	for (;;) {
+		Reply r;
+		ssize_t n = recv(sock_, &r, sizeof(r), 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n != sizeof(r))
+			return false;
+		if (r.kind == Reply::Started) {
+			*pid = r.pid;
+			*err = r.value;
+			return true;
+		}
+		// the job it belongs to may not be known yet
+		pending_.emplace_back(r.pid, r.value);
+	}
+}
+
+void Zygote::drain()
+{
+	if (!pending_.empty()) {
+		auto pending = std::move(pending_);
+		pending_.clear();
+		for (auto& st : pending) {
+			onStatus_(st.first, st.second);
+		}
+	}
+	while (running()) {
+		Reply r;
+		ssize_t n = recv(sock_, &r, sizeof(r), MSG_DONTWAIT);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				stop();
+			return;
+		}
+		if (n != sizeof(r)) {
+			stop();
+			return;
+		}
+		if (r.kind == Reply::Status) {
+			onStatus_(r.pid, r.value);
+		}
+	}
+}
@@ -0,0 +1,70 @@
+#ifndef ZYGOTE_H__
+#define ZYGOTE_H__
+
+#include <vector>
+#include <utility>
+#include <signal.h>
+#include <sys/types.h>
+#include "launch.h"
+
+/// a helper forked while the shell is still small. it spawns commands
+/// on the shell's behalf and sends back their pids and wait statuses
+/// over a socketpair, so launching costs the same however big the shell
+/// has grown. opt-in: the shell starts one when SLTSH_ZYGOTE is set
+class Zygote
+{
+public:
+	using StatusFn = void (*)(pid_t pid, int statloc);
+
+	Zygote() = default;
+	Zygote(const Zygote&) = delete;
+	~Zygote() { stop(); }
+
+	/// fork the helper. childMask is the signal mask commands start
+	/// with, onStatus receives what waitpid told the helper.
+	/// false if no helper could be started
+	bool start(const sigset_t* childMask, StatusFn onStatus);
+	void stop();
+
+	bool running() const { return sock_ >= 0; }
+	/// readable when statuses are waiting, for the event loop
+	int fd() const { return sock_; }
+
+	/// same contract as spawnProcess(). spec.sigmask is ignored: the
+	/// helper uses the mask given to start(). if the helper has gone
+	/// away the command is spawned locally
+	int spawn(const SpawnSpec& spec, pid_t* pid);
+
+	/// while held, the helper leaves its children unreaped, so the group
+	/// of a job being put together can't vanish before every process
+	/// has joined it and the terminal has been handed over
+	void hold() { hold_ = true; }
+	void release();
+
+	/// hand every status received so far to onStatus. never blocks
+	void drain();
+
+	/// in a forked child of the shell: the helper reports to the
+	/// parent, so forget it without stopping it
+	void detach();
+
+private:
+	bool recvReply(pid_t* pid, int* err);
+	/// the helper keeps it for the spawns that follow
+	bool sendEnv(char* const* envp);
+
+	int sock_ = -1;
+	pid_t pid_ = -1;
+	StatusFn onStatus_ = nullptr;
+	bool hold_ = false;
+	bool heldSent_ = false;
+	/// SpawnSpec::envGen of the environment the helper has
+	unsigned long envGen_ = 0;
+	/// statuses that came in while waiting for a spawn reply
+	std::vector<std::pair<pid_t, int>> pending_;
+	std::vector<char> buf_;
+};
+
+Zygote& getZygote();
+
+#endif